@@ -19,11 +19,33 @@ extern "C" {
 #endif
 
 #define LCJ_ABI_VERSION_MAJOR 1u
-#define LCJ_ABI_VERSION_MINOR 0u
+#define LCJ_ABI_VERSION_MINOR 23u
 #define LCJ_DIMENSION_COUNT 9u
+#define LCJ_WAIT_FOREVER 0xFFFFFFFFu
+#define LCJ_COMPRESSION_SLOTS 8u
 
 typedef struct lcj_reader lcj_reader;
 typedef struct lcj_bitmap lcj_bitmap;
+typedef struct lcj_scan lcj_scan;
+typedef struct lcj_queue lcj_queue;
+typedef struct lcj_writer lcj_writer;
+
+/*
+ * Thread safety.
+ *
+ * Functions taking an `lcj_reader` may be called on the same handle from any
+ * number of threads at once without external locking; only
+ * `lcj_reader_close` must not overlap other calls on the handle or outlive
+ * its scans and queues. Concurrent decodes read through the reader's stream
+ * in parallel, except with `LCJ_STREAM_LIBCZI`, whose reads take turns on a
+ * seek lock.
+ *
+ * An `lcj_bitmap` may be queried, copied, locked and unlocked from several
+ * threads at once; only `lcj_bitmap_close` must not overlap other calls on
+ * it. `lcj_queue_submit` and `lcj_queue_poll` may race each other. Calls on
+ * one `lcj_scan` or one `lcj_writer` must not overlap. Distinct handles are
+ * independent, and error messages are kept per thread.
+ */
 
 typedef enum lcj_status {
     LCJ_OK = 0,
@@ -55,6 +77,7 @@ typedef enum lcj_pixel_type {
     LCJ_PIXEL_BGR24 = 3,
     LCJ_PIXEL_BGR48 = 4,
     LCJ_PIXEL_BGR96_FLOAT = 8,
+    LCJ_PIXEL_BGRA32 = 9,
     LCJ_PIXEL_INVALID = 255
 } lcj_pixel_type;
 
@@ -105,6 +128,347 @@ typedef struct lcj_subblock_info {
     int32_t coordinate[LCJ_DIMENSION_COUNT];
 } lcj_subblock_info;
 
+typedef enum lcj_directory_flags {
+    LCJ_DIRECTORY_STORED_SIZE = 1
+} lcj_directory_flags;
+
+typedef struct lcj_subblock_directory_entry {
+    lcj_subblock_info info;
+    uint64_t file_position;
+    uint64_t stored_size;
+} lcj_subblock_directory_entry;
+
+/*
+ * Selects one plane. Bits in `coordinate_mask` and entries in `coordinate`
+ * use the `lcj_dimension` order, as in `lcj_subblock_info`.
+ */
+typedef struct lcj_plane_coordinate {
+    uint16_t coordinate_mask;
+    uint16_t reserved;
+    int32_t coordinate[LCJ_DIMENSION_COUNT];
+} lcj_plane_coordinate;
+
+/*
+ * `background` is an RGB fill in [0, 1] used when `fill_background` is
+ * nonzero; otherwise pixels not covered by a subblock are left untouched.
+ * Passing null options fills with black, sorts by M-index and enables
+ * libCZI's visibility check.
+ */
+typedef struct lcj_compose_options {
+    float background[3];
+    uint8_t fill_background;
+    uint8_t sort_by_m;
+    uint8_t visibility_check;
+    uint8_t reserved;
+} lcj_compose_options;
+
+/*
+ * One iterated dimension of a hyperslab read: coordinates `start` to
+ * `start + size - 1` of `dimension`, placed `stride` bytes apart in the
+ * destination.
+ */
+typedef struct lcj_hyperslab_range {
+    uint32_t dimension;
+    int32_t start;
+    int32_t size;
+    uint32_t reserved;
+    uint64_t stride;
+} lcj_hyperslab_range;
+
+/*
+ * Target layouts of `lcj_bitmap_copy_converted`:
+ *
+ * - `NATIVE` copies unchanged, like `lcj_bitmap_copy`.
+ * - `RGB` reorders BGR24 or BGR48 pixels to RGB with the same sample size.
+ * - `PLANAR` splits BGR24 or BGR48 into red, green and blue planes of 8- or
+ *   16-bit samples, `plane_stride` bytes apart.
+ * - `FLOAT32` converts Gray8 or Gray16 to `value * scale + offset`.
+ * - `UINT16` widens Gray8 to 16 bits.
+ */
+typedef enum lcj_copy_format {
+    LCJ_COPY_NATIVE = 0,
+    LCJ_COPY_RGB = 1,
+    LCJ_COPY_PLANAR = 2,
+    LCJ_COPY_FLOAT32 = 3,
+    LCJ_COPY_UINT16 = 4
+} lcj_copy_format;
+
+/*
+ * `scale` and `offset` apply to `LCJ_COPY_FLOAT32` only and `plane_stride`
+ * to `LCJ_COPY_PLANAR` only. Reserved fields must be zero.
+ */
+typedef struct lcj_copy_options {
+    uint32_t format;
+    uint32_t reserved0;
+    float scale;
+    float offset;
+    uint64_t plane_stride;
+    uint64_t reserved[4];
+} lcj_copy_options;
+
+/*
+ * How `lcj_bitmap_copy_binned` reduces each bin, per sample: the mean
+ * rounded to nearest for integer samples, the maximum, or the sum.
+ */
+typedef enum lcj_bin_mode {
+    LCJ_BIN_MEAN = 0,
+    LCJ_BIN_MAX = 1,
+    LCJ_BIN_SUM = 2
+} lcj_bin_mode;
+
+/*
+ * `factor` is the edge of a square bin in pixels, 1 to 256. Reserved fields
+ * must be zero.
+ */
+typedef struct lcj_bin_options {
+    uint32_t factor;
+    uint32_t mode;
+    uint64_t reserved[3];
+} lcj_bin_options;
+
+/*
+ * Destination layout of a binned copy. Pixels keep the source's samples in
+ * their order, for example blue, green and red for BGR24; samples are
+ * `sample_bytes` wide and floats when `sample_float` is set.
+ */
+typedef struct lcj_bin_layout {
+    uint32_t width;
+    uint32_t height;
+    uint32_t samples_per_pixel;
+    uint32_t sample_bytes;
+    uint8_t sample_float;
+    uint8_t reserved[7];
+    uint64_t row_bytes;
+} lcj_bin_layout;
+
+/*
+ * How one channel contributes to a composite. `black_point` and
+ * `white_point` are normalized to [0, 1] of the channel's sample range and
+ * `gamma` bends the curve between them, 1 being linear. With
+ * `enable_tinting` the channel is drawn in `tint_rgb`, otherwise in gray.
+ *
+ * `lut`, when not null, replaces the black point, white point and gamma with
+ * an explicit 8-bit look-up table of `lut_size` entries: 256 for 8-bit and
+ * 65536 for 16-bit channels. It is only read during the call. Reserved
+ * fields must be zero.
+ */
+typedef struct lcj_channel_display {
+    int32_t channel;
+    float weight;
+    float black_point;
+    float white_point;
+    float gamma;
+    uint8_t enable_tinting;
+    uint8_t tint_rgb[3];
+    const uint8_t* lut;
+    uint64_t lut_size;
+    uint64_t reserved[2];
+} lcj_channel_display;
+
+typedef struct lcj_guid {
+    uint32_t data1;
+    uint16_t data2;
+    uint16_t data3;
+    uint8_t data4[8];
+} lcj_guid;
+
+/*
+ * One attachment directory entry. `content_file_type` (for example "JPG" or
+ * "CZTIMS") and `name` (for example "Thumbnail") are NUL-terminated.
+ * `file_position` is the offset of the attachment segment and `data_size`
+ * the size of its payload in bytes.
+ */
+typedef struct lcj_attachment_info {
+    int32_t index;
+    uint32_t reserved0;
+    lcj_guid content_guid;
+    uint64_t file_position;
+    uint64_t data_size;
+    char content_file_type[16];
+    char name[88];
+} lcj_attachment_info;
+
+/*
+ * Pixel size in meters along each axis, from the document metadata. A value
+ * is only meaningful when its `valid` flag is set.
+ */
+typedef struct lcj_scaling {
+    double x;
+    double y;
+    double z;
+    uint8_t x_valid;
+    uint8_t y_valid;
+    uint8_t z_valid;
+    uint8_t reserved[5];
+} lcj_scaling;
+
+/*
+ * `color_rgb` is the channel color from the metadata when `color_valid` is
+ * set. `name_length` is the UTF-8 length of the channel name in bytes,
+ * excluding the terminating NUL.
+ */
+typedef struct lcj_channel_info {
+    int32_t channel;
+    uint8_t color_valid;
+    uint8_t color_rgb[3];
+    uint64_t name_length;
+} lcj_channel_info;
+
+/*
+ * Bounding boxes of one scene, in the coordinates of
+ * `lcj_statistics.bounding_box`.
+ */
+typedef struct lcj_scene_info {
+    int32_t scene;
+    uint32_t reserved;
+    lcj_rect_i32 bounding_box;
+    lcj_rect_i32 bounding_box_layer0;
+} lcj_scene_info;
+
+/*
+ * Input stream behind a file reader.
+ *
+ * `LCJ_STREAM_LIBCZI` is libCZI's own file stream. `LCJ_STREAM_PREAD` issues
+ * positional reads and keeps no file position, so concurrent reads do not
+ * serialize on a seek lock. `LCJ_STREAM_MMAP` maps the whole file read-only
+ * and serves reads from the mapping; the file must not shrink while the
+ * reader is open. `LCJ_STREAM_DEFAULT` lets the wrapper choose and is
+ * currently `LCJ_STREAM_PREAD`.
+ */
+typedef enum lcj_stream_kind {
+    LCJ_STREAM_DEFAULT = 0,
+    LCJ_STREAM_LIBCZI = 1,
+    LCJ_STREAM_PREAD = 2,
+    LCJ_STREAM_MMAP = 3
+} lcj_stream_kind;
+
+/*
+ * Options for `lcj_reader_open_utf8_ex`. Zero-initialized options behave like
+ * `lcj_reader_open_utf8`, and reserved fields must be zero.
+ *
+ * A nonzero `cache_max_bytes` attaches a decoded subblock cache with LRU
+ * eviction to the reader. `cache_max_subblocks` additionally bounds the number
+ * of cached subblocks; zero means no count limit. Only compressed subblocks
+ * are cached. `stream` holds an `lcj_stream_kind`.
+ *
+ * A `shared` of 1 opens the file through the process-wide reader pool: a
+ * path opened before with the same options, and whose size and modification
+ * time are unchanged, reuses the already parsed subblock directory and
+ * metadata instead of reading them again. Pooled handles to one file share
+ * its cache and metrics and are closed independently.
+ */
+typedef struct lcj_reader_options {
+    uint64_t cache_max_bytes;
+    uint32_t cache_max_subblocks;
+    uint32_t stream;
+    uint8_t shared;
+    uint8_t reserved0[7];
+    uint64_t reserved[5];
+} lcj_reader_options;
+
+typedef struct lcj_cache_statistics {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t memory_bytes;
+    uint32_t elements;
+    uint32_t reserved;
+} lcj_cache_statistics;
+
+/*
+ * Counters of one reader since it was opened or its metrics were last
+ * reset. Times are in nanoseconds, summed over all threads.
+ *
+ * `stream_*` cover every read from the file or memory, including those of
+ * composed plane reads. `decoded_subblocks` counts subblocks decoded by
+ * `lcj_reader_read_subblock_bitmap`, `lcj_reader_read_subblock_into`,
+ * scans and queues, indexed by raw compression mode, with modes from
+ * `LCJ_COMPRESSION_SLOTS - 1` up sharing the last slot; cache hits are not
+ * decodes. `copy_nanoseconds` covers copies out of decoded subblocks and
+ * bitmaps. `live_bitmap_bytes` is the pixel storage of open `lcj_bitmap`
+ * handles and `peak_bitmap_bytes` its maximum; a reset keeps the live value
+ * and restarts the peak from it.
+ */
+typedef struct lcj_reader_metrics {
+    uint64_t stream_reads;
+    uint64_t stream_bytes;
+    uint64_t stream_nanoseconds;
+    uint64_t decoded_subblocks[LCJ_COMPRESSION_SLOTS];
+    uint64_t decode_nanoseconds;
+    uint64_t copy_nanoseconds;
+    uint64_t live_bitmap_bytes;
+    uint64_t peak_bitmap_bytes;
+    uint64_t reserved[4];
+} lcj_reader_metrics;
+
+typedef enum lcj_request_kind {
+    LCJ_REQUEST_DECODE = 0,
+    LCJ_REQUEST_RAW = 1
+} lcj_request_kind;
+
+/*
+ * One finished queue request. `status` holds an `lcj_status`.
+ */
+typedef struct lcj_completion {
+    uint64_t request_id;
+    uint64_t user_data;
+    int32_t native_index;
+    int32_t status;
+} lcj_completion;
+
+/*
+ * Subblock compression modes of the writer, numbered like the raw
+ * compression mode stored in the file.
+ */
+typedef enum lcj_compression {
+    LCJ_COMPRESSION_NONE = 0,
+    LCJ_COMPRESSION_ZSTD0 = 5,
+    LCJ_COMPRESSION_ZSTD1 = 6
+} lcj_compression;
+
+/*
+ * Options for `lcj_writer_open_utf8`. Zero-initialized options create a new
+ * file with uncompressed subblocks, and reserved fields must be zero.
+ *
+ * `compression` holds an `lcj_compression` applied to every subblock. A
+ * nonzero `compression_level` overrides zstd's default level, and
+ * `hi_lo_byte_packing` stores 16-bit samples as separate high and low byte
+ * planes before zstd1 compression. `max_pending` bounds the subblocks held
+ * for compression and writing at once, zero meaning twice the pool size.
+ * A zero `file_guid` lets libCZI generate one.
+ */
+typedef struct lcj_writer_options {
+    lcj_guid file_guid;
+    uint32_t compression;
+    int32_t compression_level;
+    uint32_t max_pending;
+    uint8_t overwrite;
+    uint8_t hi_lo_byte_packing;
+    uint8_t reserved0[2];
+    uint64_t reserved[4];
+} lcj_writer_options;
+
+/*
+ * Where a written subblock goes. `plane` sets every dimension of the
+ * subblock, `logical_rect` places it in the image and the pixels passed
+ * hold `physical_width` x `physical_height` pixels of `pixel_type`. Pyramid
+ * subblocks have a physical size below the logical size and a nonzero
+ * `pyramid_type`, numbered as in `lcj_subblock_info`. `m_index` is stored
+ * when `m_index_present` is set. Reserved fields must be zero.
+ */
+typedef struct lcj_subblock_write {
+    lcj_plane_coordinate plane;
+    int32_t m_index;
+    uint8_t m_index_present;
+    uint8_t pixel_type;
+    uint8_t pyramid_type;
+    uint8_t reserved0;
+    lcj_rect_i32 logical_rect;
+    uint32_t physical_width;
+    uint32_t physical_height;
+    uint64_t reserved[2];
+} lcj_subblock_write;
+
 typedef struct lcj_bitmap_info {
     uint8_t pixel_type;
     uint8_t reserved[3];
@@ -127,8 +491,54 @@ LCJ_API lcj_status lcj_reader_open_utf8(
     const char* path,
     lcj_reader** reader);
 
+LCJ_API lcj_status lcj_reader_open_utf8_ex(
+    const char* path,
+    const lcj_reader_options* options,
+    lcj_reader** reader);
+
+/*
+ * Open a CZI held in caller-owned memory. The wrapper reads `data` in place
+ * and never writes to it; the region must stay valid and unchanged until
+ * `lcj_reader_close` returns.
+ */
+LCJ_API lcj_status lcj_reader_open_memory(
+    const void* data,
+    size_t size,
+    lcj_reader** reader);
+
 LCJ_API lcj_status lcj_reader_close(lcj_reader* reader);
 
+/*
+ * Number of parsed files the reader pool keeps after their last handle is
+ * closed; 64 by default. Zero releases every file as soon as it is unused.
+ */
+LCJ_API lcj_status lcj_reader_pool_set_idle_capacity(size_t capacity);
+
+/*
+ * Counters of the decoded subblock cache. Readers opened without a cache
+ * report all zeros. The cache serves `lcj_reader_read_subblock_bitmap`,
+ * `lcj_reader_read_subblock_into` and the composed plane reads.
+ */
+LCJ_API lcj_status lcj_reader_cache_statistics(
+    lcj_reader* reader,
+    lcj_cache_statistics* statistics);
+
+/*
+ * Drop every cached subblock. Counters are kept.
+ */
+LCJ_API lcj_status lcj_reader_cache_clear(lcj_reader* reader);
+
+/*
+ * Read the reader's metrics. Counters are updated without synchronizing
+ * with each other, so a snapshot taken during concurrent reads may be
+ * slightly inconsistent across fields.
+ */
+LCJ_API lcj_status lcj_reader_get_metrics(
+    lcj_reader* reader,
+    lcj_reader_metrics* metrics);
+
+LCJ_API lcj_status lcj_reader_reset_metrics(lcj_reader* reader);
+
 LCJ_API lcj_status lcj_reader_statistics(
     lcj_reader* reader,
     lcj_statistics* statistics);
@@ -147,16 +557,458 @@ LCJ_API lcj_status lcj_reader_metadata_copy(
     void* destination,
     size_t destination_size);
 
+/*
+ * Structured values from the document metadata. The metadata segment and
+ * its parsed form are read on first use and kept with the reader, as is the
+ * XML returned by `lcj_reader_metadata_copy`. Files without valid metadata
+ * XML fail with `LCJ_UNSUPPORTED`.
+ */
+LCJ_API lcj_status lcj_reader_scaling(
+    lcj_reader* reader,
+    lcj_scaling* scaling);
+
+LCJ_API lcj_status lcj_reader_channel_count(
+    lcj_reader* reader,
+    int32_t* count);
+
+/*
+ * `channel` indexes the channels of the metadata, from 0 to
+ * `lcj_reader_channel_count` - 1.
+ */
+LCJ_API lcj_status lcj_reader_channel_info(
+    lcj_reader* reader,
+    int32_t channel,
+    lcj_channel_info* info);
+
+/*
+ * Copy the UTF-8 channel name with a terminating NUL. `length` receives the
+ * name length without the NUL, and the call fails with
+ * `LCJ_BUFFER_TOO_SMALL` unless `capacity` exceeds it.
+ */
+LCJ_API lcj_status lcj_reader_channel_name(
+    lcj_reader* reader,
+    int32_t channel,
+    char* name,
+    size_t capacity,
+    size_t* length);
+
+/*
+ * List the scenes of the subblock directory in ascending scene order.
+ * `count` receives the number of scenes, and the call fails with
+ * `LCJ_BUFFER_TOO_SMALL` when it exceeds `capacity`. Files without an S
+ * dimension have no scenes.
+ */
+LCJ_API lcj_status lcj_reader_scenes(
+    lcj_reader* reader,
+    lcj_scene_info* scenes,
+    size_t capacity,
+    size_t* count);
+
+/*
+ * List the attachments in directory order. `count` receives the number of
+ * attachments, and the call fails with `LCJ_BUFFER_TOO_SMALL` when it
+ * exceeds `capacity`. Payloads are not read; each size costs one small read
+ * of the attachment's segment header.
+ */
+LCJ_API lcj_status lcj_reader_attachment_directory(
+    lcj_reader* reader,
+    lcj_attachment_info* entries,
+    size_t capacity,
+    size_t* count);
+
+/*
+ * Index of the first attachment matching `content_file_type` and `name`,
+ * either of which may be null to match anything, or -1 if none matches.
+ */
+LCJ_API lcj_status lcj_reader_find_attachment(
+    lcj_reader* reader,
+    const char* content_file_type,
+    const char* name,
+    int32_t* index);
+
+/*
+ * Copy the payload of one attachment, `lcj_attachment_info.data_size`
+ * bytes, straight from the stream into caller-owned storage.
+ */
+LCJ_API lcj_status lcj_reader_attachment_copy(
+    lcj_reader* reader,
+    int32_t index,
+    void* destination,
+    size_t destination_size);
+
 LCJ_API lcj_status lcj_reader_subblock_info(
     lcj_reader* reader,
     int32_t native_index,
     lcj_subblock_info* info);
 
+/*
+ * Fill `entries` for consecutive subblocks starting at `first_index` in one
+ * pass over the subblock directory. At most `entry_capacity` entries are
+ * written; `entry_count` receives the number actually written, which is less
+ * than the capacity only when the directory ends. Passing `first_index` 0 and
+ * `lcj_statistics.subblock_count` as capacity exports the whole directory.
+ *
+ * `file_position` is always filled. `stored_size` is the on-disk size of the
+ * subblock segment including its segment header; it is only read when
+ * `flags` contains `LCJ_DIRECTORY_STORED_SIZE` and is zero otherwise, because
+ * it costs one small stream read per subblock; those reads run in parallel on
+ * native threads. Paging with a bounded capacity does not rescan the
+ * directory for each page.
+ */
+LCJ_API lcj_status lcj_reader_subblock_directory(
+    lcj_reader* reader,
+    int32_t first_index,
+    uint32_t flags,
+    lcj_subblock_directory_entry* entries,
+    size_t entry_capacity,
+    size_t* entry_count);
+
+/*
+ * Compose all layer-0 subblocks of one plane that overlap `roi` into
+ * caller-owned storage. `roi` uses the `lcj_statistics.bounding_box`
+ * coordinate system and the destination holds `roi->width` x `roi->height`
+ * pixels with the stride rules of `lcj_bitmap_copy`. `LCJ_PIXEL_INVALID`
+ * selects the pixel type of the plane's channel.
+ */
+LCJ_API lcj_status lcj_reader_read_plane_roi(
+    lcj_reader* reader,
+    const lcj_plane_coordinate* plane,
+    const lcj_rect_i32* roi,
+    lcj_pixel_type pixel_type,
+    const lcj_compose_options* options,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride);
+
+/*
+ * Size in pixels of `roi` rendered at `zoom`, which must be in (0, 1].
+ */
+LCJ_API lcj_status lcj_reader_scaled_size(
+    lcj_reader* reader,
+    const lcj_rect_i32* roi,
+    float zoom,
+    uint32_t* width,
+    uint32_t* height);
+
+/*
+ * Like `lcj_reader_read_plane_roi`, but renders `roi` downscaled by `zoom`
+ * and reads from the pyramid layer closest to that zoom instead of layer 0.
+ * The destination holds the pixels reported by `lcj_reader_scaled_size`.
+ */
+LCJ_API lcj_status lcj_reader_read_plane_scaled(
+    lcj_reader* reader,
+    const lcj_plane_coordinate* plane,
+    const lcj_rect_i32* roi,
+    float zoom,
+    lcj_pixel_type pixel_type,
+    const lcj_compose_options* options,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride);
+
+/*
+ * Compose every plane of a hyperslab into one caller-owned array. Each plane
+ * is `base` (which may be null) with the dimensions of `ranges` set to one
+ * coordinate of each range; each range names a different dimension. A plane
+ * holds `roi` as in `lcj_reader_read_plane_roi` and starts at the sum of
+ * coordinate offset times range stride, so a Julia `(x, y, z, c, t)` array
+ * passes the byte strides of its third and later axes. Planes must not
+ * overlap and must all fit in `destination_size`.
+ *
+ * Planes are composed in parallel on up to `thread_count` threads, zero
+ * meaning one per hardware thread. `LCJ_PIXEL_INVALID` requires every
+ * selected channel to share a pixel type. On failure the status and message
+ * of the first failing plane are returned and other planes may be partially
+ * written.
+ */
+LCJ_API lcj_status lcj_reader_read_hyperslab(
+    lcj_reader* reader,
+    const lcj_plane_coordinate* base,
+    const lcj_hyperslab_range* ranges,
+    size_t range_count,
+    const lcj_rect_i32* roi,
+    lcj_pixel_type pixel_type,
+    const lcj_compose_options* options,
+    uint32_t thread_count,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride);
+
+/*
+ * Render a display-ready image of several channels. Each channel of
+ * `channels` is composed at `plane` with its C coordinate replaced, mapped
+ * through its display curve and tint, and blended into `destination` by
+ * weight. `pixel_type` is `LCJ_PIXEL_BGR24` or `LCJ_PIXEL_BGRA32`, the latter
+ * with opaque alpha. `zoom` below 1 reads from the pyramid like
+ * `lcj_reader_read_plane_scaled`, and the destination then holds the size
+ * reported by `lcj_reader_scaled_size`; at 1 it holds `roi` as in
+ * `lcj_reader_read_plane_roi`.
+ *
+ * Null `channels` uses the enabled channels of the document's display
+ * settings as reported by `lcj_reader_display_settings`. Channels are
+ * composed in parallel; floating-point channels are not supported.
+ */
+LCJ_API lcj_status lcj_reader_read_composite(
+    lcj_reader* reader,
+    const lcj_plane_coordinate* plane,
+    const lcj_rect_i32* roi,
+    float zoom,
+    const lcj_channel_display* channels,
+    size_t channel_count,
+    lcj_pixel_type pixel_type,
+    const lcj_compose_options* options,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride);
+
+/*
+ * Export the enabled channels of the document's display settings. `count`
+ * receives the number of enabled channels, and the call fails with
+ * `LCJ_BUFFER_TOO_SMALL` when it exceeds `capacity`. Spline gradation curves
+ * are reported as linear between the black and white points, and `lut` is
+ * always null. Documents without display settings fail with
+ * `LCJ_UNSUPPORTED`.
+ */
+LCJ_API lcj_status lcj_reader_display_settings(
+    lcj_reader* reader,
+    lcj_channel_display* channels,
+    size_t capacity,
+    size_t* count);
+
 LCJ_API lcj_status lcj_reader_read_subblock_bitmap(
     lcj_reader* reader,
     int32_t native_index,
     lcj_bitmap** bitmap);
 
+/*
+ * Decode one subblock straight into caller-owned storage without creating an
+ * `lcj_bitmap`. The destination receives `physical_width` x `physical_height`
+ * pixels of `pixel_type` as reported by `lcj_reader_subblock_info`, with the
+ * same stride and size rules as `lcj_bitmap_copy`. Uncompressed payloads are
+ * copied directly from the subblock data.
+ */
+LCJ_API lcj_status lcj_reader_read_subblock_into(
+    lcj_reader* reader,
+    int32_t native_index,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride);
+
+/*
+ * Decode `count` subblocks concurrently, item `i` going to `destinations[i]`
+ * exactly as `lcj_reader_read_subblock_into` would write it. Work runs on the
+ * calling thread and a shared native thread pool; `thread_count` caps the
+ * threads used and zero uses all of them. Destinations must not overlap.
+ *
+ * When `results` is not null it receives one status per item. The function
+ * returns `LCJ_OK` when every item succeeded, and otherwise the status and
+ * error message of the lowest-numbered failed item.
+ */
+LCJ_API lcj_status lcj_reader_read_subblocks_into(
+    lcj_reader* reader,
+    size_t count,
+    const int32_t* native_indices,
+    void* const* destinations,
+    const size_t* destination_sizes,
+    const size_t* destination_row_strides,
+    uint32_t thread_count,
+    lcj_status* results);
+
+/*
+ * Size in bytes of a subblock's still-compressed data and its raw
+ * compression mode, read from the segment header without loading the data.
+ */
+LCJ_API lcj_status lcj_reader_subblock_raw_size(
+    lcj_reader* reader,
+    int32_t native_index,
+    size_t* size,
+    int32_t* compression_raw);
+
+/*
+ * Copy a subblock's data exactly as stored in the file, without decoding.
+ * `destination_size` must be at least the size from
+ * `lcj_reader_subblock_raw_size`.
+ */
+LCJ_API lcj_status lcj_reader_subblock_raw_copy(
+    lcj_reader* reader,
+    int32_t native_index,
+    void* destination,
+    size_t destination_size);
+
+/*
+ * Find the subblocks whose logical rectangle intersects `roi`, restricted to
+ * a plane and pyramid layer, in ascending index order. A null plane or roi
+ * does not filter, and a negative `layer` accepts every layer; layer 0 holds
+ * the full-resolution subblocks. `count` receives the number of matches, and
+ * the call fails with `LCJ_BUFFER_TOO_SMALL` when it exceeds `capacity`.
+ *
+ * The first query builds a grid index over the directory; later queries only
+ * visit the grid cells overlapping `roi`.
+ */
+LCJ_API lcj_status lcj_reader_query_subblocks(
+    lcj_reader* reader,
+    const lcj_plane_coordinate* plane,
+    const lcj_rect_i32* roi,
+    int32_t layer,
+    int32_t* native_indices,
+    size_t capacity,
+    size_t* count);
+
+/*
+ * Reorder subblock indices in place by the file position of their segments,
+ * keeping the given order between equal positions.
+ */
+LCJ_API lcj_status lcj_reader_sort_by_file_position(
+    lcj_reader* reader,
+    int32_t* native_indices,
+    size_t count);
+
+/*
+ * Collect every subblock matching `plane` in file order. A null plane
+ * selects all subblocks; otherwise the dimensions in its mask act as a
+ * filter. `count` receives the number of matches, and the call fails with
+ * `LCJ_BUFFER_TOO_SMALL` when it exceeds `capacity`.
+ */
+LCJ_API lcj_status lcj_reader_plan_scan(
+    lcj_reader* reader,
+    const lcj_plane_coordinate* plane,
+    int32_t* native_indices,
+    size_t capacity,
+    size_t* count);
+
+/*
+ * Iterate over subblocks in the given order, typically a plan from
+ * `lcj_reader_plan_scan`, keeping up to `readahead` segment reads in flight
+ * on native threads; zero reads synchronously. The reader must stay open
+ * until `lcj_scan_close`.
+ *
+ * `lcj_scan_next` returns the next decoded subblock as a bitmap that the
+ * caller closes. After the last item it succeeds with `native_index` -1 and
+ * a null bitmap. A failed item is reported once and then skipped.
+ */
+LCJ_API lcj_status lcj_scan_open(
+    lcj_reader* reader,
+    const int32_t* native_indices,
+    size_t count,
+    uint32_t readahead,
+    lcj_scan** scan);
+
+LCJ_API lcj_status lcj_scan_next(
+    lcj_scan* scan,
+    int32_t* native_index,
+    lcj_bitmap** bitmap);
+
+LCJ_API lcj_status lcj_scan_close(lcj_scan* scan);
+
+/*
+ * Non-blocking request queue over one reader.
+ *
+ * `lcj_queue_submit` returns at once with a request id. A decode request
+ * writes like `lcj_reader_read_subblock_into`; a raw request writes like
+ * `lcj_reader_subblock_raw_copy` and ignores the row stride. At most
+ * `max_in_flight` requests run at a time on native threads, zero meaning one
+ * per pool thread. The destination must stay valid until the request's
+ * completion has been polled.
+ *
+ * `lcj_queue_poll` waits up to `timeout_ms` for completions, zero polling
+ * without waiting and `LCJ_WAIT_FOREVER` waiting indefinitely, and returns at
+ * most `capacity` of them in finishing order. Per-request errors are only
+ * reported as status codes.
+ *
+ * `lcj_queue_close` drops requests that have not started and waits for the
+ * running ones. The reader must stay open until then.
+ */
+LCJ_API lcj_status lcj_queue_open(
+    lcj_reader* reader,
+    uint32_t max_in_flight,
+    lcj_queue** queue);
+
+LCJ_API lcj_status lcj_queue_submit(
+    lcj_queue* queue,
+    lcj_request_kind kind,
+    int32_t native_index,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride,
+    uint64_t user_data,
+    uint64_t* request_id);
+
+LCJ_API lcj_status lcj_queue_poll(
+    lcj_queue* queue,
+    lcj_completion* completions,
+    size_t capacity,
+    uint32_t timeout_ms,
+    size_t* count);
+
+LCJ_API lcj_status lcj_queue_close(lcj_queue* queue);
+
+/*
+ * Create a CZI file. Fails with `LCJ_IO_ERROR` when the file exists and
+ * `options->overwrite` is not set.
+ *
+ * `lcj_writer_add_subblock` copies the rows of `data`, `row_stride` bytes
+ * apart, and returns while the subblock is compressed on native threads;
+ * it only blocks while `max_pending` subblocks are already in flight.
+ * Subblocks, metadata and attachments reach the file in the order they were
+ * added. A failed compression or write is reported by every later call on
+ * the writer, including `lcj_writer_close`, and nothing more is written.
+ *
+ * `lcj_writer_add_metadata` stores `size` bytes of UTF-8 XML and may be
+ * called once. When it was never called, `lcj_writer_close` stores the
+ * minimal metadata libCZI derives from the subblocks.
+ *
+ * `lcj_writer_add_attachment` stores `size` bytes under a content GUID,
+ * a file type of at most 8 characters (for example "JPG") and a name of at
+ * most 80 characters (for example "Thumbnail").
+ *
+ * `lcj_writer_close` waits for pending work, finishes the file and frees
+ * the writer even when it fails; a file whose writer failed is incomplete.
+ * Calls on one writer must not overlap.
+ */
+LCJ_API lcj_status lcj_writer_open_utf8(
+    const char* path,
+    const lcj_writer_options* options,
+    lcj_writer** writer);
+
+LCJ_API lcj_status lcj_writer_add_subblock(
+    lcj_writer* writer,
+    const lcj_subblock_write* subblock,
+    const void* data,
+    size_t data_size,
+    size_t row_stride);
+
+LCJ_API lcj_status lcj_writer_add_metadata(
+    lcj_writer* writer,
+    const char* xml,
+    size_t size);
+
+LCJ_API lcj_status lcj_writer_add_attachment(
+    lcj_writer* writer,
+    const lcj_guid* content_guid,
+    const char* content_file_type,
+    const char* name,
+    const void* data,
+    size_t size);
+
+LCJ_API lcj_status lcj_writer_close(lcj_writer* writer);
+
+/*
+ * Rewrite the CZI file at `source` into a new file at `destination` as if
+ * every subblock were decoded and added to an `lcj_writer` opened with
+ * `options`. Subblocks already stored with the target compression are
+ * copied as stored. Subblocks keep their file order and their own metadata
+ * and attachments, and the document metadata and attachments are copied
+ * unchanged.
+ *
+ * Reading, decoding and encoding run on native threads with at most
+ * `options->max_pending` subblocks in memory. `destination` must not name
+ * the source, and a failed transcode leaves an incomplete file behind.
+ */
+LCJ_API lcj_status lcj_transcode_file(
+    const char* source,
+    const char* destination,
+    const lcj_writer_options* options);
+
 LCJ_API lcj_status lcj_bitmap_get_info(
     lcj_bitmap* bitmap,
     lcj_bitmap_info* info);
@@ -166,7 +1018,8 @@ LCJ_API lcj_status lcj_bitmap_get_info(
  *
  * `destination_row_stride` is measured in bytes and must be at least
  * `lcj_bitmap_info.row_bytes`. `destination_size` must cover the last copied
- * row. The wrapper performs no pixel conversion.
+ * row. Pixels are copied unchanged; `lcj_bitmap_copy_converted` converts
+ * them during the copy.
  */
 LCJ_API lcj_status lcj_bitmap_copy(
     lcj_bitmap* bitmap,
@@ -174,6 +1027,67 @@ LCJ_API lcj_status lcj_bitmap_copy(
     size_t destination_size,
     size_t destination_row_stride);
 
+/*
+ * Copy the decoded bitmap into caller-owned storage, converting every row to
+ * `options->format` on the way. Each destination row holds `width` pixels of
+ * the target layout, and stride and size rules follow `lcj_bitmap_copy`;
+ * with `LCJ_COPY_PLANAR` they apply to each plane and `destination_size`
+ * must also cover the blue plane at twice `plane_stride`. Pixel types the
+ * format does not accept fail with `LCJ_UNSUPPORTED`.
+ *
+ * Conversion uses vector kernels selected for the running CPU.
+ */
+LCJ_API lcj_status lcj_bitmap_copy_converted(
+    lcj_bitmap* bitmap,
+    const lcj_copy_options* options,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride);
+
+/*
+ * Copy the decoded bitmap reduced by `options->factor` in both directions,
+ * each destination pixel combining a factor x factor bin of source pixels.
+ * Bins on the right and bottom edges cover the remaining pixels only, so the
+ * destination is the source size divided by the factor and rounded up.
+ *
+ * Mean and max keep the source sample type. Sum widens 8- and 16-bit
+ * samples to 32-bit unsigned integers and keeps floats, which cannot
+ * overflow at the largest factor. `lcj_bitmap_binned_layout` reports the
+ * destination layout; stride and size rules follow `lcj_bitmap_copy` with
+ * its `row_bytes` and `height`.
+ *
+ * Every pixel type is supported. Rows are accumulated with vector kernels
+ * selected for the running CPU.
+ */
+LCJ_API lcj_status lcj_bitmap_binned_layout(
+    lcj_bitmap* bitmap,
+    const lcj_bin_options* options,
+    lcj_bin_layout* layout);
+
+LCJ_API lcj_status lcj_bitmap_copy_binned(
+    lcj_bitmap* bitmap,
+    const lcj_bin_options* options,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride);
+
+/*
+ * Expose the decoded pixels without copying them.
+ *
+ * `data` points at the first row and `row_stride` is the distance between
+ * rows in bytes; each row holds `lcj_bitmap_info.row_bytes` valid bytes. The
+ * view is read-only and stays valid until the matching `lcj_bitmap_unlock` or
+ * `lcj_bitmap_close`, whichever comes first. Locks nest and may be taken
+ * and released from several threads at once, and closing a bitmap releases
+ * any locks that are still held.
+ */
+LCJ_API lcj_status lcj_bitmap_lock(
+    lcj_bitmap* bitmap,
+    const void** data,
+    size_t* row_stride);
+
+LCJ_API lcj_status lcj_bitmap_unlock(lcj_bitmap* bitmap);
+
 LCJ_API lcj_status lcj_bitmap_close(lcj_bitmap* bitmap);
 
 #ifdef __cplusplus
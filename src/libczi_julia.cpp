@@ -1,28 +1,128 @@
 #include "libczi_julia.h"
 
+#include "pixel_kernels.h"
+
 #include "libCZI.h"
+#include "libCZI_compress.h"
 #include "libCZI_exceptions.h"
 
+#if defined(_WIN32)
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
 #include <codecvt>
+#include <condition_variable>
 #include <cstddef>
 #include <cstring>
+#include <deque>
 #include <exception>
+#include <functional>
+#include <future>
 #include <ios>
 #include <iterator>
 #include <limits>
+#include <list>
 #include <locale>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <new>
 #include <stdexcept>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace {
+class subblock_cache;
+struct spatial_index;
+struct reader_metrics;
+
+struct attachment_record {
+    uint64_t file_position;
+    uint64_t data_size;
+};
+}
+
+namespace {
+/*
+ * One parsed file: libCZI's reader with its stream, cache and metrics, and
+ * everything derived lazily from the directory and metadata. Handles opened
+ * through the reader pool share a core.
+ */
+struct reader_core {
+    std::shared_ptr<libCZI::ICZIReader> value;
+    std::shared_ptr<libCZI::IStream> stream;
+    std::shared_ptr<subblock_cache> cache;
+    std::shared_ptr<reader_metrics> metrics;
+    bool pooled = false;
+    std::once_flag positions_once;
+    std::vector<uint64_t> positions;
+    std::once_flag spatial_once;
+    std::unique_ptr<spatial_index> spatial;
+    std::once_flag attachments_once;
+    std::vector<attachment_record> attachments;
+    std::once_flag metadata_once;
+    std::shared_ptr<libCZI::IMetadataSegment> metadata;
+    std::once_flag document_once;
+    std::shared_ptr<libCZI::ICziMultiDimensionDocumentInfo> document;
+};
+}
 
+// The pointers are copies of the core's, saving hot paths an indirection.
 struct lcj_reader {
     std::shared_ptr<libCZI::ICZIReader> value;
+    std::shared_ptr<libCZI::IStream> stream;
+    std::shared_ptr<subblock_cache> cache;
+    std::shared_ptr<reader_metrics> metrics;
+    std::shared_ptr<reader_core> core;
 };
 
 struct lcj_bitmap {
     std::shared_ptr<libCZI::IBitmapData> value;
+    std::atomic<uint32_t> lock_count{0};
+    std::shared_ptr<reader_metrics> metrics;
+    uint64_t bytes = 0;
+};
+
+namespace {
+struct queue_state;
+struct writer_state;
+}
+
+struct lcj_queue {
+    std::shared_ptr<queue_state> state;
+};
+
+struct lcj_writer {
+    std::shared_ptr<writer_state> state;
+};
+
+struct lcj_scan {
+    lcj_reader* reader = nullptr;
+    std::vector<int32_t> indices;
+    uint32_t readahead = 0;
+    size_t next_read = 0;
+    std::deque<std::future<std::shared_ptr<libCZI::ISubBlock>>> pending;
 };
 
 static_assert(sizeof(lcj_version) == 16, "lcj_version ABI size changed");
@@ -31,13 +131,77 @@ static_assert(sizeof(lcj_dim_bounds) == 12, "lcj_dim_bounds ABI size changed");
 static_assert(sizeof(lcj_statistics) == 48, "lcj_statistics ABI size changed");
 static_assert(sizeof(lcj_subblock_info) == 80, "lcj_subblock_info ABI size changed");
 static_assert(sizeof(lcj_bitmap_info) == 24, "lcj_bitmap_info ABI size changed");
+static_assert(
+    sizeof(lcj_plane_coordinate) == 40,
+    "lcj_plane_coordinate ABI size changed");
+static_assert(
+    sizeof(lcj_compose_options) == 16,
+    "lcj_compose_options ABI size changed");
+static_assert(
+    sizeof(lcj_subblock_directory_entry) == 96,
+    "lcj_subblock_directory_entry ABI size changed");
+
+static_assert(
+    sizeof(lcj_reader_options) == 64,
+    "lcj_reader_options ABI size changed");
+static_assert(
+    sizeof(lcj_cache_statistics) == 40,
+    "lcj_cache_statistics ABI size changed");
+
+static_assert(
+    sizeof(lcj_completion) == 24,
+    "lcj_completion ABI size changed");
+static_assert(
+    sizeof(lcj_hyperslab_range) == 24,
+    "lcj_hyperslab_range ABI size changed");
+static_assert(
+    sizeof(lcj_copy_options) == 56,
+    "lcj_copy_options ABI size changed");
+static_assert(
+    sizeof(lcj_channel_display) == 56,
+    "lcj_channel_display ABI size changed");
+static_assert(sizeof(lcj_guid) == 16, "lcj_guid ABI size changed");
+static_assert(
+    sizeof(lcj_attachment_info) == 144,
+    "lcj_attachment_info ABI size changed");
+static_assert(sizeof(lcj_scaling) == 32, "lcj_scaling ABI size changed");
+static_assert(
+    sizeof(lcj_channel_info) == 16,
+    "lcj_channel_info ABI size changed");
+static_assert(
+    sizeof(lcj_scene_info) == 40,
+    "lcj_scene_info ABI size changed");
+static_assert(
+    sizeof(lcj_reader_metrics) == 152,
+    "lcj_reader_metrics ABI size changed");
+static_assert(
+    sizeof(lcj_writer_options) == 64,
+    "lcj_writer_options ABI size changed");
+static_assert(
+    sizeof(lcj_subblock_write) == 88,
+    "lcj_subblock_write ABI size changed");
+static_assert(
+    sizeof(lcj_bin_options) == 32,
+    "lcj_bin_options ABI size changed");
+static_assert(
+    sizeof(lcj_bin_layout) == 32,
+    "lcj_bin_layout ABI size changed");
 
 static_assert(
     offsetof(lcj_subblock_info, coordinate) == 44,
     "lcj_subblock_info coordinate offset changed");
+static_assert(
+    offsetof(lcj_subblock_directory_entry, file_position) == 80,
+    "lcj_subblock_directory_entry file_position offset changed");
 static_assert(
     offsetof(lcj_bitmap_info, row_bytes) == 16,
     "lcj_bitmap_info row_bytes offset changed");
+static_assert(
+    offsetof(lcj_channel_display, lut) == 24,
+    "lcj_channel_display lut offset changed");
+static_assert(
+    offsetof(lcj_attachment_info, name) == 56,
+    "lcj_attachment_info name offset changed");
 
 namespace {
 
@@ -53,6 +217,18 @@ public:
     using std::runtime_error::runtime_error;
 };
 
+// Reports the first failed item of a batch with that item's own status.
+class batch_failure : public std::runtime_error {
+public:
+    batch_failure(lcj_status status, const std::string& message)
+        : std::runtime_error(message),
+          status(status)
+    {
+    }
+
+    lcj_status status;
+};
+
 void clear_error()
 {
     last_error.clear();
@@ -73,6 +249,9 @@ lcj_status protect(Function&& function)
         function();
         return LCJ_OK;
     }
+    catch (const batch_failure& error) {
+        return fail(error.status, error.what());
+    }
     catch (const std::bad_alloc& error) {
         return fail(LCJ_OUT_OF_MEMORY, error.what());
     }
@@ -105,218 +284,3945 @@ lcj_status protect(Function&& function)
     }
 }
 
-std::wstring utf8_to_wstring(const char* path)
-{
-#if defined(_WIN32)
-    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> conversion;
-#else
-    std::wstring_convert<std::codecvt_utf8<wchar_t>> conversion;
-#endif
-    return conversion.from_bytes(path);
-}
-
-libCZI::DimensionIndex to_libczi_dimension(lcj_dimension dimension)
-{
-    switch (dimension) {
-    case LCJ_DIM_Z: return libCZI::DimensionIndex::Z;
-    case LCJ_DIM_C: return libCZI::DimensionIndex::C;
-    case LCJ_DIM_T: return libCZI::DimensionIndex::T;
-    case LCJ_DIM_R: return libCZI::DimensionIndex::R;
-    case LCJ_DIM_S: return libCZI::DimensionIndex::S;
-    case LCJ_DIM_I: return libCZI::DimensionIndex::I;
-    case LCJ_DIM_H: return libCZI::DimensionIndex::H;
-    case LCJ_DIM_V: return libCZI::DimensionIndex::V;
-    case LCJ_DIM_B: return libCZI::DimensionIndex::B;
+/*
+ * Fixed set of native threads shared by every batch entry point. It is
+ * intentionally leaked: joining threads from a static destructor can
+ * deadlock while a shared library is being unloaded.
+ */
+class worker_pool {
+public:
+    explicit worker_pool(unsigned thread_count)
+    {
+        threads_.reserve(thread_count);
+        for (unsigned i = 0; i < thread_count; ++i) {
+            threads_.emplace_back([this] { run(); });
+        }
     }
 
-    throw std::invalid_argument("invalid CZI dimension");
-}
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
 
+    unsigned size() const
+    {
+        return static_cast<unsigned>(threads_.size());
+    }
 
-uint8_t to_lcj_pixel_type(libCZI::PixelType pixel_type)
-{
-    switch (pixel_type) {
-    case libCZI::PixelType::Gray8: return LCJ_PIXEL_GRAY8;
-    case libCZI::PixelType::Gray16: return LCJ_PIXEL_GRAY16;
-    case libCZI::PixelType::Gray32Float: return LCJ_PIXEL_GRAY32_FLOAT;
-    case libCZI::PixelType::Bgr24: return LCJ_PIXEL_BGR24;
-    case libCZI::PixelType::Bgr48: return LCJ_PIXEL_BGR48;
-    case libCZI::PixelType::Bgr96Float: return LCJ_PIXEL_BGR96_FLOAT;
-    default: return LCJ_PIXEL_INVALID;
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            tasks_.push_back(std::move(task));
+        }
+        ready_.notify_one();
     }
-}
 
-uint8_t to_lcj_pyramid_type(libCZI::SubBlockPyramidType pyramid_type)
-{
-    switch (pyramid_type) {
-    case libCZI::SubBlockPyramidType::None: return 0;
-    case libCZI::SubBlockPyramidType::SingleSubBlock: return 1;
-    case libCZI::SubBlockPyramidType::MultiSubBlock: return 2;
-    default: return 255;
+private:
+    void run()
+    {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this] { return !tasks_.empty(); });
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
     }
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::thread> threads_;
+};
+
+worker_pool& shared_pool()
+{
+    static worker_pool* pool = new worker_pool(
+        std::max(1u, std::thread::hardware_concurrency()));
+    return *pool;
 }
 
-const libCZI::DimensionIndex dimensions[LCJ_DIMENSION_COUNT] = {
-    libCZI::DimensionIndex::Z,
-    libCZI::DimensionIndex::C,
-    libCZI::DimensionIndex::T,
-    libCZI::DimensionIndex::R,
-    libCZI::DimensionIndex::S,
-    libCZI::DimensionIndex::I,
-    libCZI::DimensionIndex::H,
-    libCZI::DimensionIndex::V,
-    libCZI::DimensionIndex::B,
+struct parallel_state {
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    std::condition_variable idle;
+    unsigned active = 0;
+    bool closed = false;
 };
 
-lcj_rect_i32 convert_rect(const libCZI::IntRect& rectangle)
+/*
+ * Run `body(i)` for every i in [0, count) on the calling thread plus up to
+ * `thread_count - 1` pool threads; zero means one per hardware thread. The
+ * body must not throw. Helpers that start after the caller has drained the
+ * range return immediately, so nested calls from pool threads cannot
+ * deadlock on queued helpers.
+ */
+template<class Function>
+void parallel_for(size_t count, uint32_t thread_count, const Function& body)
 {
-    return {
-        static_cast<int32_t>(rectangle.x),
-        static_cast<int32_t>(rectangle.y),
-        static_cast<int32_t>(rectangle.w),
-        static_cast<int32_t>(rectangle.h),
+    if (count == 0) {
+        return;
+    }
+
+    auto& pool = shared_pool();
+    const size_t wanted = thread_count == 0 ? pool.size() + 1 : thread_count;
+    const auto helpers = std::min<size_t>(
+        {wanted - 1, count - 1, static_cast<size_t>(pool.size())});
+
+    auto state = std::make_shared<parallel_state>();
+    const auto drain = [&state, count, &body] {
+        for (auto i = state->next.fetch_add(1); i < count;
+             i = state->next.fetch_add(1)) {
+            body(i);
+        }
     };
+
+    for (size_t i = 0; i < helpers; ++i) {
+        pool.submit([state, &drain] {
+            {
+                std::lock_guard<std::mutex> guard(state->mutex);
+                if (state->closed) {
+                    return;
+                }
+                ++state->active;
+            }
+            drain();
+            {
+                std::lock_guard<std::mutex> guard(state->mutex);
+                --state->active;
+            }
+            state->idle.notify_all();
+        });
+    }
+
+    drain();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->closed = true;
+    state->idle.wait(lock, [&state] { return state->active == 0; });
 }
 
-size_t bytes_per_pixel(libCZI::PixelType pixel_type)
+/*
+ * `parallel_for` over bodies that may throw. Each item's status is stored in
+ * `results` when given, and the first failing item's status and message are
+ * rethrown once every item has run.
+ */
+template<class Function>
+void parallel_for_checked(
+    size_t count,
+    uint32_t thread_count,
+    const Function& body,
+    lcj_status* results = nullptr)
 {
-    switch (pixel_type) {
-    case libCZI::PixelType::Gray8: return 1;
-    case libCZI::PixelType::Gray16: return 2;
-    case libCZI::PixelType::Gray32Float: return 4;
-    case libCZI::PixelType::Bgr24: return 3;
-    case libCZI::PixelType::Bgr48: return 6;
-    case libCZI::PixelType::Bgr96Float: return 12;
-    default:
-        throw unsupported_operation("unsupported decoded pixel type");
+    std::vector<lcj_status> statuses(count, LCJ_OK);
+    std::vector<std::string> messages(count);
+    parallel_for(count, thread_count, [&](size_t i) {
+        statuses[i] = protect([&] { body(i); });
+        if (statuses[i] != LCJ_OK) {
+            messages[i] = last_error;
+        }
+    });
+
+    if (results != nullptr) {
+        std::copy(statuses.begin(), statuses.end(), results);
+    }
+
+    const auto failed = std::find_if(
+        statuses.begin(),
+        statuses.end(),
+        [](lcj_status item) { return item != LCJ_OK; });
+    if (failed != statuses.end()) {
+        const auto index = static_cast<size_t>(failed - statuses.begin());
+        throw batch_failure(*failed, messages[index]);
     }
 }
 
-void require_reader(lcj_reader* reader)
+std::wstring utf8_to_wstring(const char* path)
 {
-    if (reader == nullptr || !reader->value) {
-        throw std::invalid_argument("reader must not be null");
-    }
+#if defined(_WIN32)
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> conversion;
+#else
+    std::wstring_convert<std::codecvt_utf8<wchar_t>> conversion;
+#endif
+    return conversion.from_bytes(path);
 }
 
-void require_bitmap(lcj_bitmap* bitmap)
+std::string wstring_to_utf8(const std::wstring& text)
 {
-    if (bitmap == nullptr || !bitmap->value) {
-        throw std::invalid_argument("bitmap must not be null");
-    }
+#if defined(_WIN32)
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> conversion;
+#else
+    std::wstring_convert<std::codecvt_utf8<wchar_t>> conversion;
+#endif
+    return conversion.to_bytes(text);
 }
 
-std::shared_ptr<libCZI::IMetadataSegment> metadata_segment(lcj_reader* reader)
+void read_mapped(
+    const void* view,
+    uint64_t view_size,
+    std::uint64_t offset,
+    void* pv,
+    std::uint64_t size,
+    std::uint64_t* ptrBytesRead)
 {
-    require_reader(reader);
-    auto segment = reader->value->ReadMetadataSegment();
-    if (!segment) {
-        throw unsupported_operation("CZI metadata segment is absent");
+    const auto available = offset < view_size ? view_size - offset : 0;
+    const auto count = std::min(size, available);
+    if (count != 0) {
+        std::memcpy(
+            pv,
+            static_cast<const uint8_t*>(view) + offset,
+            static_cast<size_t>(count));
+    }
+    if (ptrBytesRead != nullptr) {
+        *ptrBytesRead = count;
     }
-    return segment;
 }
 
+// What the reader pool compares to tell whether a file changed.
+struct file_identity {
+    uint64_t size = 0;
+    int64_t modified = 0;
+    uint32_t modified_fraction = 0;
 
-} // namespace
+    bool operator==(const file_identity& other) const
+    {
+        return size == other.size && modified == other.modified &&
+            modified_fraction == other.modified_fraction;
+    }
+};
 
-extern "C" {
+/*
+ * Input streams selected through `lcj_reader_options.stream`. Neither keeps a
+ * file position, so concurrent reads through one stream never serialize on a
+ * seek lock.
+ */
+#if defined(_WIN32)
 
-const char* lcj_last_error_message(void)
+[[noreturn]] void throw_system_error(const char* operation)
 {
-    return last_error.c_str();
+    throw std::ios_base::failure(
+        operation,
+        std::error_code(
+            static_cast<int>(GetLastError()),
+            std::system_category()));
 }
 
-lcj_status lcj_abi_version(lcj_version* version)
-{
-    if (version == nullptr) {
-        return fail(LCJ_INVALID_ARGUMENT, "version must not be null");
+class file_handle {
+public:
+    explicit file_handle(const char* path, DWORD flags = 0)
+    {
+        const auto wide_path = utf8_to_wstring(path);
+        handle_ = CreateFileW(
+            wide_path.c_str(),
+            GENERIC_READ,
+            FILE_SHARE_READ,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS | flags,
+            nullptr);
+        if (handle_ == INVALID_HANDLE_VALUE) {
+            throw_system_error("failed to open CZI file");
+        }
     }
 
-    clear_error();
-    *version = {
-        LCJ_ABI_VERSION_MAJOR,
-        LCJ_ABI_VERSION_MINOR,
-        0u,
-        0u,
-    };
-    return LCJ_OK;
-}
+    file_handle(const file_handle&) = delete;
+    file_handle& operator=(const file_handle&) = delete;
 
-lcj_status lcj_libczi_version(lcj_version* version)
-{
-    if (version == nullptr) {
-        return fail(LCJ_INVALID_ARGUMENT, "version must not be null");
+    ~file_handle()
+    {
+        CloseHandle(handle_);
     }
 
-    return protect([&] {
-        int major = 0;
-        int minor = 0;
-        int patch = 0;
-        int tweak = 0;
-        libCZI::GetLibCZIVersion(&major, &minor, &patch, &tweak);
-        *version = {
-            static_cast<uint32_t>(major),
-            static_cast<uint32_t>(minor),
-            static_cast<uint32_t>(patch),
-            static_cast<uint32_t>(tweak),
-        };
-    });
-}
+    HANDLE get() const
+    {
+        return handle_;
+    }
 
-lcj_status lcj_reader_open_utf8(
-    const char* path,
-    lcj_reader** reader)
-{
-    if (path == nullptr || reader == nullptr) {
-        return fail(
-            LCJ_INVALID_ARGUMENT,
-            "path and reader output must not be null");
+    uint64_t size() const
+    {
+        LARGE_INTEGER value;
+        if (!GetFileSizeEx(handle_, &value)) {
+            throw_system_error("failed to query CZI file size");
+        }
+        return static_cast<uint64_t>(value.QuadPart);
     }
 
-    *reader = nullptr;
+private:
+    HANDLE handle_;
+};
 
-    return protect([&] {
-        const auto wide_path = utf8_to_wstring(path);
-        auto stream = libCZI::CreateStreamFromFile(wide_path.c_str());
-        auto native_reader = libCZI::CreateCZIReader();
-        native_reader->Open(stream);
+class event_handle {
+public:
+    event_handle()
+        : handle_(CreateEventW(nullptr, TRUE, FALSE, nullptr))
+    {
+        if (handle_ == nullptr) {
+            throw_system_error("failed to create read event");
+        }
+    }
 
-        auto result = std::make_unique<lcj_reader>();
-        result->value = std::move(native_reader);
-        *reader = result.release();
-    });
-}
+    event_handle(const event_handle&) = delete;
+    event_handle& operator=(const event_handle&) = delete;
 
-lcj_status lcj_reader_close(lcj_reader* reader)
-{
-    if (reader == nullptr) {
-        clear_error();
-        return LCJ_OK;
+    ~event_handle()
+    {
+        CloseHandle(handle_);
     }
 
-    std::unique_ptr<lcj_reader> owned(reader);
-    return protect([&] {
-        if (owned->value) {
-            owned->value->Close();
-            owned->value.reset();
-        }
-    });
-}
+    HANDLE get() const
+    {
+        return handle_;
+    }
 
-lcj_status lcj_reader_statistics(
-    lcj_reader* reader,
-    lcj_statistics* statistics)
-{
-    if (statistics == nullptr) {
-        return fail(LCJ_INVALID_ARGUMENT, "statistics must not be null");
+private:
+    HANDLE handle_;
+};
+
+/*
+ * The file is opened for overlapped I/O: reads on a synchronous file object
+ * are serialized by the I/O manager even when they carry their own offset.
+ * Every call waits on its own event.
+ */
+class pread_stream final : public libCZI::IStream {
+public:
+    explicit pread_stream(const char* path)
+        : file_(path, FILE_FLAG_OVERLAPPED)
+    {
     }
 
-    return protect([&] {
-        require_reader(reader);
-        const auto value = reader->value->GetStatistics();
+    void Read(
+        std::uint64_t offset,
+        void* pv,
+        std::uint64_t size,
+        std::uint64_t* ptrBytesRead) override
+    {
+        auto* target = static_cast<uint8_t*>(pv);
+        std::uint64_t total = 0;
+        event_handle event;
+        while (total < size) {
+            const auto chunk = static_cast<DWORD>(std::min<std::uint64_t>(
+                size - total,
+                std::numeric_limits<DWORD>::max()));
+            const auto position = offset + total;
 
-        statistics->subblock_count =
-            static_cast<int32_t>(value.subBlockCount);
+            OVERLAPPED overlapped{};
+            overlapped.Offset = static_cast<DWORD>(position);
+            overlapped.OffsetHigh = static_cast<DWORD>(position >> 32);
+            overlapped.hEvent = event.get();
+
+            DWORD transferred = 0;
+            if (!ReadFile(
+                    file_.get(),
+                    target + total,
+                    chunk,
+                    nullptr,
+                    &overlapped) &&
+                GetLastError() != ERROR_IO_PENDING) {
+                if (GetLastError() == ERROR_HANDLE_EOF) {
+                    break;
+                }
+                throw_system_error("failed to read CZI file");
+            }
+            if (!GetOverlappedResult(
+                    file_.get(),
+                    &overlapped,
+                    &transferred,
+                    TRUE)) {
+                if (GetLastError() == ERROR_HANDLE_EOF) {
+                    break;
+                }
+                throw_system_error("failed to read CZI file");
+            }
+            if (transferred == 0) {
+                break;
+            }
+            total += transferred;
+        }
+
+        if (ptrBytesRead != nullptr) {
+            *ptrBytesRead = total;
+        }
+    }
+
+private:
+    file_handle file_;
+};
+
+class mmap_stream final : public libCZI::IStream {
+public:
+    explicit mmap_stream(const char* path)
+        : file_(path),
+          size_(file_.size())
+    {
+        if (size_ == 0) {
+            return;
+        }
+
+        mapping_ = CreateFileMappingW(
+            file_.get(),
+            nullptr,
+            PAGE_READONLY,
+            0,
+            0,
+            nullptr);
+        if (mapping_ == nullptr) {
+            throw_system_error("failed to map CZI file");
+        }
+        view_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+        if (view_ == nullptr) {
+            CloseHandle(mapping_);
+            throw_system_error("failed to map CZI file");
+        }
+    }
+
+    mmap_stream(const mmap_stream&) = delete;
+    mmap_stream& operator=(const mmap_stream&) = delete;
+
+    ~mmap_stream() override
+    {
+        if (view_ != nullptr) {
+            UnmapViewOfFile(view_);
+            CloseHandle(mapping_);
+        }
+    }
+
+    void Read(
+        std::uint64_t offset,
+        void* pv,
+        std::uint64_t size,
+        std::uint64_t* ptrBytesRead) override
+    {
+        read_mapped(view_, size_, offset, pv, size, ptrBytesRead);
+    }
+
+private:
+    file_handle file_;
+    uint64_t size_;
+    HANDLE mapping_ = nullptr;
+    void* view_ = nullptr;
+};
+
+file_identity identify_file(const char* path)
+{
+    const auto wide_path = utf8_to_wstring(path);
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExW(
+            wide_path.c_str(),
+            GetFileExInfoStandard,
+            &attributes)) {
+        throw_system_error("failed to query CZI file");
+    }
+
+    file_identity identity;
+    identity.size = (static_cast<uint64_t>(attributes.nFileSizeHigh) << 32) |
+        attributes.nFileSizeLow;
+    identity.modified = static_cast<int64_t>(
+        attributes.ftLastWriteTime.dwHighDateTime);
+    identity.modified_fraction = attributes.ftLastWriteTime.dwLowDateTime;
+    return identity;
+}
+
+#else
+
+[[noreturn]] void throw_system_error(const char* operation)
+{
+    throw std::ios_base::failure(
+        operation,
+        std::error_code(errno, std::generic_category()));
+}
+
+class file_descriptor {
+public:
+    explicit file_descriptor(const char* path)
+        : descriptor_(::open(path, O_RDONLY | O_CLOEXEC))
+    {
+        if (descriptor_ < 0) {
+            throw_system_error("failed to open CZI file");
+        }
+    }
+
+    file_descriptor(const file_descriptor&) = delete;
+    file_descriptor& operator=(const file_descriptor&) = delete;
+
+    ~file_descriptor()
+    {
+        ::close(descriptor_);
+    }
+
+    int get() const
+    {
+        return descriptor_;
+    }
+
+    uint64_t size() const
+    {
+        struct stat status;
+        if (::fstat(descriptor_, &status) != 0) {
+            throw_system_error("failed to query CZI file size");
+        }
+        return static_cast<uint64_t>(status.st_size);
+    }
+
+private:
+    int descriptor_;
+};
+
+class pread_stream final : public libCZI::IStream {
+public:
+    explicit pread_stream(const char* path)
+        : file_(path)
+    {
+    }
+
+    void Read(
+        std::uint64_t offset,
+        void* pv,
+        std::uint64_t size,
+        std::uint64_t* ptrBytesRead) override
+    {
+        if (offset > static_cast<std::uint64_t>(
+                         std::numeric_limits<off_t>::max())) {
+            throw std::ios_base::failure("stream offset is out of range");
+        }
+
+        auto* target = static_cast<uint8_t*>(pv);
+        std::uint64_t total = 0;
+        while (total < size) {
+            const auto chunk = static_cast<size_t>(std::min<std::uint64_t>(
+                size - total,
+                static_cast<std::uint64_t>(
+                    std::numeric_limits<ssize_t>::max())));
+            const auto result = ::pread(
+                file_.get(),
+                target + total,
+                chunk,
+                static_cast<off_t>(offset + total));
+            if (result < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw_system_error("failed to read CZI file");
+            }
+            if (result == 0) {
+                break;
+            }
+            total += static_cast<std::uint64_t>(result);
+        }
+
+        if (ptrBytesRead != nullptr) {
+            *ptrBytesRead = total;
+        }
+    }
+
+private:
+    file_descriptor file_;
+};
+
+class mmap_stream final : public libCZI::IStream {
+public:
+    explicit mmap_stream(const char* path)
+        : file_(path),
+          size_(file_.size())
+    {
+        if (size_ == 0) {
+            return;
+        }
+        if (size_ > std::numeric_limits<size_t>::max()) {
+            throw unsupported_operation(
+                "CZI file is too large to map into memory");
+        }
+
+        view_ = ::mmap(
+            nullptr,
+            static_cast<size_t>(size_),
+            PROT_READ,
+            MAP_PRIVATE,
+            file_.get(),
+            0);
+        if (view_ == MAP_FAILED) {
+            view_ = nullptr;
+            throw_system_error("failed to map CZI file");
+        }
+        ::madvise(view_, static_cast<size_t>(size_), MADV_RANDOM);
+    }
+
+    mmap_stream(const mmap_stream&) = delete;
+    mmap_stream& operator=(const mmap_stream&) = delete;
+
+    ~mmap_stream() override
+    {
+        if (view_ != nullptr) {
+            ::munmap(view_, static_cast<size_t>(size_));
+        }
+    }
+
+    void Read(
+        std::uint64_t offset,
+        void* pv,
+        std::uint64_t size,
+        std::uint64_t* ptrBytesRead) override
+    {
+        read_mapped(view_, size_, offset, pv, size, ptrBytesRead);
+    }
+
+private:
+    file_descriptor file_;
+    uint64_t size_;
+    void* view_ = nullptr;
+};
+
+file_identity identify_file(const char* path)
+{
+    struct stat status;
+    if (::stat(path, &status) != 0) {
+        throw_system_error("failed to query CZI file");
+    }
+
+#if defined(__APPLE__)
+    const auto& modified = status.st_mtimespec;
+#else
+    const auto& modified = status.st_mtim;
+#endif
+    file_identity identity;
+    identity.size = static_cast<uint64_t>(status.st_size);
+    identity.modified = static_cast<int64_t>(modified.tv_sec);
+    identity.modified_fraction = static_cast<uint32_t>(modified.tv_nsec);
+    return identity;
+}
+
+#endif
+
+// Reads from a caller-owned region that outlives the reader.
+class memory_stream final : public libCZI::IStream {
+public:
+    memory_stream(const void* data, size_t size)
+        : data_(data),
+          size_(size)
+    {
+    }
+
+    void Read(
+        std::uint64_t offset,
+        void* pv,
+        std::uint64_t size,
+        std::uint64_t* ptrBytesRead) override
+    {
+        read_mapped(data_, size_, offset, pv, size, ptrBytesRead);
+    }
+
+private:
+    const void* data_;
+    uint64_t size_;
+};
+
+/*
+ * Counters behind `lcj_reader_metrics`, shared by a reader with its stream
+ * and its bitmaps, which may outlive it. Updates are relaxed: the counters
+ * are statistics and order nothing else.
+ */
+struct reader_metrics {
+    std::atomic<uint64_t> stream_reads{0};
+    std::atomic<uint64_t> stream_bytes{0};
+    std::atomic<uint64_t> stream_nanoseconds{0};
+    std::atomic<uint64_t> decoded_subblocks[LCJ_COMPRESSION_SLOTS]{};
+    std::atomic<uint64_t> decode_nanoseconds{0};
+    std::atomic<uint64_t> copy_nanoseconds{0};
+    std::atomic<uint64_t> live_bitmap_bytes{0};
+    std::atomic<uint64_t> peak_bitmap_bytes{0};
+
+    void count_decode(int32_t compression_raw)
+    {
+        size_t slot = LCJ_COMPRESSION_SLOTS - 1;
+        if (compression_raw >= 0 &&
+            static_cast<uint32_t>(compression_raw) < slot) {
+            slot = static_cast<size_t>(compression_raw);
+        }
+        decoded_subblocks[slot].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void add_bitmap(uint64_t bytes)
+    {
+        const auto live =
+            live_bitmap_bytes.fetch_add(bytes, std::memory_order_relaxed) +
+            bytes;
+        auto peak = peak_bitmap_bytes.load(std::memory_order_relaxed);
+        while (peak < live &&
+               !peak_bitmap_bytes.compare_exchange_weak(
+                   peak,
+                   live,
+                   std::memory_order_relaxed)) {
+        }
+    }
+
+    void remove_bitmap(uint64_t bytes)
+    {
+        live_bitmap_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+};
+
+/*
+ * Adds the lifetime of a scope to `counter`, if there is one.
+ */
+class scoped_timer {
+public:
+    explicit scoped_timer(std::atomic<uint64_t>* counter)
+        : counter_(counter),
+          start_(counter == nullptr
+                  ? std::chrono::steady_clock::time_point()
+                  : std::chrono::steady_clock::now())
+    {
+    }
+
+    scoped_timer(const scoped_timer&) = delete;
+    scoped_timer& operator=(const scoped_timer&) = delete;
+
+    ~scoped_timer()
+    {
+        if (counter_ != nullptr) {
+            const auto elapsed = std::chrono::steady_clock::now() - start_;
+            counter_->fetch_add(
+                static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        elapsed)
+                        .count()),
+                std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::atomic<uint64_t>* counter_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+class counting_stream final : public libCZI::IStream {
+public:
+    counting_stream(
+        std::shared_ptr<libCZI::IStream> inner,
+        std::shared_ptr<reader_metrics> metrics)
+        : inner_(std::move(inner)),
+          metrics_(std::move(metrics))
+    {
+    }
+
+    void Read(
+        std::uint64_t offset,
+        void* pv,
+        std::uint64_t size,
+        std::uint64_t* ptrBytesRead) override
+    {
+        std::uint64_t bytes = 0;
+        {
+            scoped_timer timer(&metrics_->stream_nanoseconds);
+            inner_->Read(offset, pv, size, &bytes);
+        }
+        metrics_->stream_reads.fetch_add(1, std::memory_order_relaxed);
+        metrics_->stream_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        if (ptrBytesRead != nullptr) {
+            *ptrBytesRead = bytes;
+        }
+    }
+
+private:
+    std::shared_ptr<libCZI::IStream> inner_;
+    std::shared_ptr<reader_metrics> metrics_;
+};
+
+std::shared_ptr<libCZI::IStream> open_stream(
+    const char* path,
+    uint32_t stream_kind)
+{
+    switch (stream_kind) {
+    case LCJ_STREAM_LIBCZI: {
+        const auto wide_path = utf8_to_wstring(path);
+        return libCZI::CreateStreamFromFile(wide_path.c_str());
+    }
+    case LCJ_STREAM_DEFAULT:
+    case LCJ_STREAM_PREAD:
+        return std::make_shared<pread_stream>(path);
+    case LCJ_STREAM_MMAP:
+        return std::make_shared<mmap_stream>(path);
+    }
+
+    throw std::invalid_argument("unknown reader stream kind");
+}
+
+libCZI::DimensionIndex to_libczi_dimension(lcj_dimension dimension)
+{
+    switch (dimension) {
+    case LCJ_DIM_Z: return libCZI::DimensionIndex::Z;
+    case LCJ_DIM_C: return libCZI::DimensionIndex::C;
+    case LCJ_DIM_T: return libCZI::DimensionIndex::T;
+    case LCJ_DIM_R: return libCZI::DimensionIndex::R;
+    case LCJ_DIM_S: return libCZI::DimensionIndex::S;
+    case LCJ_DIM_I: return libCZI::DimensionIndex::I;
+    case LCJ_DIM_H: return libCZI::DimensionIndex::H;
+    case LCJ_DIM_V: return libCZI::DimensionIndex::V;
+    case LCJ_DIM_B: return libCZI::DimensionIndex::B;
+    }
+
+    throw std::invalid_argument("invalid CZI dimension");
+}
+
+
+uint8_t to_lcj_pixel_type(libCZI::PixelType pixel_type)
+{
+    switch (pixel_type) {
+    case libCZI::PixelType::Gray8: return LCJ_PIXEL_GRAY8;
+    case libCZI::PixelType::Gray16: return LCJ_PIXEL_GRAY16;
+    case libCZI::PixelType::Gray32Float: return LCJ_PIXEL_GRAY32_FLOAT;
+    case libCZI::PixelType::Bgr24: return LCJ_PIXEL_BGR24;
+    case libCZI::PixelType::Bgr48: return LCJ_PIXEL_BGR48;
+    case libCZI::PixelType::Bgr96Float: return LCJ_PIXEL_BGR96_FLOAT;
+    case libCZI::PixelType::Bgra32: return LCJ_PIXEL_BGRA32;
+    default: return LCJ_PIXEL_INVALID;
+    }
+}
+
+uint8_t to_lcj_pyramid_type(libCZI::SubBlockPyramidType pyramid_type)
+{
+    switch (pyramid_type) {
+    case libCZI::SubBlockPyramidType::None: return 0;
+    case libCZI::SubBlockPyramidType::SingleSubBlock: return 1;
+    case libCZI::SubBlockPyramidType::MultiSubBlock: return 2;
+    default: return 255;
+    }
+}
+
+libCZI::SubBlockPyramidType from_lcj_pyramid_type(uint8_t pyramid_type)
+{
+    switch (pyramid_type) {
+    case 0: return libCZI::SubBlockPyramidType::None;
+    case 1: return libCZI::SubBlockPyramidType::SingleSubBlock;
+    case 2: return libCZI::SubBlockPyramidType::MultiSubBlock;
+    default: break;
+    }
+
+    throw std::invalid_argument("invalid pyramid type");
+}
+
+const libCZI::DimensionIndex dimensions[LCJ_DIMENSION_COUNT] = {
+    libCZI::DimensionIndex::Z,
+    libCZI::DimensionIndex::C,
+    libCZI::DimensionIndex::T,
+    libCZI::DimensionIndex::R,
+    libCZI::DimensionIndex::S,
+    libCZI::DimensionIndex::I,
+    libCZI::DimensionIndex::H,
+    libCZI::DimensionIndex::V,
+    libCZI::DimensionIndex::B,
+};
+
+libCZI::PixelType from_lcj_pixel_type(lcj_pixel_type pixel_type)
+{
+    switch (pixel_type) {
+    case LCJ_PIXEL_GRAY8: return libCZI::PixelType::Gray8;
+    case LCJ_PIXEL_GRAY16: return libCZI::PixelType::Gray16;
+    case LCJ_PIXEL_GRAY32_FLOAT: return libCZI::PixelType::Gray32Float;
+    case LCJ_PIXEL_BGR24: return libCZI::PixelType::Bgr24;
+    case LCJ_PIXEL_BGR48: return libCZI::PixelType::Bgr48;
+    case LCJ_PIXEL_BGR96_FLOAT: return libCZI::PixelType::Bgr96Float;
+    case LCJ_PIXEL_BGRA32: return libCZI::PixelType::Bgra32;
+    case LCJ_PIXEL_INVALID: break;
+    }
+
+    throw std::invalid_argument("invalid pixel type");
+}
+
+lcj_rect_i32 convert_rect(const libCZI::IntRect& rectangle)
+{
+    return {
+        static_cast<int32_t>(rectangle.x),
+        static_cast<int32_t>(rectangle.y),
+        static_cast<int32_t>(rectangle.w),
+        static_cast<int32_t>(rectangle.h),
+    };
+}
+
+void fill_subblock_info(
+    int32_t native_index,
+    const libCZI::SubBlockInfo& native_info,
+    lcj_subblock_info* info)
+{
+    info->native_index = native_index;
+    info->compression_raw =
+        static_cast<int32_t>(native_info.compressionModeRaw);
+    info->pixel_type =
+        to_lcj_pixel_type(native_info.pixelType);
+    info->pyramid_type =
+        to_lcj_pyramid_type(native_info.pyramidType);
+    info->m_index_present =
+        native_info.IsMindexValid() ? uint8_t{1} : uint8_t{0};
+    info->reserved0 = 0;
+    info->m_index = native_info.IsMindexValid()
+        ? static_cast<int32_t>(native_info.mIndex)
+        : 0;
+    info->logical_rect = convert_rect(native_info.logicalRect);
+    if (static_cast<uint64_t>(native_info.physicalSize.w) >
+            std::numeric_limits<uint32_t>::max() ||
+        static_cast<uint64_t>(native_info.physicalSize.h) >
+            std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error(
+            "libCZI returned an invalid physical subblock size");
+    }
+    info->physical_width =
+        static_cast<uint32_t>(native_info.physicalSize.w);
+    info->physical_height =
+        static_cast<uint32_t>(native_info.physicalSize.h);
+    info->coordinate_mask = 0;
+    info->reserved1 = 0;
+    std::fill(
+        std::begin(info->coordinate),
+        std::end(info->coordinate),
+        int32_t{0});
+
+    for (size_t i = 0; i < LCJ_DIMENSION_COUNT; ++i) {
+        int coordinate = 0;
+        if (native_info.coordinate.TryGetPosition(
+                dimensions[i],
+                &coordinate)) {
+            info->coordinate_mask |=
+                static_cast<uint16_t>(uint16_t{1} << i);
+            info->coordinate[i] =
+                static_cast<int32_t>(coordinate);
+        }
+    }
+}
+
+uint32_t read_le_u32(const uint8_t* bytes)
+{
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; --i) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+uint64_t read_le_u64(const uint8_t* bytes)
+{
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+// A CZI segment starts with a 16-byte id followed by the little-endian
+// allocated and used sizes of the segment body. The body of a subblock
+// segment begins with its metadata, attachment and data sizes.
+constexpr size_t segment_header_size = 32;
+constexpr size_t subblock_header_size = segment_header_size + 16;
+
+struct subblock_segment {
+    uint64_t stored_size;
+    uint64_t data_size;
+};
+
+subblock_segment read_subblock_segment(
+    libCZI::IStream& stream,
+    uint64_t file_position)
+{
+    uint8_t header[subblock_header_size];
+    uint64_t bytes_read = 0;
+    stream.Read(file_position, header, sizeof(header), &bytes_read);
+    if (bytes_read != sizeof(header)) {
+        throw std::ios_base::failure("subblock segment header is truncated");
+    }
+
+    static const char subblock_id[] = "ZISRAWSUBBLOCK";
+    if (std::memcmp(header, subblock_id, sizeof(subblock_id) - 1) != 0) {
+        throw std::runtime_error(
+            "directory entry does not point at a subblock segment");
+    }
+
+    const auto allocated_size = read_le_u64(header + 16);
+    const auto used_size = read_le_u64(header + 24);
+    const auto body_size = used_size != 0 ? used_size : allocated_size;
+    if (body_size > std::numeric_limits<uint64_t>::max() -
+            segment_header_size) {
+        throw std::runtime_error("subblock segment size is invalid");
+    }
+
+    subblock_segment segment;
+    segment.stored_size = body_size + segment_header_size;
+    segment.data_size = read_le_u64(header + segment_header_size + 8);
+    return segment;
+}
+
+// The file header segment stores the attachment directory position after
+// its version, GUIDs, file part and subblock directory and metadata
+// positions. The directory holds its entry count and 252 reserved bytes,
+// then 128-byte entries whose segment position follows a 12-byte schema
+// prefix. An attachment segment body starts with the payload size and puts
+// the payload 256 bytes in.
+constexpr uint64_t attachment_directory_field = segment_header_size + 72;
+constexpr uint64_t attachment_directory_header_size =
+    segment_header_size + 256;
+constexpr size_t attachment_entry_size = 128;
+constexpr uint64_t attachment_header_size = segment_header_size + 256;
+
+void read_exact(
+    libCZI::IStream& stream,
+    uint64_t file_position,
+    void* destination,
+    uint64_t size,
+    const char* what)
+{
+    uint64_t bytes_read = 0;
+    stream.Read(file_position, destination, size, &bytes_read);
+    if (bytes_read != size) {
+        throw std::ios_base::failure(what);
+    }
+}
+
+void require_segment_id(const uint8_t* header, const char* id)
+{
+    if (std::strncmp(reinterpret_cast<const char*>(header), id, 16) != 0) {
+        throw std::runtime_error("CZI segment has an unexpected id");
+    }
+}
+
+std::vector<attachment_record> read_attachment_records(
+    libCZI::IStream& stream)
+{
+    uint8_t field[8];
+    read_exact(
+        stream,
+        attachment_directory_field,
+        field,
+        sizeof(field),
+        "CZI file header is truncated");
+    const auto directory_position = read_le_u64(field);
+    if (directory_position == 0) {
+        return {};
+    }
+
+    uint8_t header[segment_header_size + 4];
+    read_exact(
+        stream,
+        directory_position,
+        header,
+        sizeof(header),
+        "attachment directory is truncated");
+    require_segment_id(header, "ZISRAWATTDIR");
+
+    const auto body_size = std::max(
+        read_le_u64(header + 16),
+        read_le_u64(header + 24));
+    const auto entry_count = read_le_u32(header + segment_header_size);
+    if (entry_count > body_size / attachment_entry_size) {
+        throw std::runtime_error("attachment directory size is invalid");
+    }
+
+    std::vector<uint8_t> entries(entry_count * attachment_entry_size);
+    read_exact(
+        stream,
+        directory_position + attachment_directory_header_size,
+        entries.data(),
+        entries.size(),
+        "attachment directory is truncated");
+
+    std::vector<attachment_record> records(entry_count);
+    for (size_t i = 0; i < records.size(); ++i) {
+        auto& record = records[i];
+        record.file_position =
+            read_le_u64(entries.data() + i * attachment_entry_size + 12);
+
+        uint8_t segment[segment_header_size + 8];
+        read_exact(
+            stream,
+            record.file_position,
+            segment,
+            sizeof(segment),
+            "attachment segment header is truncated");
+        require_segment_id(segment, "ZISRAWATTACH");
+        record.data_size = read_le_u64(segment + segment_header_size);
+    }
+    return records;
+}
+
+size_t bytes_per_pixel(libCZI::PixelType pixel_type)
+{
+    switch (pixel_type) {
+    case libCZI::PixelType::Gray8: return 1;
+    case libCZI::PixelType::Gray16: return 2;
+    case libCZI::PixelType::Gray32Float: return 4;
+    case libCZI::PixelType::Bgr24: return 3;
+    case libCZI::PixelType::Bgr48: return 6;
+    case libCZI::PixelType::Bgr96Float: return 12;
+    case libCZI::PixelType::Bgra32: return 4;
+    default:
+        throw unsupported_operation("unsupported decoded pixel type");
+    }
+}
+
+size_t row_bytes_of(libCZI::PixelType pixel_type, uint32_t width)
+{
+    const auto bytes = bytes_per_pixel(pixel_type);
+    if (width > std::numeric_limits<size_t>::max() / bytes) {
+        throw std::overflow_error("bitmap row size overflows size_t");
+    }
+    return static_cast<size_t>(width) * bytes;
+}
+
+void require_destination(
+    const void* destination,
+    size_t destination_size,
+    size_t destination_row_stride,
+    size_t row_bytes,
+    uint32_t height)
+{
+    if (destination == nullptr) {
+        throw std::invalid_argument(
+            "bitmap destination must not be null");
+    }
+    if (destination_row_stride < row_bytes) {
+        throw buffer_too_small(
+            "bitmap destination row stride is too small");
+    }
+
+    size_t required = 0;
+    if (height != 0) {
+        const auto rows_before_last =
+            static_cast<size_t>(height - 1);
+        if (rows_before_last >
+            (std::numeric_limits<size_t>::max() - row_bytes) /
+                destination_row_stride) {
+            throw std::overflow_error(
+                "bitmap destination size overflows size_t");
+        }
+        required =
+            rows_before_last * destination_row_stride + row_bytes;
+    }
+
+    if (destination_size < required) {
+        throw buffer_too_small(
+            "bitmap destination buffer is too small");
+    }
+}
+
+void copy_rows(
+    const uint8_t* source,
+    size_t source_stride,
+    uint8_t* target,
+    size_t target_stride,
+    size_t row_bytes,
+    uint32_t height)
+{
+    if (source_stride == row_bytes && target_stride == row_bytes) {
+        std::memcpy(target, source, row_bytes * height);
+        return;
+    }
+
+    for (uint32_t y = 0; y < height; ++y) {
+        std::memcpy(
+            target + static_cast<size_t>(y) * target_stride,
+            source + static_cast<size_t>(y) * source_stride,
+            row_bytes);
+    }
+}
+
+void copy_bitmap(
+    const std::shared_ptr<libCZI::IBitmapData>& bitmap,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride)
+{
+    const auto size = bitmap->GetSize();
+    const auto row_bytes = row_bytes_of(bitmap->GetPixelType(), size.w);
+    require_destination(
+        destination,
+        destination_size,
+        destination_row_stride,
+        row_bytes,
+        size.h);
+
+    libCZI::ScopedBitmapLockerSP lock(bitmap);
+    const auto* source =
+        static_cast<const uint8_t*>(lock.ptrDataRoi);
+
+    if (size.w != 0 && size.h != 0 && source == nullptr) {
+        throw std::runtime_error(
+            "libCZI returned null decoded bitmap storage");
+    }
+    if (lock.stride < row_bytes) {
+        throw std::runtime_error(
+            "libCZI returned a bitmap stride smaller than one row");
+    }
+
+    copy_rows(
+        source,
+        lock.stride,
+        static_cast<uint8_t*>(destination),
+        destination_row_stride,
+        row_bytes,
+        size.h);
+}
+
+lcj_copy_options require_copy_options(const lcj_copy_options* options)
+{
+    if (options == nullptr) {
+        throw std::invalid_argument("copy options must not be null");
+    }
+    if (options->format > LCJ_COPY_UINT16) {
+        throw std::invalid_argument("copy format is invalid");
+    }
+    if (options->reserved0 != 0 ||
+        std::any_of(
+            std::begin(options->reserved),
+            std::end(options->reserved),
+            [](uint64_t value) { return value != 0; })) {
+        throw std::invalid_argument(
+            "copy options reserved fields must be zero");
+    }
+    return *options;
+}
+
+/*
+ * Like `copy_bitmap`, but runs every row through a conversion kernel while
+ * copying. The source is only read once, which is the point of converting
+ * here rather than in a second pass on the caller's side.
+ */
+void copy_bitmap_converted(
+    const std::shared_ptr<libCZI::IBitmapData>& bitmap,
+    const lcj_copy_options& options,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride)
+{
+    if (options.format == LCJ_COPY_NATIVE) {
+        copy_bitmap(
+            bitmap,
+            destination,
+            destination_size,
+            destination_row_stride);
+        return;
+    }
+
+    const auto& kernels = pixel_kernels::active_kernels();
+    const auto pixel_type = bitmap->GetPixelType();
+    const auto size = bitmap->GetSize();
+
+    const auto unsupported = [] {
+        return unsupported_operation(
+            "pixel type cannot be converted to the requested format");
+    };
+
+    size_t target_pixel_bytes = 0;
+    pixel_kernels::convert_row convert = nullptr;
+    pixel_kernels::split_row split = nullptr;
+    pixel_kernels::scale_row scale = nullptr;
+    switch (options.format) {
+    case LCJ_COPY_RGB:
+    case LCJ_COPY_PLANAR:
+        if (pixel_type == libCZI::PixelType::Bgr24) {
+            convert = kernels.bgr24_to_rgb24;
+            split = kernels.bgr24_to_planar;
+            target_pixel_bytes = 1;
+        }
+        else if (pixel_type == libCZI::PixelType::Bgr48) {
+            convert = kernels.bgr48_to_rgb48;
+            split = kernels.bgr48_to_planar;
+            target_pixel_bytes = 2;
+        }
+        else {
+            throw unsupported();
+        }
+        if (options.format == LCJ_COPY_RGB) {
+            split = nullptr;
+            target_pixel_bytes *= 3;
+        }
+        else {
+            convert = nullptr;
+        }
+        break;
+    case LCJ_COPY_FLOAT32:
+        if (pixel_type == libCZI::PixelType::Gray8) {
+            scale = kernels.gray8_to_f32;
+        }
+        else if (pixel_type == libCZI::PixelType::Gray16) {
+            scale = kernels.gray16_to_f32;
+        }
+        else {
+            throw unsupported();
+        }
+        target_pixel_bytes = 4;
+        break;
+    case LCJ_COPY_UINT16:
+        if (pixel_type != libCZI::PixelType::Gray8) {
+            throw unsupported();
+        }
+        convert = kernels.gray8_to_u16;
+        target_pixel_bytes = 2;
+        break;
+    default:
+        throw unsupported();
+    }
+
+    if (size.w > std::numeric_limits<size_t>::max() / target_pixel_bytes) {
+        throw std::overflow_error("bitmap row size overflows size_t");
+    }
+    const auto row_bytes = static_cast<size_t>(size.w) * target_pixel_bytes;
+    require_destination(
+        destination,
+        destination_size,
+        destination_row_stride,
+        row_bytes,
+        size.h);
+
+    size_t plane_stride = 0;
+    if (split != nullptr && size.h != 0) {
+        const auto plane_bytes =
+            static_cast<size_t>(size.h - 1) * destination_row_stride +
+            row_bytes;
+        if (options.plane_stride < plane_bytes) {
+            throw std::invalid_argument("copy planes overlap");
+        }
+        if (options.plane_stride >
+                (std::numeric_limits<size_t>::max() - plane_bytes) / 2 ||
+            destination_size < 2 * options.plane_stride + plane_bytes) {
+            throw buffer_too_small("bitmap destination buffer is too small");
+        }
+        plane_stride = static_cast<size_t>(options.plane_stride);
+    }
+
+    libCZI::ScopedBitmapLockerSP lock(bitmap);
+    const auto* source = static_cast<const uint8_t*>(lock.ptrDataRoi);
+    if (size.w != 0 && size.h != 0 && source == nullptr) {
+        throw std::runtime_error(
+            "libCZI returned null decoded bitmap storage");
+    }
+    if (lock.stride < row_bytes_of(pixel_type, size.w)) {
+        throw std::runtime_error(
+            "libCZI returned a bitmap stride smaller than one row");
+    }
+
+    auto* target = static_cast<uint8_t*>(destination);
+    for (uint32_t y = 0; y < size.h; ++y) {
+        const auto* row = source + static_cast<size_t>(y) * lock.stride;
+        auto* out = target + static_cast<size_t>(y) * destination_row_stride;
+        if (convert != nullptr) {
+            convert(row, out, size.w);
+        }
+        else if (split != nullptr) {
+            split(
+                row,
+                out,
+                out + plane_stride,
+                out + 2 * plane_stride,
+                size.w);
+        }
+        else {
+            scale(row, out, size.w, options.scale, options.offset);
+        }
+    }
+}
+
+lcj_bin_options require_bin_options(const lcj_bin_options* options)
+{
+    if (options == nullptr) {
+        throw std::invalid_argument("bin options must not be null");
+    }
+    if (options->factor == 0 || options->factor > 256) {
+        throw std::invalid_argument("bin factor must be in [1, 256]");
+    }
+    if (options->mode > LCJ_BIN_SUM) {
+        throw std::invalid_argument("bin mode is invalid");
+    }
+    if (std::any_of(
+            std::begin(options->reserved),
+            std::end(options->reserved),
+            [](uint64_t value) { return value != 0; })) {
+        throw std::invalid_argument(
+            "bin options reserved fields must be zero");
+    }
+    return *options;
+}
+
+/*
+ * Binning works on samples, so every pixel type reduces to a number of
+ * 8-bit, 16-bit or float samples per pixel.
+ */
+struct sample_layout {
+    uint32_t samples;
+    uint32_t bytes;
+    bool floating;
+};
+
+sample_layout sample_layout_of(libCZI::PixelType pixel_type)
+{
+    switch (pixel_type) {
+    case libCZI::PixelType::Gray8: return {1, 1, false};
+    case libCZI::PixelType::Gray16: return {1, 2, false};
+    case libCZI::PixelType::Gray32Float: return {1, 4, true};
+    case libCZI::PixelType::Bgr24: return {3, 1, false};
+    case libCZI::PixelType::Bgr48: return {3, 2, false};
+    case libCZI::PixelType::Bgr96Float: return {3, 4, true};
+    case libCZI::PixelType::Bgra32: return {4, 1, false};
+    default:
+        throw unsupported_operation("unsupported decoded pixel type");
+    }
+}
+
+lcj_bin_layout bin_layout(
+    libCZI::PixelType pixel_type,
+    libCZI::IntSize size,
+    const lcj_bin_options& options)
+{
+    const auto samples = sample_layout_of(pixel_type);
+    const auto factor = options.factor;
+
+    lcj_bin_layout layout{};
+    layout.width = size.w / factor + (size.w % factor != 0 ? 1u : 0u);
+    layout.height = size.h / factor + (size.h % factor != 0 ? 1u : 0u);
+    layout.samples_per_pixel = samples.samples;
+    layout.sample_bytes = options.mode == LCJ_BIN_SUM ? 4u : samples.bytes;
+    layout.sample_float = samples.floating ? 1u : 0u;
+    layout.row_bytes = static_cast<uint64_t>(layout.width) *
+        layout.samples_per_pixel * layout.sample_bytes;
+    return layout;
+}
+
+template<class T>
+T load_sample(const uint8_t* source)
+{
+    T value;
+    std::memcpy(&value, source, sizeof(value));
+    return value;
+}
+
+template<class T>
+void store_sample(uint8_t* target, T value)
+{
+    std::memcpy(target, &value, sizeof(value));
+}
+
+uint32_t bin_mean(uint32_t total, uint32_t count)
+{
+    return (total + count / 2) / count;
+}
+
+float bin_mean(float total, uint32_t count)
+{
+    return total / static_cast<float>(count);
+}
+
+/*
+ * Fold the columns of one row of vertical sums into bins, `rows` source rows
+ * having gone into every sum. Bins at the right edge cover fewer columns.
+ */
+template<class Sum, class Target>
+void fold_sums(
+    const uint8_t* sums,
+    uint8_t* target,
+    size_t width,
+    uint32_t samples,
+    uint32_t factor,
+    uint32_t rows,
+    bool mean)
+{
+    for (size_t x = 0; x < width; x += factor) {
+        const auto columns =
+            static_cast<uint32_t>(std::min<size_t>(factor, width - x));
+        for (uint32_t k = 0; k < samples; ++k) {
+            Sum total = 0;
+            for (uint32_t c = 0; c < columns; ++c) {
+                total += load_sample<Sum>(
+                    sums + ((x + c) * samples + k) * sizeof(Sum));
+            }
+            store_sample(
+                target,
+                static_cast<Target>(
+                    mean ? bin_mean(total, columns * rows) : total));
+            target += sizeof(Target);
+        }
+    }
+}
+
+template<class Sample>
+void fold_maxima(
+    const uint8_t* maxima,
+    uint8_t* target,
+    size_t width,
+    uint32_t samples,
+    uint32_t factor)
+{
+    for (size_t x = 0; x < width; x += factor) {
+        const auto end = std::min<size_t>(x + factor, width);
+        for (uint32_t k = 0; k < samples; ++k) {
+            auto maximum = load_sample<Sample>(
+                maxima + (x * samples + k) * sizeof(Sample));
+            for (auto column = x + 1; column < end; ++column) {
+                const auto value = load_sample<Sample>(
+                    maxima + (column * samples + k) * sizeof(Sample));
+                maximum = maximum > value ? maximum : value;
+            }
+            store_sample(target, maximum);
+            target += sizeof(Sample);
+        }
+    }
+}
+
+void fold_bins(
+    const uint8_t* accumulator,
+    uint8_t* target,
+    const sample_layout& layout,
+    size_t width,
+    uint32_t factor,
+    uint32_t rows,
+    uint32_t mode)
+{
+    const auto samples = layout.samples;
+    if (mode == LCJ_BIN_MAX) {
+        if (layout.floating) {
+            fold_maxima<float>(accumulator, target, width, samples, factor);
+        }
+        else if (layout.bytes == 1) {
+            fold_maxima<uint8_t>(accumulator, target, width, samples, factor);
+        }
+        else {
+            fold_maxima<uint16_t>(
+                accumulator,
+                target,
+                width,
+                samples,
+                factor);
+        }
+        return;
+    }
+
+    const bool mean = mode == LCJ_BIN_MEAN;
+    if (layout.floating) {
+        fold_sums<float, float>(
+            accumulator, target, width, samples, factor, rows, mean);
+    }
+    else if (!mean) {
+        fold_sums<uint32_t, uint32_t>(
+            accumulator, target, width, samples, factor, rows, false);
+    }
+    else if (layout.bytes == 1) {
+        fold_sums<uint32_t, uint8_t>(
+            accumulator, target, width, samples, factor, rows, true);
+    }
+    else {
+        fold_sums<uint32_t, uint16_t>(
+            accumulator, target, width, samples, factor, rows, true);
+    }
+}
+
+/*
+ * Bin while copying. Each run of `factor` source rows is folded into one
+ * accumulator row with a vector kernel, sums in 32 bits for integer samples
+ * so that even 256 x 256 Gray16 bins cannot overflow; only the accumulator
+ * row is then folded across columns, once per output row.
+ */
+void copy_bitmap_binned(
+    const std::shared_ptr<libCZI::IBitmapData>& bitmap,
+    const lcj_bin_options& options,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride)
+{
+    if (options.factor == 1 && options.mode != LCJ_BIN_SUM) {
+        copy_bitmap(
+            bitmap,
+            destination,
+            destination_size,
+            destination_row_stride);
+        return;
+    }
+
+    const auto pixel_type = bitmap->GetPixelType();
+    const auto size = bitmap->GetSize();
+    const auto layout = bin_layout(pixel_type, size, options);
+    if (layout.row_bytes > std::numeric_limits<size_t>::max()) {
+        throw std::overflow_error("bitmap row size overflows size_t");
+    }
+    require_destination(
+        destination,
+        destination_size,
+        destination_row_stride,
+        static_cast<size_t>(layout.row_bytes),
+        layout.height);
+    if (layout.row_bytes == 0) {
+        return;
+    }
+
+    const auto samples = sample_layout_of(pixel_type);
+    const bool maximum = options.mode == LCJ_BIN_MAX;
+    const auto& kernels = pixel_kernels::active_kernels();
+    pixel_kernels::accumulate_row accumulate = nullptr;
+    switch (samples.bytes) {
+    case 1:
+        accumulate = maximum ? kernels.max_u8 : kernels.add_u8;
+        break;
+    case 2:
+        accumulate = maximum ? kernels.max_u16 : kernels.add_u16;
+        break;
+    default:
+        accumulate = maximum ? kernels.max_f32 : kernels.add_f32;
+        break;
+    }
+
+    const auto source_row_bytes = row_bytes_of(pixel_type, size.w);
+    const auto count = static_cast<size_t>(size.w) * samples.samples;
+    std::vector<uint8_t> accumulator(
+        maximum ? source_row_bytes : count * 4);
+
+    libCZI::ScopedBitmapLockerSP lock(bitmap);
+    const auto* source = static_cast<const uint8_t*>(lock.ptrDataRoi);
+    if (size.w != 0 && size.h != 0 && source == nullptr) {
+        throw std::runtime_error(
+            "libCZI returned null decoded bitmap storage");
+    }
+    if (lock.stride < source_row_bytes) {
+        throw std::runtime_error(
+            "libCZI returned a bitmap stride smaller than one row");
+    }
+
+    auto* target = static_cast<uint8_t*>(destination);
+    for (uint32_t y = 0; y < layout.height; ++y) {
+        const auto first = static_cast<size_t>(y) * options.factor;
+        const auto rows = static_cast<uint32_t>(
+            std::min<size_t>(options.factor, size.h - first));
+        const auto* row = source + first * lock.stride;
+
+        // Maxima start from the first row, sums from zero.
+        uint32_t folded = 0;
+        if (maximum) {
+            std::memcpy(accumulator.data(), row, source_row_bytes);
+            folded = 1;
+        }
+        else {
+            std::fill(accumulator.begin(), accumulator.end(), uint8_t{0});
+        }
+        for (; folded < rows; ++folded) {
+            accumulate(
+                row + static_cast<size_t>(folded) * lock.stride,
+                accumulator.data(),
+                count);
+        }
+
+        fold_bins(
+            accumulator.data(),
+            target + static_cast<size_t>(y) * destination_row_stride,
+            samples,
+            size.w,
+            options.factor,
+            rows,
+            options.mode);
+    }
+}
+
+void require_reader(lcj_reader* reader)
+{
+    if (reader == nullptr || !reader->value) {
+        throw std::invalid_argument("reader must not be null");
+    }
+}
+
+void require_bitmap(lcj_bitmap* bitmap)
+{
+    if (bitmap == nullptr || !bitmap->value) {
+        throw std::invalid_argument("bitmap must not be null");
+    }
+}
+
+/*
+ * Decorates libCZI's LRU subblock cache with hit, miss and eviction counters
+ * and keeps it inside the byte and element budget after every insertion.
+ */
+class subblock_cache final : public libCZI::ISubBlockCache {
+public:
+    subblock_cache(uint64_t max_bytes, uint32_t max_subblocks)
+        : inner_(libCZI::CreateSubBlockCache())
+    {
+        limits_.maxMemoryUsage = max_bytes;
+        limits_.maxSubBlockCount = max_subblocks == 0
+            ? std::numeric_limits<uint32_t>::max()
+            : max_subblocks;
+    }
+
+    Statistics GetStatistics(std::uint8_t mask) const override
+    {
+        return inner_->GetStatistics(mask);
+    }
+
+    void Prune(const PruneOptions& options) override
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        prune_locked(options, true);
+    }
+
+    std::shared_ptr<libCZI::IBitmapData> Get(int subblock_index) override
+    {
+        auto bitmap = inner_->Get(subblock_index);
+        (bitmap ? hits_ : misses_).fetch_add(1, std::memory_order_relaxed);
+        return bitmap;
+    }
+
+    void Add(
+        int subblock_index,
+        std::shared_ptr<libCZI::IBitmapData> bitmap) override
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        inner_->Add(subblock_index, std::move(bitmap));
+        prune_locked(limits_, true);
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        PruneOptions everything;
+        everything.maxMemoryUsage = 0;
+        everything.maxSubBlockCount = 0;
+        prune_locked(everything, false);
+    }
+
+    lcj_cache_statistics statistics() const
+    {
+        const auto native = inner_->GetStatistics(
+            kMemoryUsage | kElementsCount);
+
+        lcj_cache_statistics result{};
+        result.hits = hits_.load(std::memory_order_relaxed);
+        result.misses = misses_.load(std::memory_order_relaxed);
+        result.evictions = evictions_.load(std::memory_order_relaxed);
+        result.memory_bytes = native.memoryUsage;
+        result.elements = native.elementsCount;
+        return result;
+    }
+
+private:
+    void prune_locked(const PruneOptions& options, bool count_evictions)
+    {
+        const auto before =
+            inner_->GetStatistics(kElementsCount).elementsCount;
+        inner_->Prune(options);
+        const auto after =
+            inner_->GetStatistics(kElementsCount).elementsCount;
+        if (count_evictions && after < before) {
+            evictions_.fetch_add(before - after, std::memory_order_relaxed);
+        }
+    }
+
+    std::shared_ptr<libCZI::ISubBlockCache> inner_;
+    PruneOptions limits_;
+    std::mutex mutex_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+};
+
+std::shared_ptr<libCZI::ISubBlock> read_subblock(
+    lcj_reader* reader,
+    int32_t native_index)
+{
+    auto subblock = reader->value->ReadSubBlock(native_index);
+    if (!subblock) {
+        throw std::out_of_range("subblock index is out of range");
+    }
+    return subblock;
+}
+
+/*
+ * Decode one subblock, going through the reader's cache when it has one.
+ * Uncompressed subblocks bypass the cache because decoding them is a copy.
+ */
+std::shared_ptr<libCZI::IBitmapData> create_bitmap(
+    lcj_reader* reader,
+    libCZI::ISubBlock& subblock)
+{
+    auto& metrics = *reader->metrics;
+    std::shared_ptr<libCZI::IBitmapData> decoded;
+    {
+        scoped_timer timer(&metrics.decode_nanoseconds);
+        decoded = subblock.CreateBitmap();
+    }
+    if (!decoded) {
+        throw std::runtime_error("libCZI returned a null bitmap");
+    }
+    metrics.count_decode(subblock.GetSubBlockInfo().compressionModeRaw);
+    return decoded;
+}
+
+std::shared_ptr<libCZI::IBitmapData> decode_subblock(
+    lcj_reader* reader,
+    int32_t native_index)
+{
+    bool cacheable = false;
+    if (reader->cache) {
+        libCZI::SubBlockInfo native_info;
+        if (!reader->value->TryGetSubBlockInfo(native_index, &native_info)) {
+            throw std::out_of_range("subblock index is out of range");
+        }
+        cacheable = native_info.compressionModeRaw != 0;
+    }
+
+    if (cacheable) {
+        if (auto cached = reader->cache->Get(native_index)) {
+            return cached;
+        }
+    }
+
+    auto subblock = read_subblock(reader, native_index);
+
+    auto decoded = create_bitmap(reader, *subblock);
+    if (cacheable) {
+        reader->cache->Add(native_index, decoded);
+    }
+    return decoded;
+}
+
+/*
+ * Wrap a decoded bitmap in a handle whose pixels count towards the reader's
+ * live bitmap bytes until it is closed. Pixel types the wrapper cannot
+ * describe count as empty.
+ */
+std::unique_ptr<lcj_bitmap> bitmap_handle(
+    lcj_reader* reader,
+    std::shared_ptr<libCZI::IBitmapData> decoded)
+{
+    const auto pixel_type = decoded->GetPixelType();
+    const auto size = decoded->GetSize();
+
+    auto result = std::make_unique<lcj_bitmap>();
+    if (to_lcj_pixel_type(pixel_type) != LCJ_PIXEL_INVALID) {
+        result->bytes =
+            static_cast<uint64_t>(row_bytes_of(pixel_type, size.w)) * size.h;
+    }
+    result->value = std::move(decoded);
+    result->metrics = reader->metrics;
+    result->metrics->add_bitmap(result->bytes);
+    return result;
+}
+
+void read_subblock_into(
+    lcj_reader* reader,
+    int32_t native_index,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride)
+{
+    libCZI::SubBlockInfo native_info;
+    if (!reader->value->TryGetSubBlockInfo(native_index, &native_info)) {
+        throw std::out_of_range("subblock index is out of range");
+    }
+
+    if (native_info.compressionModeRaw != 0) {
+        auto decoded = decode_subblock(reader, native_index);
+        scoped_timer timer(&reader->metrics->copy_nanoseconds);
+        copy_bitmap(
+            decoded,
+            destination,
+            destination_size,
+            destination_row_stride);
+        return;
+    }
+
+    // Uncompressed payloads are tightly packed rows of the physical
+    // size, so they can be copied out without an intermediate bitmap.
+    const auto width = native_info.physicalSize.w;
+    const auto height = native_info.physicalSize.h;
+    const auto row_bytes = row_bytes_of(native_info.pixelType, width);
+    require_destination(
+        destination,
+        destination_size,
+        destination_row_stride,
+        row_bytes,
+        height);
+
+    auto subblock = read_subblock(reader, native_index);
+
+    const void* data = nullptr;
+    size_t bytes = 0;
+    subblock->DangerousGetRawData(
+        libCZI::ISubBlock::MemBlkType::Data,
+        data,
+        bytes);
+    if (height != 0 &&
+        row_bytes > std::numeric_limits<size_t>::max() / height) {
+        throw std::overflow_error("subblock size overflows size_t");
+    }
+    if (bytes < row_bytes * height) {
+        throw std::runtime_error(
+            "uncompressed subblock payload is truncated");
+    }
+    if (bytes != 0 && data == nullptr) {
+        throw std::runtime_error(
+            "libCZI returned null subblock storage");
+    }
+
+    reader->metrics->count_decode(0);
+    scoped_timer timer(&reader->metrics->copy_nanoseconds);
+    copy_rows(
+        static_cast<const uint8_t*>(data),
+        row_bytes,
+        static_cast<uint8_t*>(destination),
+        destination_row_stride,
+        row_bytes,
+        height);
+}
+
+/*
+ * File position of every subblock segment, indexed by subblock index. Built
+ * on first use with one pass over the directory.
+ */
+const std::vector<uint64_t>& subblock_positions(lcj_reader* reader)
+{
+    std::call_once(reader->core->positions_once, [reader] {
+        std::vector<uint64_t> positions;
+        positions.reserve(static_cast<size_t>(
+            std::max(0, reader->value->GetStatistics().subBlockCount)));
+        reader->value->EnumerateSubBlocksEx(
+            [&](int index, const libCZI::DirectorySubBlockInfo& native_info) {
+                const auto slot = static_cast<size_t>(index);
+                if (slot >= positions.size()) {
+                    positions.resize(slot + 1);
+                }
+                positions[slot] = native_info.filePosition;
+                return true;
+            });
+        reader->core->positions = std::move(positions);
+    });
+    return reader->core->positions;
+}
+
+uint64_t subblock_position(lcj_reader* reader, int32_t native_index)
+{
+    const auto& positions = subblock_positions(reader);
+    if (native_index < 0 ||
+        static_cast<size_t>(native_index) >= positions.size()) {
+        throw std::out_of_range("subblock index is out of range");
+    }
+    return positions[static_cast<size_t>(native_index)];
+}
+
+/*
+ * Positions and payload sizes of the attachments, in the directory order
+ * libCZI uses for attachment indices; read once per reader.
+ */
+const std::vector<attachment_record>& attachment_records(lcj_reader* reader)
+{
+    std::call_once(reader->core->attachments_once, [reader] {
+        if (!reader->stream) {
+            throw unsupported_operation(
+                "reader has no stream for attachment reads");
+        }
+
+        auto records = read_attachment_records(*reader->stream);
+        size_t native_count = 0;
+        reader->value->EnumerateAttachments(
+            [&](int, const libCZI::AttachmentInfo&) {
+                ++native_count;
+                return true;
+            });
+        if (native_count != records.size()) {
+            throw std::runtime_error(
+                "attachment directory disagrees with libCZI");
+        }
+        reader->core->attachments = std::move(records);
+    });
+    return reader->core->attachments;
+}
+
+const attachment_record& require_attachment(
+    lcj_reader* reader,
+    int32_t index)
+{
+    const auto& records = attachment_records(reader);
+    if (index < 0 || static_cast<size_t>(index) >= records.size()) {
+        throw std::out_of_range("attachment index is out of range");
+    }
+    return records[static_cast<size_t>(index)];
+}
+
+void sort_by_file_position(
+    lcj_reader* reader,
+    int32_t* native_indices,
+    size_t count)
+{
+    const auto& positions = subblock_positions(reader);
+    for (size_t i = 0; i < count; ++i) {
+        if (native_indices[i] < 0 ||
+            static_cast<size_t>(native_indices[i]) >= positions.size()) {
+            throw std::out_of_range("subblock index is out of range");
+        }
+    }
+
+    std::stable_sort(
+        native_indices,
+        native_indices + count,
+        [&positions](int32_t left, int32_t right) {
+            return positions[static_cast<size_t>(left)] <
+                positions[static_cast<size_t>(right)];
+        });
+}
+
+void require_scan(lcj_scan* scan)
+{
+    if (scan == nullptr || scan->reader == nullptr) {
+        throw std::invalid_argument("scan must not be null");
+    }
+}
+
+// Keep up to `readahead` segment reads in flight on the shared pool.
+void scan_read_ahead(lcj_scan* scan)
+{
+    while (scan->next_read < scan->indices.size() &&
+        scan->pending.size() < scan->readahead) {
+        auto* reader = scan->reader;
+        const auto native_index = scan->indices[scan->next_read];
+        auto task = std::make_shared<
+            std::packaged_task<std::shared_ptr<libCZI::ISubBlock>()>>(
+            [reader, native_index] {
+                return read_subblock(reader, native_index);
+            });
+
+        scan->pending.push_back(task->get_future());
+        ++scan->next_read;
+        shared_pool().submit([task] { (*task)(); });
+    }
+}
+
+void copy_subblock_data(
+    lcj_reader* reader,
+    int32_t native_index,
+    void* destination,
+    size_t destination_size)
+{
+    auto subblock = read_subblock(reader, native_index);
+
+    const void* data = nullptr;
+    size_t bytes = 0;
+    subblock->DangerousGetRawData(
+        libCZI::ISubBlock::MemBlkType::Data,
+        data,
+        bytes);
+
+    if (bytes > destination_size) {
+        throw buffer_too_small("subblock data destination is too small");
+    }
+    if (bytes != 0 && destination == nullptr) {
+        throw std::invalid_argument(
+            "subblock data destination must not be null");
+    }
+    if (bytes != 0 && data == nullptr) {
+        throw std::runtime_error(
+            "libCZI returned null subblock storage");
+    }
+    if (bytes != 0) {
+        std::memcpy(destination, data, bytes);
+    }
+}
+
+struct queue_request {
+    uint64_t request_id;
+    uint64_t user_data;
+    lcj_request_kind kind;
+    int32_t native_index;
+    void* destination;
+    size_t destination_size;
+    size_t destination_row_stride;
+};
+
+/*
+ * Requests wait in `waiting` until fewer than `max_in_flight` run on the
+ * shared pool; finished ones move to `completed` until polled. The state is
+ * shared with running tasks so that it outlives them.
+ */
+struct queue_state : std::enable_shared_from_this<queue_state> {
+    lcj_reader* reader = nullptr;
+    uint32_t max_in_flight = 0;
+    uint64_t next_request_id = 1;
+    uint32_t running = 0;
+    std::deque<queue_request> waiting;
+    std::deque<lcj_completion> completed;
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    void dispatch_locked()
+    {
+        while (!waiting.empty() && running < max_in_flight) {
+            auto request = waiting.front();
+            waiting.pop_front();
+            ++running;
+
+            auto self = shared_from_this();
+            shared_pool().submit([self, request] { self->execute(request); });
+        }
+    }
+
+    void execute(const queue_request& request)
+    {
+        const auto status = protect([&] {
+            if (request.kind == LCJ_REQUEST_RAW) {
+                copy_subblock_data(
+                    reader,
+                    request.native_index,
+                    request.destination,
+                    request.destination_size);
+            }
+            else {
+                read_subblock_into(
+                    reader,
+                    request.native_index,
+                    request.destination,
+                    request.destination_size,
+                    request.destination_row_stride);
+            }
+        });
+
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            lcj_completion completion{};
+            completion.request_id = request.request_id;
+            completion.user_data = request.user_data;
+            completion.native_index = request.native_index;
+            completion.status = static_cast<int32_t>(status);
+            completed.push_back(completion);
+            --running;
+            dispatch_locked();
+        }
+        changed.notify_all();
+    }
+};
+
+void require_queue(lcj_queue* queue)
+{
+    if (queue == nullptr || !queue->state) {
+        throw std::invalid_argument("queue must not be null");
+    }
+}
+
+/*
+ * Uniform grid per pyramid layer over the logical rectangles of all
+ * subblocks. Cells are about one typical tile of that layer in size, so a
+ * viewport query touches a handful of cells instead of every subblock.
+ * Plane coordinates are interned because mosaics repeat a few planes across
+ * many tiles.
+ */
+struct spatial_index {
+    struct entry {
+        int32_t native_index;
+        uint32_t plane;
+        libCZI::IntRect rect;
+    };
+
+    struct grid {
+        int32_t layer = 0;
+        int64_t origin_x = 0;
+        int64_t origin_y = 0;
+        int64_t cell_width = 1;
+        int64_t cell_height = 1;
+        int64_t columns = 0;
+        int64_t rows = 0;
+        std::vector<uint32_t> cell_start;
+        std::vector<uint32_t> cell_entries;
+    };
+
+    std::vector<entry> entries;
+    std::vector<lcj_plane_coordinate> planes;
+    std::vector<grid> grids;
+};
+
+bool rects_intersect(const libCZI::IntRect& a, const libCZI::IntRect& b)
+{
+    return int64_t{a.x} < int64_t{b.x} + b.w &&
+        int64_t{b.x} < int64_t{a.x} + a.w &&
+        int64_t{a.y} < int64_t{b.y} + b.h &&
+        int64_t{b.y} < int64_t{a.y} + a.h;
+}
+
+/*
+ * Pyramid layer of a subblock from the ratio of its logical to physical
+ * size, using the minification factor libCZI reports for its scene.
+ */
+int32_t pyramid_layer(
+    const libCZI::SubBlockInfo& native_info,
+    const std::map<int, int>& scene_factors)
+{
+    if (native_info.physicalSize.w == 0 || native_info.logicalRect.w <= 0) {
+        return 0;
+    }
+
+    const auto ratio = static_cast<double>(native_info.logicalRect.w) /
+        static_cast<double>(native_info.physicalSize.w);
+    if (ratio < 1.5) {
+        return 0;
+    }
+
+    int scene = 0;
+    native_info.coordinate.TryGetPosition(libCZI::DimensionIndex::S, &scene);
+    const auto found = scene_factors.find(scene);
+    const auto factor =
+        found != scene_factors.end() && found->second > 1 ? found->second : 2;
+    return static_cast<int32_t>(
+        std::lround(std::log(ratio) / std::log(static_cast<double>(factor))));
+}
+
+std::unique_ptr<spatial_index> build_spatial_index(lcj_reader* reader)
+{
+    std::map<int, int> scene_factors;
+    for (const auto& scene :
+         reader->value->GetPyramidStatistics().scenePyramidStatistics) {
+        for (const auto& layer : scene.second) {
+            if (layer.layerInfo.minificationFactor > 1) {
+                scene_factors[scene.first] =
+                    layer.layerInfo.minificationFactor;
+                break;
+            }
+        }
+    }
+
+    auto index = std::make_unique<spatial_index>();
+    using plane_key = std::array<int32_t, LCJ_DIMENSION_COUNT + 1>;
+    std::map<plane_key, uint32_t> plane_ids;
+    std::map<int32_t, std::vector<uint32_t>> layers;
+
+    reader->value->EnumerateSubBlocks(
+        [&](int native_index, const libCZI::SubBlockInfo& native_info) {
+            lcj_plane_coordinate plane{};
+            plane_key key{};
+            for (size_t i = 0; i < LCJ_DIMENSION_COUNT; ++i) {
+                int coordinate = 0;
+                if (native_info.coordinate.TryGetPosition(
+                        dimensions[i],
+                        &coordinate)) {
+                    plane.coordinate_mask |=
+                        static_cast<uint16_t>(uint16_t{1} << i);
+                    plane.coordinate[i] = static_cast<int32_t>(coordinate);
+                }
+                key[i] = plane.coordinate[i];
+            }
+            key[LCJ_DIMENSION_COUNT] = plane.coordinate_mask;
+
+            const auto inserted = plane_ids.emplace(
+                key,
+                static_cast<uint32_t>(index->planes.size()));
+            if (inserted.second) {
+                index->planes.push_back(plane);
+            }
+
+            const auto entry_id = static_cast<uint32_t>(index->entries.size());
+            index->entries.push_back({
+                static_cast<int32_t>(native_index),
+                inserted.first->second,
+                native_info.logicalRect,
+            });
+            layers[pyramid_layer(native_info, scene_factors)].push_back(
+                entry_id);
+            return true;
+        });
+
+    for (auto& layer : layers) {
+        const auto& members = layer.second;
+        spatial_index::grid grid;
+        grid.layer = layer.first;
+
+        int64_t min_x = std::numeric_limits<int64_t>::max();
+        int64_t min_y = std::numeric_limits<int64_t>::max();
+        int64_t max_x = std::numeric_limits<int64_t>::min();
+        int64_t max_y = std::numeric_limits<int64_t>::min();
+        std::vector<int32_t> widths;
+        std::vector<int32_t> heights;
+        for (const auto id : members) {
+            const auto& rect = index->entries[id].rect;
+            min_x = std::min<int64_t>(min_x, rect.x);
+            min_y = std::min<int64_t>(min_y, rect.y);
+            max_x = std::max<int64_t>(max_x, int64_t{rect.x} + rect.w);
+            max_y = std::max<int64_t>(max_y, int64_t{rect.y} + rect.h);
+            widths.push_back(std::max(1, rect.w));
+            heights.push_back(std::max(1, rect.h));
+        }
+
+        std::nth_element(
+            widths.begin(),
+            widths.begin() + widths.size() / 2,
+            widths.end());
+        std::nth_element(
+            heights.begin(),
+            heights.begin() + heights.size() / 2,
+            heights.end());
+        grid.origin_x = min_x;
+        grid.origin_y = min_y;
+        grid.cell_width = widths[widths.size() / 2];
+        grid.cell_height = heights[heights.size() / 2];
+
+        // Keep the cell count proportional to the number of subblocks even
+        // when a layer is sparse.
+        const auto span_x = std::max<int64_t>(1, max_x - min_x);
+        const auto span_y = std::max<int64_t>(1, max_y - min_y);
+        const auto cell_budget =
+            4 * static_cast<int64_t>(members.size()) + 16;
+        for (;;) {
+            grid.columns = (span_x + grid.cell_width - 1) / grid.cell_width;
+            grid.rows = (span_y + grid.cell_height - 1) / grid.cell_height;
+            // Spans reach 2^32 each, so the product could overflow.
+            if (grid.columns <= cell_budget / grid.rows) {
+                break;
+            }
+            grid.cell_width *= 2;
+            grid.cell_height *= 2;
+        }
+
+        const auto cells = static_cast<size_t>(grid.columns * grid.rows);
+        const auto cell_range = [&grid](const libCZI::IntRect& rect) {
+            const auto x0 = (int64_t{rect.x} - grid.origin_x) /
+                grid.cell_width;
+            const auto y0 = (int64_t{rect.y} - grid.origin_y) /
+                grid.cell_height;
+            const auto x1 = (int64_t{rect.x} + std::max(1, rect.w) - 1 -
+                                grid.origin_x) / grid.cell_width;
+            const auto y1 = (int64_t{rect.y} + std::max(1, rect.h) - 1 -
+                                grid.origin_y) / grid.cell_height;
+            return std::make_tuple(
+                std::max<int64_t>(0, x0),
+                std::max<int64_t>(0, y0),
+                std::min(grid.columns - 1, x1),
+                std::min(grid.rows - 1, y1));
+        };
+
+        // Counting pass, then fill, giving a compact CSR layout.
+        grid.cell_start.assign(cells + 1, 0);
+        for (const auto id : members) {
+            int64_t x0, y0, x1, y1;
+            std::tie(x0, y0, x1, y1) = cell_range(index->entries[id].rect);
+            for (auto y = y0; y <= y1; ++y) {
+                for (auto x = x0; x <= x1; ++x) {
+                    ++grid.cell_start[static_cast<size_t>(
+                        y * grid.columns + x + 1)];
+                }
+            }
+        }
+        for (size_t i = 0; i < cells; ++i) {
+            grid.cell_start[i + 1] += grid.cell_start[i];
+        }
+
+        grid.cell_entries.resize(grid.cell_start[cells]);
+        auto cursor = grid.cell_start;
+        for (const auto id : members) {
+            int64_t x0, y0, x1, y1;
+            std::tie(x0, y0, x1, y1) = cell_range(index->entries[id].rect);
+            for (auto y = y0; y <= y1; ++y) {
+                for (auto x = x0; x <= x1; ++x) {
+                    grid.cell_entries[cursor[static_cast<size_t>(
+                        y * grid.columns + x)]++] = id;
+                }
+            }
+        }
+
+        index->grids.push_back(std::move(grid));
+    }
+
+    return index;
+}
+
+const spatial_index& reader_spatial_index(lcj_reader* reader)
+{
+    std::call_once(reader->core->spatial_once, [reader] {
+        reader->core->spatial = build_spatial_index(reader);
+    });
+    return *reader->core->spatial;
+}
+
+std::vector<int32_t> query_spatial_index(
+    const spatial_index& index,
+    const lcj_plane_coordinate* plane,
+    const libCZI::IntRect* roi,
+    int32_t layer)
+{
+    std::vector<uint8_t> plane_selected(index.planes.size(), 1);
+    if (plane != nullptr) {
+        for (size_t i = 0; i < index.planes.size(); ++i) {
+            const auto& candidate = index.planes[i];
+            bool matches = true;
+            for (size_t d = 0; d < LCJ_DIMENSION_COUNT && matches; ++d) {
+                const auto bit = 1u << d;
+                matches = (plane->coordinate_mask & bit) == 0 ||
+                    (candidate.coordinate_mask & bit) == 0 ||
+                    candidate.coordinate[d] == plane->coordinate[d];
+            }
+            plane_selected[i] = matches ? 1 : 0;
+        }
+    }
+
+    std::vector<uint32_t> candidates;
+    for (const auto& grid : index.grids) {
+        if (layer >= 0 && grid.layer != layer) {
+            continue;
+        }
+
+        int64_t x0 = 0;
+        int64_t y0 = 0;
+        int64_t x1 = grid.columns - 1;
+        int64_t y1 = grid.rows - 1;
+        if (roi != nullptr) {
+            x0 = std::max<int64_t>(
+                0,
+                (int64_t{roi->x} - grid.origin_x) / grid.cell_width);
+            y0 = std::max<int64_t>(
+                0,
+                (int64_t{roi->y} - grid.origin_y) / grid.cell_height);
+            x1 = std::min(
+                x1,
+                (int64_t{roi->x} + roi->w - 1 - grid.origin_x) /
+                    grid.cell_width);
+            y1 = std::min(
+                y1,
+                (int64_t{roi->y} + roi->h - 1 - grid.origin_y) /
+                    grid.cell_height);
+        }
+
+        for (auto y = y0; y <= y1; ++y) {
+            for (auto x = x0; x <= x1; ++x) {
+                const auto cell = static_cast<size_t>(y * grid.columns + x);
+                candidates.insert(
+                    candidates.end(),
+                    grid.cell_entries.begin() + grid.cell_start[cell],
+                    grid.cell_entries.begin() + grid.cell_start[cell + 1]);
+            }
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(
+        std::unique(candidates.begin(), candidates.end()),
+        candidates.end());
+
+    std::vector<int32_t> result;
+    for (const auto id : candidates) {
+        const auto& entry = index.entries[id];
+        if (plane_selected[entry.plane] != 0 &&
+            (roi == nullptr || rects_intersect(entry.rect, *roi))) {
+            result.push_back(entry.native_index);
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+libCZI::IntRect require_roi(const lcj_rect_i32* roi)
+{
+    if (roi == nullptr) {
+        throw std::invalid_argument("region of interest must not be null");
+    }
+    if (roi->width <= 0 || roi->height <= 0) {
+        throw std::invalid_argument(
+            "region of interest must have a positive size");
+    }
+    return {roi->x, roi->y, roi->width, roi->height};
+}
+
+/*
+ * libCZI selects scenes through an index set rather than the plane
+ * coordinate, so an S value in the mask becomes a single-scene filter.
+ */
+struct plane_selection {
+    libCZI::CDimCoordinate coordinate;
+    std::shared_ptr<libCZI::IIndexSet> scene_filter;
+    int channel = 0;
+};
+
+void require_plane_mask(const lcj_plane_coordinate& plane)
+{
+    if ((plane.coordinate_mask >> LCJ_DIMENSION_COUNT) != 0) {
+        throw std::invalid_argument("plane coordinate mask is invalid");
+    }
+}
+
+/*
+ * Dimensions selected by the mask must match where the subblock has them,
+ * the same rule libCZI applies to plane coordinates.
+ */
+bool plane_matches(
+    const lcj_plane_coordinate& plane,
+    const libCZI::IDimCoordinate& coordinate)
+{
+    for (size_t i = 0; i < LCJ_DIMENSION_COUNT; ++i) {
+        if ((plane.coordinate_mask & (1u << i)) == 0) {
+            continue;
+        }
+
+        int value = 0;
+        if (coordinate.TryGetPosition(dimensions[i], &value) &&
+            value != plane.coordinate[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+plane_selection to_plane_selection(const lcj_plane_coordinate* plane)
+{
+    if (plane == nullptr) {
+        throw std::invalid_argument("plane coordinate must not be null");
+    }
+    require_plane_mask(*plane);
+
+    plane_selection selection;
+    for (size_t i = 0; i < LCJ_DIMENSION_COUNT; ++i) {
+        if ((plane->coordinate_mask & (1u << i)) == 0) {
+            continue;
+        }
+
+        if (dimensions[i] == libCZI::DimensionIndex::S) {
+            selection.scene_filter = libCZI::Utils::IndexSetFromString(
+                std::to_wstring(plane->coordinate[i]));
+            continue;
+        }
+        if (dimensions[i] == libCZI::DimensionIndex::C) {
+            selection.channel = plane->coordinate[i];
+        }
+        selection.coordinate.Set(dimensions[i], plane->coordinate[i]);
+    }
+    return selection;
+}
+
+libCZI::PixelType plane_pixel_type(
+    lcj_reader* reader,
+    const plane_selection& plane,
+    lcj_pixel_type requested)
+{
+    if (requested != LCJ_PIXEL_INVALID) {
+        return from_lcj_pixel_type(requested);
+    }
+
+    libCZI::SubBlockInfo native_info;
+    if (!reader->value->TryGetSubBlockInfoOfArbitrarySubBlockInChannel(
+            plane.channel,
+            native_info)) {
+        throw std::out_of_range("plane channel contains no subblocks");
+    }
+    return native_info.pixelType;
+}
+
+template<class Options>
+void apply_compose_options(
+    lcj_reader* reader,
+    const lcj_compose_options* options,
+    const plane_selection& plane,
+    Options& native)
+{
+    native.Clear();
+    native.sceneFilter = plane.scene_filter;
+    if (reader->cache) {
+        native.subBlockCache = reader->cache;
+        native.onlyUseSubBlockCacheForCompressedData = true;
+    }
+    if (options == nullptr) {
+        native.backGroundColor = {0.0f, 0.0f, 0.0f};
+        native.sortByM = true;
+        native.useVisibilityCheckOptimization = true;
+        return;
+    }
+
+    if (options->fill_background != 0) {
+        native.backGroundColor = {
+            options->background[0],
+            options->background[1],
+            options->background[2],
+        };
+    }
+    else {
+        const auto none = std::numeric_limits<float>::quiet_NaN();
+        native.backGroundColor = {none, none, none};
+    }
+    native.sortByM = options->sort_by_m != 0;
+    native.useVisibilityCheckOptimization = options->visibility_check != 0;
+}
+
+/*
+ * Presents caller-owned storage as a libCZI bitmap so that accessors compose
+ * straight into it.
+ */
+class caller_bitmap final : public libCZI::IBitmapData {
+public:
+    caller_bitmap(
+        libCZI::PixelType pixel_type,
+        uint32_t width,
+        uint32_t height,
+        void* destination,
+        size_t destination_size,
+        size_t destination_row_stride)
+        : pixel_type_(pixel_type),
+          width_(width),
+          height_(height),
+          data_(destination),
+          size_(destination_size),
+          stride_(static_cast<uint32_t>(destination_row_stride))
+    {
+        require_destination(
+            destination,
+            destination_size,
+            destination_row_stride,
+            row_bytes_of(pixel_type, width),
+            height);
+        if (destination_row_stride > std::numeric_limits<uint32_t>::max()) {
+            throw unsupported_operation(
+                "destination row stride exceeds the libCZI limit");
+        }
+    }
+
+    libCZI::PixelType GetPixelType() const override
+    {
+        return pixel_type_;
+    }
+
+    libCZI::IntSize GetSize() const override
+    {
+        return {width_, height_};
+    }
+
+    libCZI::BitmapLockInfo Lock() override
+    {
+        ++lock_count_;
+        libCZI::BitmapLockInfo info;
+        info.ptrData = data_;
+        info.ptrDataRoi = data_;
+        info.stride = stride_;
+        info.size = size_;
+        return info;
+    }
+
+    void Unlock() override
+    {
+        --lock_count_;
+    }
+
+    int GetLockCount() const override
+    {
+        return lock_count_;
+    }
+
+private:
+    libCZI::PixelType pixel_type_;
+    uint32_t width_;
+    uint32_t height_;
+    void* data_;
+    size_t size_;
+    uint32_t stride_;
+    int lock_count_ = 0;
+};
+
+struct hyperslab_plane {
+    lcj_plane_coordinate coordinate;
+    size_t offset;
+};
+
+size_t checked_multiply(size_t a, size_t b)
+{
+    if (a != 0 && b > std::numeric_limits<size_t>::max() / a) {
+        throw std::overflow_error("hyperslab size overflows size_t");
+    }
+    return a * b;
+}
+
+size_t checked_add(size_t a, size_t b)
+{
+    if (b > std::numeric_limits<size_t>::max() - a) {
+        throw std::overflow_error("hyperslab size overflows size_t");
+    }
+    return a + b;
+}
+
+/*
+ * Expand the ranges into planes, first range varying fastest.
+ */
+std::vector<hyperslab_plane> hyperslab_planes(
+    const lcj_plane_coordinate* base,
+    const lcj_hyperslab_range* ranges,
+    size_t range_count)
+{
+    if (range_count != 0 && ranges == nullptr) {
+        throw std::invalid_argument("hyperslab ranges must not be null");
+    }
+    if (range_count > LCJ_DIMENSION_COUNT) {
+        throw std::invalid_argument("too many hyperslab ranges");
+    }
+
+    lcj_plane_coordinate first{};
+    if (base != nullptr) {
+        require_plane_mask(*base);
+        first = *base;
+    }
+
+    uint32_t seen = 0;
+    size_t plane_count = 1;
+    for (size_t i = 0; i < range_count; ++i) {
+        const auto& range = ranges[i];
+        if (range.dimension >= LCJ_DIMENSION_COUNT) {
+            throw std::invalid_argument("hyperslab dimension is invalid");
+        }
+        if ((seen & (1u << range.dimension)) != 0) {
+            throw std::invalid_argument(
+                "hyperslab ranges must name different dimensions");
+        }
+        if (range.size <= 0 || range.reserved != 0) {
+            throw std::invalid_argument(
+                "hyperslab ranges need a positive size and zero reserved");
+        }
+        if (int64_t{range.start} + range.size - 1 >
+            std::numeric_limits<int32_t>::max()) {
+            throw std::invalid_argument("hyperslab range overflows int32");
+        }
+        if (range.stride > std::numeric_limits<size_t>::max()) {
+            throw std::invalid_argument("hyperslab stride overflows size_t");
+        }
+        seen |= 1u << range.dimension;
+        plane_count =
+            checked_multiply(plane_count, static_cast<size_t>(range.size));
+        first.coordinate_mask |=
+            static_cast<uint16_t>(uint16_t{1} << range.dimension);
+        first.coordinate[range.dimension] = range.start;
+    }
+
+    std::vector<hyperslab_plane> planes;
+    planes.reserve(plane_count);
+    for (size_t index = 0; index < plane_count; ++index) {
+        hyperslab_plane plane{first, 0};
+        auto rest = index;
+        for (size_t i = 0; i < range_count; ++i) {
+            const auto size = static_cast<size_t>(ranges[i].size);
+            const auto step = rest % size;
+            rest /= size;
+            plane.coordinate.coordinate[ranges[i].dimension] +=
+                static_cast<int32_t>(step);
+            plane.offset += step * static_cast<size_t>(ranges[i].stride);
+        }
+        planes.push_back(plane);
+    }
+    return planes;
+}
+
+/*
+ * Check that planes of `plane_bytes` each are disjoint and fit the
+ * destination. Sorted by stride, each stride must clear everything spanned
+ * by the smaller ones; that is sufficient for disjoint planes and matches
+ * any dense or padded array layout.
+ */
+void require_hyperslab_layout(
+    const lcj_hyperslab_range* ranges,
+    size_t range_count,
+    size_t plane_bytes,
+    size_t destination_size)
+{
+    std::vector<const lcj_hyperslab_range*> by_stride;
+    for (size_t i = 0; i < range_count; ++i) {
+        if (ranges[i].size > 1) {
+            by_stride.push_back(&ranges[i]);
+        }
+    }
+    std::sort(
+        by_stride.begin(),
+        by_stride.end(),
+        [](const lcj_hyperslab_range* a, const lcj_hyperslab_range* b) {
+            return a->stride < b->stride;
+        });
+
+    size_t extent = plane_bytes;
+    for (const auto* range : by_stride) {
+        if (range->stride < extent) {
+            throw std::invalid_argument("hyperslab planes overlap");
+        }
+        extent = checked_add(
+            checked_multiply(
+                static_cast<size_t>(range->size - 1),
+                static_cast<size_t>(range->stride)),
+            extent);
+    }
+    if (destination_size < extent) {
+        throw buffer_too_small("hyperslab destination buffer is too small");
+    }
+}
+
+float require_zoom(float zoom)
+{
+    if (!(zoom > 0.0f && zoom <= 1.0f)) {
+        throw std::invalid_argument("zoom must be in (0, 1]");
+    }
+    return zoom;
+}
+
+std::shared_ptr<reader_core> open_core(
+    std::shared_ptr<libCZI::IStream> stream,
+    const lcj_reader_options& settings)
+{
+    auto metrics = std::make_shared<reader_metrics>();
+    stream = std::make_shared<counting_stream>(std::move(stream), metrics);
+
+    auto native_reader = libCZI::CreateCZIReader();
+    native_reader->Open(stream);
+
+    auto core = std::make_shared<reader_core>();
+    core->value = std::move(native_reader);
+    core->stream = std::move(stream);
+    core->metrics = std::move(metrics);
+    if (settings.cache_max_bytes != 0) {
+        core->cache = std::make_shared<subblock_cache>(
+            settings.cache_max_bytes,
+            settings.cache_max_subblocks);
+    }
+    return core;
+}
+
+std::unique_ptr<lcj_reader> reader_handle(std::shared_ptr<reader_core> core)
+{
+    auto result = std::make_unique<lcj_reader>();
+    result->value = core->value;
+    result->stream = core->stream;
+    result->cache = core->cache;
+    result->metrics = core->metrics;
+    result->core = std::move(core);
+    return result;
+}
+
+std::unique_ptr<lcj_reader> open_reader(
+    std::shared_ptr<libCZI::IStream> stream,
+    const lcj_reader_options& settings)
+{
+    return reader_handle(open_core(std::move(stream), settings));
+}
+
+/*
+ * Parsed files shared by readers opened with `lcj_reader_options.shared`.
+ * Entries are keyed by path and the options that shape the core, and are
+ * dropped when the file's size or modification time no longer matches.
+ * Cores no handle refers to stay parsed, most recently used first, until
+ * the idle capacity is exceeded.
+ */
+class reader_pool {
+public:
+    std::shared_ptr<reader_core> open(
+        const char* path,
+        const lcj_reader_options& settings)
+    {
+        const key_type key{
+            path,
+            settings.stream,
+            settings.cache_max_bytes,
+            settings.cache_max_subblocks};
+        const auto identity = identify_file(path);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (auto core = find_locked(key, identity)) {
+                return core;
+            }
+        }
+
+        // Parsing takes long; racing opens of one file may both parse, and
+        // the first to finish is kept.
+        auto core = open_core(open_stream(path, settings.stream), settings);
+        core->pooled = true;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (auto existing = find_locked(key, identity)) {
+            return existing;
+        }
+        entries_.push_front(entry{key, identity, core});
+        trim_locked();
+        return core;
+    }
+
+    void set_idle_capacity(size_t capacity)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle_capacity_ = capacity;
+        trim_locked();
+    }
+
+    void trim()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        trim_locked();
+    }
+
+private:
+    using key_type = std::tuple<std::string, uint32_t, uint64_t, uint32_t>;
+
+    struct entry {
+        key_type key;
+        file_identity identity;
+        std::shared_ptr<reader_core> core;
+    };
+
+    std::shared_ptr<reader_core> find_locked(
+        const key_type& key,
+        const file_identity& identity)
+    {
+        const auto found = std::find_if(
+            entries_.begin(),
+            entries_.end(),
+            [&key](const entry& candidate) { return candidate.key == key; });
+        if (found == entries_.end()) {
+            return nullptr;
+        }
+        if (!(found->identity == identity)) {
+            // Open handles keep the stale core alive on their own.
+            entries_.erase(found);
+            return nullptr;
+        }
+        entries_.splice(entries_.begin(), entries_, found);
+        return found->core;
+    }
+
+    void trim_locked()
+    {
+        size_t idle = 0;
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            if (it->core.use_count() == 1 && ++idle > idle_capacity_) {
+                it = entries_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    std::mutex mutex_;
+    std::list<entry> entries_;
+    size_t idle_capacity_ = 64;
+};
+
+reader_pool& shared_readers()
+{
+    // Leaked so no core is closed during static destruction.
+    static auto* pool = new reader_pool();
+    return *pool;
+}
+
+lcj_reader_options require_reader_options(const lcj_reader_options* options)
+{
+    lcj_reader_options settings{};
+    if (options == nullptr) {
+        return settings;
+    }
+
+    settings = *options;
+    if (std::any_of(
+            std::begin(settings.reserved0),
+            std::end(settings.reserved0),
+            [](uint8_t value) { return value != 0; }) ||
+        std::any_of(
+            std::begin(settings.reserved),
+            std::end(settings.reserved),
+            [](uint64_t value) { return value != 0; })) {
+        throw std::invalid_argument("reader option reserved fields must be 0");
+    }
+    if (settings.shared > 1) {
+        throw std::invalid_argument("reader option shared must be 0 or 1");
+    }
+    return settings;
+}
+
+/*
+ * The metadata segment and its parsed form are read once per reader; files
+ * carry megabytes of XML and callers typically ask for its size, then its
+ * contents, then a few parsed values.
+ */
+const std::shared_ptr<libCZI::IMetadataSegment>& metadata_segment(
+    lcj_reader* reader)
+{
+    require_reader(reader);
+    std::call_once(reader->core->metadata_once, [reader] {
+        auto segment = reader->value->ReadMetadataSegment();
+        if (!segment) {
+            throw unsupported_operation("CZI metadata segment is absent");
+        }
+        reader->core->metadata = std::move(segment);
+    });
+    return reader->core->metadata;
+}
+
+const libCZI::ICziMultiDimensionDocumentInfo& document_info(
+    lcj_reader* reader)
+{
+    const auto& segment = metadata_segment(reader);
+    std::call_once(reader->core->document_once, [reader, &segment] {
+        const auto metadata = segment->CreateMetaFromMetadataSegment();
+        if (!metadata || !metadata->IsXmlValid()) {
+            throw unsupported_operation("CZI metadata XML is not valid");
+        }
+        auto document = metadata->GetDocumentInfo();
+        if (!document) {
+            throw unsupported_operation("CZI metadata has no document info");
+        }
+        reader->core->document = std::move(document);
+    });
+    return *reader->core->document;
+}
+
+std::shared_ptr<libCZI::IDimensionChannelInfo> channel_metadata(
+    lcj_reader* reader,
+    int32_t channel)
+{
+    const auto channels = document_info(reader).GetDimensionChannelsInfo();
+    if (!channels || channel < 0 || channel >= channels->GetChannelCount()) {
+        throw std::out_of_range("channel index is out of range");
+    }
+    auto info = channels->GetChannel(channel);
+    if (!info) {
+        throw std::out_of_range("channel index is out of range");
+    }
+    return info;
+}
+
+/*
+ * Enabled channels of the document's display settings. Spline gradation
+ * curves are approximated by the linear curve between black and white.
+ */
+std::vector<lcj_channel_display> document_display_settings(
+    lcj_reader* reader)
+{
+    const auto settings = document_info(reader).GetDisplaySettings();
+    if (!settings) {
+        throw unsupported_operation("CZI metadata has no display settings");
+    }
+
+    std::vector<int> channels;
+    settings->GetChannelIndices(&channels);
+
+    std::vector<lcj_channel_display> result;
+    for (const auto channel : channels) {
+        const auto setting = settings->GetChannelDisplaySettings(channel);
+        if (!setting || !setting->GetIsEnabled()) {
+            continue;
+        }
+
+        lcj_channel_display display{};
+        display.channel = static_cast<int32_t>(channel);
+        display.weight = setting->GetWeight();
+        setting->GetBlackWhitePoint(
+            &display.black_point,
+            &display.white_point);
+
+        display.gamma = 1.0f;
+        float gamma = 1.0f;
+        if (setting->GetGradationCurveMode() ==
+                libCZI::IDisplaySettings::GradationCurveMode::Gamma &&
+            setting->TryGetGamma(&gamma) && gamma > 0.0f) {
+            display.gamma = gamma;
+        }
+
+        libCZI::Rgb8Color tint;
+        if (setting->TryGetTintingColorRgb8(&tint)) {
+            display.enable_tinting = 1;
+            display.tint_rgb[0] = tint.r;
+            display.tint_rgb[1] = tint.g;
+            display.tint_rgb[2] = tint.b;
+        }
+        result.push_back(display);
+    }
+    return result;
+}
+
+size_t lookup_table_size(libCZI::PixelType pixel_type)
+{
+    switch (pixel_type) {
+    case libCZI::PixelType::Gray8:
+    case libCZI::PixelType::Bgr24:
+        return 256;
+    case libCZI::PixelType::Gray16:
+    case libCZI::PixelType::Bgr48:
+        return 65536;
+    default:
+        throw unsupported_operation(
+            "channel pixel type cannot be composited");
+    }
+}
+
+/*
+ * One channel of a composite: its plane, the storage it is rendered into
+ * and the blending parameters libCZI's compositor reads.
+ */
+struct composite_channel {
+    plane_selection selection;
+    libCZI::PixelType pixel_type = libCZI::PixelType::Invalid;
+    std::vector<uint8_t> pixels;
+    std::unique_ptr<caller_bitmap> bitmap;
+    std::vector<uint8_t> gamma_table;
+    libCZI::Compositors::ChannelInfo info;
+};
+
+void prepare_composite_channel(
+    lcj_reader* reader,
+    const lcj_plane_coordinate& plane,
+    const lcj_channel_display& display,
+    const libCZI::IntSize& size,
+    composite_channel& channel)
+{
+    if (display.reserved[0] != 0 || display.reserved[1] != 0) {
+        throw std::invalid_argument(
+            "channel display reserved fields must be zero");
+    }
+
+    auto coordinate = plane;
+    coordinate.coordinate_mask |=
+        static_cast<uint16_t>(uint16_t{1} << LCJ_DIM_C);
+    coordinate.coordinate[LCJ_DIM_C] = display.channel;
+    channel.selection = to_plane_selection(&coordinate);
+    channel.pixel_type =
+        plane_pixel_type(reader, channel.selection, LCJ_PIXEL_INVALID);
+    const auto table_size = lookup_table_size(channel.pixel_type);
+
+    channel.info.Clear();
+    channel.info.weight = display.weight;
+    channel.info.enableTinting = display.enable_tinting != 0;
+    channel.info.tinting.r = display.tint_rgb[0];
+    channel.info.tinting.g = display.tint_rgb[1];
+    channel.info.tinting.b = display.tint_rgb[2];
+    channel.info.blackPoint = display.black_point;
+    channel.info.whitePoint = display.white_point;
+
+    if (display.lut != nullptr) {
+        if (display.lut_size != table_size) {
+            throw std::invalid_argument(
+                "channel look-up table size does not match its pixel type");
+        }
+        channel.info.lookUpTableElementCount = static_cast<int>(table_size);
+        channel.info.ptrLookUpTable = display.lut;
+    }
+    else if (display.gamma != 1.0f) {
+        if (!(display.gamma > 0.0f)) {
+            throw std::invalid_argument("channel gamma must be positive");
+        }
+        channel.gamma_table = libCZI::Utils::Create8BitLookUpTableFromGamma(
+            static_cast<int>(table_size),
+            display.black_point,
+            display.white_point,
+            display.gamma);
+        channel.info.lookUpTableElementCount =
+            static_cast<int>(channel.gamma_table.size());
+        channel.info.ptrLookUpTable = channel.gamma_table.data();
+    }
+
+    const auto row_bytes = row_bytes_of(channel.pixel_type, size.w);
+    if (size.h != 0 &&
+        row_bytes > std::numeric_limits<size_t>::max() / size.h) {
+        throw std::overflow_error("channel bitmap size overflows size_t");
+    }
+    channel.pixels.resize(std::max<size_t>(1, row_bytes * size.h));
+    channel.bitmap = std::make_unique<caller_bitmap>(
+        channel.pixel_type,
+        size.w,
+        size.h,
+        channel.pixels.data(),
+        channel.pixels.size(),
+        row_bytes);
+}
+
+uint32_t segment_size(size_t size)
+{
+    if (size > std::numeric_limits<uint32_t>::max()) {
+        throw std::out_of_range("CZI segment data exceeds 4 GiB");
+    }
+    return static_cast<uint32_t>(size);
+}
+
+/*
+ * One unit of writer output. `prepare`, when set, runs on the shared pool
+ * and typically compresses `data`; `write` runs once every earlier job has
+ * been written.
+ */
+struct writer_job {
+    std::vector<uint8_t> data;
+    std::shared_ptr<libCZI::IMemoryBlock> compressed;
+    std::function<void(writer_job&)> prepare;
+    std::function<void(libCZI::ICziWriter&, const writer_job&)> write;
+    bool ready = false;
+
+    const void* payload() const
+    {
+        return compressed ? compressed->GetPtr() : data.data();
+    }
+
+    uint32_t payload_size() const
+    {
+        return segment_size(
+            compressed ? compressed->GetSizeOfData() : data.size());
+    }
+};
+
+/*
+ * Jobs are written strictly in submission order by whichever thread finds
+ * the oldest one ready, while later ones are still prepared on the shared
+ * pool. At most `max_pending` jobs are queued. The first failure sticks:
+ * later jobs are dropped and every later call reports it.
+ */
+struct writer_state : std::enable_shared_from_this<writer_state> {
+    std::shared_ptr<libCZI::ICziWriter> value;
+    int32_t compression = LCJ_COMPRESSION_NONE;
+    libCZI::CompressParametersOnMap parameters;
+    size_t max_pending = 0;
+    bool metadata_added = false;
+    bool writing = false;
+    lcj_status error = LCJ_OK;
+    std::string message;
+    std::deque<std::shared_ptr<writer_job>> pending;
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    void require_healthy_locked() const
+    {
+        if (error != LCJ_OK) {
+            throw batch_failure(error, message);
+        }
+    }
+
+    // Must run on the thread whose `protect` produced `status`.
+    void record_locked(lcj_status status)
+    {
+        if (status != LCJ_OK && error == LCJ_OK) {
+            error = status;
+            message = last_error;
+        }
+    }
+
+    void submit(const std::shared_ptr<writer_job>& job)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] {
+            return pending.size() < max_pending || error != LCJ_OK;
+        });
+        require_healthy_locked();
+
+        pending.push_back(job);
+        if (!job->prepare) {
+            job->ready = true;
+            write_ready(lock);
+            require_healthy_locked();
+            return;
+        }
+        lock.unlock();
+
+        auto self = shared_from_this();
+        shared_pool().submit([self, job] { self->prepare(*job); });
+    }
+
+    void prepare(writer_job& job)
+    {
+        const auto status = protect([&job] { job.prepare(job); });
+
+        std::unique_lock<std::mutex> lock(mutex);
+        record_locked(status);
+        job.ready = true;
+        write_ready(lock);
+    }
+
+    void write_ready(std::unique_lock<std::mutex>& lock)
+    {
+        while (!writing && !pending.empty() && pending.front()->ready) {
+            auto job = std::move(pending.front());
+            pending.pop_front();
+            if (error == LCJ_OK) {
+                writing = true;
+                lock.unlock();
+                const auto status =
+                    protect([this, &job] { job->write(*value, *job); });
+                job.reset();
+                lock.lock();
+                writing = false;
+                record_locked(status);
+            }
+            changed.notify_all();
+        }
+    }
+
+    void wait_idle()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return pending.empty() && !writing; });
+    }
+
+    void finish()
+    {
+        wait_idle();
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            require_healthy_locked();
+        }
+
+        if (!metadata_added) {
+            const auto xml =
+                value->GetPreparedMetadata(libCZI::PrepareMetadataInfo())
+                    ->GetXml();
+            write_metadata(*value, xml.data(), xml.size());
+        }
+        value->Close();
+    }
+
+    static void write_metadata(
+        libCZI::ICziWriter& writer,
+        const char* xml,
+        size_t size)
+    {
+        libCZI::WriteMetadataInfo info;
+        info.Clear();
+        info.szMetadata = xml;
+        info.szMetadataSize = size;
+        writer.SyncWriteMetadata(info);
+    }
+};
+
+void require_writer(lcj_writer* writer)
+{
+    if (writer == nullptr || !writer->state) {
+        throw std::invalid_argument("writer must not be null");
+    }
+}
+
+lcj_writer_options require_writer_options(const lcj_writer_options* options)
+{
+    lcj_writer_options settings{};
+    if (options == nullptr) {
+        return settings;
+    }
+
+    settings = *options;
+    if (settings.reserved0[0] != 0 || settings.reserved0[1] != 0 ||
+        std::any_of(
+            std::begin(settings.reserved),
+            std::end(settings.reserved),
+            [](uint64_t value) { return value != 0; })) {
+        throw std::invalid_argument("writer option reserved fields must be 0");
+    }
+    if (settings.compression != LCJ_COMPRESSION_NONE &&
+        settings.compression != LCJ_COMPRESSION_ZSTD0 &&
+        settings.compression != LCJ_COMPRESSION_ZSTD1) {
+        throw std::invalid_argument("unknown writer compression");
+    }
+    return settings;
+}
+
+libCZI::GUID to_libczi_guid(const lcj_guid& guid)
+{
+    libCZI::GUID result{};
+    result.Data1 = guid.data1;
+    result.Data2 = guid.data2;
+    result.Data3 = guid.data3;
+    std::copy(
+        std::begin(guid.data4),
+        std::end(guid.data4),
+        std::begin(result.Data4));
+    return result;
+}
+
+std::shared_ptr<writer_state> open_writer(
+    const char* path,
+    const lcj_writer_options& settings)
+{
+    auto state = std::make_shared<writer_state>();
+    state->compression = static_cast<int32_t>(settings.compression);
+    if (settings.compression_level != 0) {
+        state->parameters.map[
+            libCZI::CompressionParameterKey::ZSTD_RAWCOMPRESSIONLEVEL] =
+            libCZI::CompressParameter(settings.compression_level);
+    }
+    if (settings.hi_lo_byte_packing != 0) {
+        state->parameters.map[
+            libCZI::CompressionParameterKey::
+                ZSTD_PREPROCESS_DOHILOBYTEPACKING] =
+            libCZI::CompressParameter(true);
+    }
+    state->max_pending = settings.max_pending != 0
+        ? settings.max_pending
+        : 2 * static_cast<size_t>(shared_pool().size());
+
+    const auto wide_path = utf8_to_wstring(path);
+    std::shared_ptr<libCZI::IOutputStream> stream;
+    try {
+        stream = libCZI::CreateOutputStreamForFile(
+            wide_path.c_str(),
+            settings.overwrite != 0);
+    }
+    catch (const std::runtime_error& error) {
+        // libCZI reports failing opens as plain runtime errors.
+        throw std::ios_base::failure(error.what());
+    }
+
+    state->value = libCZI::CreateCZIWriter();
+    state->value->Create(
+        std::move(stream),
+        std::make_shared<libCZI::CCziWriterInfo>(
+            to_libczi_guid(settings.file_guid)));
+    return state;
+}
+
+std::shared_ptr<libCZI::IMemoryBlock> compress_pixels(
+    int32_t compression,
+    const libCZI::ICompressParameters* parameters,
+    libCZI::PixelType pixel_type,
+    uint32_t width,
+    uint32_t height,
+    uint32_t stride,
+    const void* pixels)
+{
+    auto compressed = compression == LCJ_COMPRESSION_ZSTD0
+        ? libCZI::ZstdCompress::CompressZStd0Alloc(
+              width,
+              height,
+              stride,
+              pixel_type,
+              pixels,
+              parameters)
+        : libCZI::ZstdCompress::CompressZStd1Alloc(
+              width,
+              height,
+              stride,
+              pixel_type,
+              pixels,
+              parameters);
+    if (!compressed) {
+        throw std::runtime_error("libCZI returned no compressed data");
+    }
+    return compressed;
+}
+
+/*
+ * Copy the caller's rows into a job, so that the caller may reuse its
+ * buffer as soon as the subblock has been queued.
+ */
+std::shared_ptr<writer_job> subblock_job(
+    const writer_state& state,
+    const lcj_subblock_write& subblock,
+    const void* data,
+    size_t data_size,
+    size_t row_stride)
+{
+    if (subblock.reserved0 != 0 || subblock.reserved[0] != 0 ||
+        subblock.reserved[1] != 0) {
+        throw std::invalid_argument("subblock reserved fields must be zero");
+    }
+    require_plane_mask(subblock.plane);
+
+    const auto pixel_type =
+        from_lcj_pixel_type(static_cast<lcj_pixel_type>(subblock.pixel_type));
+    const auto& rect = subblock.logical_rect;
+    const auto width = subblock.physical_width;
+    const auto height = subblock.physical_height;
+    const auto int_max =
+        static_cast<uint32_t>(std::numeric_limits<int>::max());
+    if (rect.width <= 0 || rect.height <= 0 || width == 0 || height == 0 ||
+        width > int_max || height > int_max) {
+        throw std::invalid_argument("subblock sizes must be positive");
+    }
+
+    const auto row_bytes = row_bytes_of(pixel_type, width);
+    if (row_bytes > std::numeric_limits<uint32_t>::max() / height) {
+        throw std::out_of_range("CZI segment data exceeds 4 GiB");
+    }
+    if (data == nullptr) {
+        throw std::invalid_argument("subblock data must not be null");
+    }
+    if (row_stride < row_bytes) {
+        throw std::invalid_argument("subblock data row stride is too small");
+    }
+    if (height - 1 >
+            (std::numeric_limits<size_t>::max() - row_bytes) / row_stride ||
+        data_size < (height - 1) * row_stride + row_bytes) {
+        throw std::invalid_argument("subblock data is too small");
+    }
+
+    libCZI::AddSubBlockInfoMemPtr info;
+    info.Clear();
+    for (size_t i = 0; i < LCJ_DIMENSION_COUNT; ++i) {
+        if ((subblock.plane.coordinate_mask & (1u << i)) != 0) {
+            info.coordinate.Set(dimensions[i], subblock.plane.coordinate[i]);
+        }
+    }
+    info.mIndexValid = subblock.m_index_present != 0;
+    info.mIndex = subblock.m_index;
+    info.x = rect.x;
+    info.y = rect.y;
+    info.logicalWidth = rect.width;
+    info.logicalHeight = rect.height;
+    info.physicalWidth = static_cast<int>(width);
+    info.physicalHeight = static_cast<int>(height);
+    info.PixelType = pixel_type;
+    info.pyramid_type = from_lcj_pyramid_type(subblock.pyramid_type);
+    info.compressionModeRaw = state.compression;
+
+    auto job = std::make_shared<writer_job>();
+    job->data.resize(row_bytes * height);
+    copy_rows(
+        static_cast<const uint8_t*>(data),
+        row_stride,
+        job->data.data(),
+        row_bytes,
+        row_bytes,
+        height);
+
+    job->write = [info](
+                     libCZI::ICziWriter& writer,
+                     const writer_job& item) mutable {
+        info.ptrData = item.payload();
+        info.dataSize = item.payload_size();
+        writer.SyncAddSubBlock(info);
+    };
+
+    if (state.compression != LCJ_COMPRESSION_NONE) {
+        const auto compression = state.compression;
+        const auto* parameters = &state.parameters;
+        const auto stride = static_cast<uint32_t>(row_bytes);
+        job->prepare = [=](writer_job& item) {
+            item.compressed = compress_pixels(
+                compression,
+                parameters,
+                pixel_type,
+                width,
+                height,
+                stride,
+                item.data.data());
+            std::vector<uint8_t>().swap(item.data);
+        };
+    }
+    return job;
+}
+
+std::shared_ptr<writer_job> metadata_job(const char* xml, size_t size)
+{
+    auto job = std::make_shared<writer_job>();
+    job->data.assign(xml, xml + size);
+    job->write = [](libCZI::ICziWriter& writer, const writer_job& item) {
+        writer_state::write_metadata(
+            writer,
+            reinterpret_cast<const char*>(item.data.data()),
+            item.data.size());
+    };
+    return job;
+}
+
+std::shared_ptr<writer_job> attachment_job(
+    const libCZI::GUID& content_guid,
+    const char* content_file_type,
+    const char* name,
+    const void* data,
+    size_t size)
+{
+    libCZI::AddAttachmentInfo info;
+    info.Clear();
+    info.contentGuid = content_guid;
+    if (!info.SetContentFileType(content_file_type)) {
+        throw std::invalid_argument(
+            "attachment file type is longer than 8 characters");
+    }
+    if (!info.SetName(name)) {
+        throw std::invalid_argument(
+            "attachment name is longer than 80 characters");
+    }
+    segment_size(size);
+
+    auto job = std::make_shared<writer_job>();
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    job->data.assign(bytes, bytes + size);
+    job->write = [info](
+                     libCZI::ICziWriter& writer,
+                     const writer_job& item) mutable {
+        info.ptrData = item.payload();
+        info.dataSize = item.payload_size();
+        writer.SyncAddAttachment(info);
+    };
+    return job;
+}
+
+/*
+ * Read one subblock on the pool and either keep its stored data, when it
+ * already has the target compression, or decode and re-encode it. The
+ * write keeps the source subblock alive for its data, metadata and
+ * attachment parts.
+ */
+std::shared_ptr<writer_job> transcode_job(
+    const writer_state& state,
+    lcj_reader* reader,
+    int32_t native_index)
+{
+    const auto compression = state.compression;
+    const auto* parameters = &state.parameters;
+
+    auto job = std::make_shared<writer_job>();
+    job->prepare = [=](writer_job& item) {
+        auto subblock = read_subblock(reader, native_index);
+        const auto& source = subblock->GetSubBlockInfo();
+
+        libCZI::AddSubBlockInfoMemPtr info;
+        info.Clear();
+        info.coordinate = source.coordinate;
+        info.mIndexValid = source.IsMindexValid();
+        info.mIndex = source.mIndex;
+        info.x = source.logicalRect.x;
+        info.y = source.logicalRect.y;
+        info.logicalWidth = source.logicalRect.w;
+        info.logicalHeight = source.logicalRect.h;
+        info.physicalWidth = static_cast<int>(source.physicalSize.w);
+        info.physicalHeight = static_cast<int>(source.physicalSize.h);
+        info.PixelType = source.pixelType;
+        info.pyramid_type = source.pyramidType;
+        info.compressionModeRaw = compression;
+
+        const void* data = nullptr;
+        size_t size = 0;
+        if (source.compressionModeRaw == compression) {
+            subblock->DangerousGetRawData(
+                libCZI::ISubBlock::MemBlkType::Data,
+                data,
+                size);
+        }
+        else {
+            auto bitmap = subblock->CreateBitmap();
+            if (!bitmap) {
+                throw std::runtime_error("libCZI returned a null bitmap");
+            }
+
+            const auto bitmap_size = bitmap->GetSize();
+            const auto row_bytes =
+                row_bytes_of(bitmap->GetPixelType(), bitmap_size.w);
+            libCZI::ScopedBitmapLockerSP lock(bitmap);
+            const auto* pixels = static_cast<const uint8_t*>(lock.ptrDataRoi);
+            if (compression == LCJ_COMPRESSION_NONE) {
+                if (bitmap_size.h != 0 &&
+                    row_bytes >
+                        std::numeric_limits<uint32_t>::max() / bitmap_size.h) {
+                    throw std::out_of_range("CZI segment data exceeds 4 GiB");
+                }
+                item.data.resize(row_bytes * bitmap_size.h);
+                copy_rows(
+                    pixels,
+                    lock.stride,
+                    item.data.data(),
+                    row_bytes,
+                    row_bytes,
+                    bitmap_size.h);
+            }
+            else {
+                item.compressed = compress_pixels(
+                    compression,
+                    parameters,
+                    bitmap->GetPixelType(),
+                    bitmap_size.w,
+                    bitmap_size.h,
+                    lock.stride,
+                    pixels);
+            }
+            data = item.payload();
+            size = item.payload_size();
+        }
+
+        item.write = [info, subblock, data, size](
+                         libCZI::ICziWriter& writer,
+                         const writer_job&) mutable {
+            info.ptrData = data;
+            info.dataSize = segment_size(size);
+
+            size_t part_size = 0;
+            subblock->DangerousGetRawData(
+                libCZI::ISubBlock::MemBlkType::Metadata,
+                info.ptrSbBlkMetadata,
+                part_size);
+            info.sbBlkMetadataSize = segment_size(part_size);
+            subblock->DangerousGetRawData(
+                libCZI::ISubBlock::MemBlkType::Attachment,
+                info.ptrSbBlkAttachment,
+                part_size);
+            info.sbBlkAttachmentSize = segment_size(part_size);
+            writer.SyncAddSubBlock(info);
+        };
+    };
+    return job;
+}
+
+void copy_document_parts(writer_state& state, lcj_reader* reader)
+{
+    std::vector<int> attachments;
+    reader->value->EnumerateAttachments(
+        [&attachments](int index, const libCZI::AttachmentInfo&) {
+            attachments.push_back(index);
+            return true;
+        });
+
+    for (const auto index : attachments) {
+        const auto attachment = reader->value->ReadAttachment(index);
+        if (!attachment) {
+            throw std::out_of_range("attachment index is out of range");
+        }
+
+        const auto& info = attachment->GetAttachmentInfo();
+        const void* data = nullptr;
+        size_t size = 0;
+        attachment->DangerousGetRawData(data, size);
+        state.submit(attachment_job(
+            info.contentGuid,
+            info.contentFileType,
+            info.name.c_str(),
+            data,
+            size));
+    }
+
+    std::shared_ptr<libCZI::IMetadataSegment> segment;
+    try {
+        segment = reader->value->ReadMetadataSegment();
+    }
+    catch (const libCZI::LibCZISegmentNotPresent&) {
+    }
+    if (segment) {
+        const void* xml = nullptr;
+        size_t size = 0;
+        segment->DangerousGetRawData(
+            libCZI::IMetadataSegment::MemBlkType::XmlMetadata,
+            xml,
+            size);
+        state.submit(metadata_job(static_cast<const char*>(xml), size));
+        state.metadata_added = true;
+    }
+}
+
+void transcode_file(
+    const char* source,
+    const char* destination,
+    const lcj_writer_options& settings)
+{
+    const auto reader =
+        open_reader(open_stream(source, LCJ_STREAM_PREAD), {});
+    auto state = open_writer(destination, settings);
+
+    std::vector<int32_t> order;
+    reader->value->EnumerateSubBlocks(
+        [&order](int index, const libCZI::SubBlockInfo&) {
+            order.push_back(index);
+            return true;
+        });
+    sort_by_file_position(reader.get(), order.data(), order.size());
+
+    try {
+        for (const auto index : order) {
+            state->submit(transcode_job(*state, reader.get(), index));
+        }
+        copy_document_parts(*state, reader.get());
+        state->finish();
+    }
+    catch (...) {
+        // Queued jobs still read through the reader.
+        state->wait_idle();
+        throw;
+    }
+}
+
+} // namespace
+
+extern "C" {
+
+const char* lcj_last_error_message(void)
+{
+    return last_error.c_str();
+}
+
+lcj_status lcj_abi_version(lcj_version* version)
+{
+    if (version == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "version must not be null");
+    }
+
+    clear_error();
+    *version = {
+        LCJ_ABI_VERSION_MAJOR,
+        LCJ_ABI_VERSION_MINOR,
+        0u,
+        0u,
+    };
+    return LCJ_OK;
+}
+
+lcj_status lcj_libczi_version(lcj_version* version)
+{
+    if (version == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "version must not be null");
+    }
+
+    return protect([&] {
+        int major = 0;
+        int minor = 0;
+        int patch = 0;
+        int tweak = 0;
+        libCZI::GetLibCZIVersion(&major, &minor, &patch, &tweak);
+        *version = {
+            static_cast<uint32_t>(major),
+            static_cast<uint32_t>(minor),
+            static_cast<uint32_t>(patch),
+            static_cast<uint32_t>(tweak),
+        };
+    });
+}
+
+lcj_status lcj_reader_open_utf8(
+    const char* path,
+    lcj_reader** reader)
+{
+    return lcj_reader_open_utf8_ex(path, nullptr, reader);
+}
+
+lcj_status lcj_reader_open_utf8_ex(
+    const char* path,
+    const lcj_reader_options* options,
+    lcj_reader** reader)
+{
+    if (path == nullptr || reader == nullptr) {
+        return fail(
+            LCJ_INVALID_ARGUMENT,
+            "path and reader output must not be null");
+    }
+
+    *reader = nullptr;
+
+    return protect([&] {
+        const lcj_reader_options settings = require_reader_options(options);
+
+        auto result = settings.shared
+            ? reader_handle(shared_readers().open(path, settings))
+            : open_reader(open_stream(path, settings.stream), settings);
+        *reader = result.release();
+    });
+}
+
+lcj_status lcj_reader_open_memory(
+    const void* data,
+    size_t size,
+    lcj_reader** reader)
+{
+    if ((data == nullptr && size != 0) || reader == nullptr) {
+        return fail(
+            LCJ_INVALID_ARGUMENT,
+            "data and reader output must not be null");
+    }
+
+    *reader = nullptr;
+
+    return protect([&] {
+        auto result = open_reader(
+            std::make_shared<memory_stream>(data, size),
+            lcj_reader_options{});
+        *reader = result.release();
+    });
+}
+
+lcj_status lcj_reader_close(lcj_reader* reader)
+{
+    if (reader == nullptr) {
+        clear_error();
+        return LCJ_OK;
+    }
+
+    std::unique_ptr<lcj_reader> owned(reader);
+    return protect([&] {
+        auto core = std::move(owned->core);
+        const bool pooled = core->pooled;
+        owned.reset();
+        if (!pooled) {
+            core->value->Close();
+        }
+        core.reset();
+        if (pooled) {
+            shared_readers().trim();
+        }
+    });
+}
+
+lcj_status lcj_reader_pool_set_idle_capacity(size_t capacity)
+{
+    return protect([&] { shared_readers().set_idle_capacity(capacity); });
+}
+
+lcj_status lcj_reader_cache_statistics(
+    lcj_reader* reader,
+    lcj_cache_statistics* statistics)
+{
+    if (statistics == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "statistics must not be null");
+    }
+
+    return protect([&] {
+        require_reader(reader);
+        *statistics = reader->cache
+            ? reader->cache->statistics()
+            : lcj_cache_statistics{};
+    });
+}
+
+lcj_status lcj_reader_cache_clear(lcj_reader* reader)
+{
+    return protect([&] {
+        require_reader(reader);
+        if (reader->cache) {
+            reader->cache->clear();
+        }
+    });
+}
+
+lcj_status lcj_reader_get_metrics(
+    lcj_reader* reader,
+    lcj_reader_metrics* metrics)
+{
+    if (metrics == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "metrics must not be null");
+    }
+
+    *metrics = {};
+
+    return protect([&] {
+        require_reader(reader);
+        const auto& source = *reader->metrics;
+        const auto load = [](const std::atomic<uint64_t>& counter) {
+            return counter.load(std::memory_order_relaxed);
+        };
+
+        metrics->stream_reads = load(source.stream_reads);
+        metrics->stream_bytes = load(source.stream_bytes);
+        metrics->stream_nanoseconds = load(source.stream_nanoseconds);
+        for (size_t i = 0; i < LCJ_COMPRESSION_SLOTS; ++i) {
+            metrics->decoded_subblocks[i] = load(source.decoded_subblocks[i]);
+        }
+        metrics->decode_nanoseconds = load(source.decode_nanoseconds);
+        metrics->copy_nanoseconds = load(source.copy_nanoseconds);
+        metrics->live_bitmap_bytes = load(source.live_bitmap_bytes);
+        metrics->peak_bitmap_bytes = load(source.peak_bitmap_bytes);
+    });
+}
+
+lcj_status lcj_reader_reset_metrics(lcj_reader* reader)
+{
+    return protect([&] {
+        require_reader(reader);
+        auto& metrics = *reader->metrics;
+        const auto reset = [](std::atomic<uint64_t>& counter) {
+            counter.store(0, std::memory_order_relaxed);
+        };
+
+        reset(metrics.stream_reads);
+        reset(metrics.stream_bytes);
+        reset(metrics.stream_nanoseconds);
+        for (auto& counter : metrics.decoded_subblocks) {
+            reset(counter);
+        }
+        reset(metrics.decode_nanoseconds);
+        reset(metrics.copy_nanoseconds);
+        metrics.peak_bitmap_bytes.store(
+            metrics.live_bitmap_bytes.load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+    });
+}
+
+lcj_status lcj_reader_statistics(
+    lcj_reader* reader,
+    lcj_statistics* statistics)
+{
+    if (statistics == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "statistics must not be null");
+    }
+
+    return protect([&] {
+        require_reader(reader);
+        const auto value = reader->value->GetStatistics();
+
+        statistics->subblock_count =
+            static_cast<int32_t>(value.subBlockCount);
         statistics->min_m_index =
             static_cast<int32_t>(value.minMindex);
         statistics->max_m_index =
@@ -334,178 +4240,1305 @@ lcj_status lcj_reader_statistics(
     });
 }
 
-lcj_status lcj_reader_dimension_bounds(
+lcj_status lcj_reader_dimension_bounds(
+    lcj_reader* reader,
+    lcj_dimension dimension,
+    lcj_dim_bounds* bounds)
+{
+    if (bounds == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "bounds must not be null");
+    }
+
+    return protect([&] {
+        require_reader(reader);
+        const auto statistics = reader->value->GetStatistics();
+
+        int start = 0;
+        int size = 0;
+        const bool present = statistics.dimBounds.TryGetInterval(
+            to_libczi_dimension(dimension),
+            &start,
+            &size);
+
+        bounds->present = present ? uint8_t{1} : uint8_t{0};
+        std::fill(
+            std::begin(bounds->reserved),
+            std::end(bounds->reserved),
+            uint8_t{0});
+        bounds->start = present ? static_cast<int32_t>(start) : 0;
+        bounds->size = present ? static_cast<int32_t>(size) : 0;
+    });
+}
+
+lcj_status lcj_reader_metadata_size(
+    lcj_reader* reader,
+    size_t* size)
+{
+    if (size == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "size must not be null");
+    }
+
+    return protect([&] {
+        const auto& segment = metadata_segment(reader);
+        const void* data = nullptr;
+        size_t bytes = 0;
+        segment->DangerousGetRawData(
+            libCZI::IMetadataSegment::MemBlkType::XmlMetadata,
+            data,
+            bytes);
+        *size = bytes;
+    });
+}
+
+lcj_status lcj_reader_metadata_copy(
+    lcj_reader* reader,
+    void* destination,
+    size_t destination_size)
+{
+    return protect([&] {
+        const auto& segment = metadata_segment(reader);
+        const void* data = nullptr;
+        size_t bytes = 0;
+        segment->DangerousGetRawData(
+            libCZI::IMetadataSegment::MemBlkType::XmlMetadata,
+            data,
+            bytes);
+
+        if (bytes > destination_size) {
+            throw buffer_too_small("metadata destination is too small");
+        }
+        if (bytes != 0 && destination == nullptr) {
+            throw std::invalid_argument(
+                "metadata destination must not be null");
+        }
+
+        if (bytes != 0 && data == nullptr) {
+            throw std::runtime_error(
+                "libCZI returned null metadata storage");
+        }
+        if (bytes != 0) {
+            std::memcpy(destination, data, bytes);
+        }
+    });
+}
+
+lcj_status lcj_reader_scaling(lcj_reader* reader, lcj_scaling* scaling)
+{
+    if (scaling == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "scaling must not be null");
+    }
+
+    *scaling = lcj_scaling{};
+
+    return protect([&] {
+        const auto value = document_info(reader).GetScalingInfo();
+        if (value.IsScaleXValid()) {
+            scaling->x = value.scaleX;
+            scaling->x_valid = 1;
+        }
+        if (value.IsScaleYValid()) {
+            scaling->y = value.scaleY;
+            scaling->y_valid = 1;
+        }
+        if (value.IsScaleZValid()) {
+            scaling->z = value.scaleZ;
+            scaling->z_valid = 1;
+        }
+    });
+}
+
+lcj_status lcj_reader_channel_count(lcj_reader* reader, int32_t* count)
+{
+    if (count == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "count must not be null");
+    }
+
+    *count = 0;
+
+    return protect([&] {
+        const auto channels =
+            document_info(reader).GetDimensionChannelsInfo();
+        *count = channels ? static_cast<int32_t>(channels->GetChannelCount())
+                          : 0;
+    });
+}
+
+lcj_status lcj_reader_channel_info(
+    lcj_reader* reader,
+    int32_t channel,
+    lcj_channel_info* info)
+{
+    if (info == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "info must not be null");
+    }
+
+    *info = lcj_channel_info{};
+
+    return protect([&] {
+        const auto native_info = channel_metadata(reader, channel);
+        info->channel = channel;
+
+        libCZI::Rgb8Color color;
+        if (native_info->TryGetColor(&color)) {
+            info->color_valid = 1;
+            info->color_rgb[0] = color.r;
+            info->color_rgb[1] = color.g;
+            info->color_rgb[2] = color.b;
+        }
+
+        std::wstring name;
+        if (native_info->TryGetAttributeName(&name)) {
+            info->name_length =
+                static_cast<uint64_t>(wstring_to_utf8(name).size());
+        }
+    });
+}
+
+lcj_status lcj_reader_channel_name(
+    lcj_reader* reader,
+    int32_t channel,
+    char* name,
+    size_t capacity,
+    size_t* length)
+{
+    if (length == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "length must not be null");
+    }
+
+    *length = 0;
+
+    return protect([&] {
+        std::wstring native_name;
+        channel_metadata(reader, channel)->TryGetAttributeName(&native_name);
+        const auto text = wstring_to_utf8(native_name);
+
+        *length = text.size();
+        if (text.size() >= capacity) {
+            throw buffer_too_small("channel name destination is too small");
+        }
+        if (name == nullptr) {
+            throw std::invalid_argument(
+                "channel name destination must not be null");
+        }
+        std::memcpy(name, text.c_str(), text.size() + 1);
+    });
+}
+
+lcj_status lcj_reader_scenes(
+    lcj_reader* reader,
+    lcj_scene_info* scenes,
+    size_t capacity,
+    size_t* count)
+{
+    if (count == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "count must not be null");
+    }
+
+    *count = 0;
+
+    return protect([&] {
+        require_reader(reader);
+        if (capacity != 0 && scenes == nullptr) {
+            throw std::invalid_argument("scene entries must not be null");
+        }
+
+        const auto statistics = reader->value->GetStatistics();
+        *count = statistics.sceneBoundingBoxes.size();
+        if (statistics.sceneBoundingBoxes.size() > capacity) {
+            throw buffer_too_small("scene destination is too small");
+        }
+
+        size_t slot = 0;
+        for (const auto& scene : statistics.sceneBoundingBoxes) {
+            auto& entry = scenes[slot++];
+            entry = lcj_scene_info{};
+            entry.scene = static_cast<int32_t>(scene.first);
+            entry.bounding_box = convert_rect(scene.second.boundingBox);
+            entry.bounding_box_layer0 =
+                convert_rect(scene.second.boundingBoxLayer0);
+        }
+    });
+}
+
+lcj_status lcj_reader_attachment_directory(
+    lcj_reader* reader,
+    lcj_attachment_info* entries,
+    size_t capacity,
+    size_t* count)
+{
+    if (count == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "count must not be null");
+    }
+
+    *count = 0;
+
+    return protect([&] {
+        require_reader(reader);
+        if (capacity != 0 && entries == nullptr) {
+            throw std::invalid_argument(
+                "attachment entries must not be null");
+        }
+
+        const auto& records = attachment_records(reader);
+        *count = records.size();
+        if (records.size() > capacity) {
+            throw buffer_too_small("attachment destination is too small");
+        }
+
+        reader->value->EnumerateAttachments(
+            [&](int index, const libCZI::AttachmentInfo& native_info) {
+                const auto slot = static_cast<size_t>(index);
+                if (index < 0 || slot >= records.size()) {
+                    throw std::runtime_error(
+                        "attachment index disagrees with the directory");
+                }
+                auto& entry = entries[slot];
+                entry = lcj_attachment_info{};
+                entry.index = static_cast<int32_t>(index);
+                entry.content_guid.data1 = native_info.contentGuid.Data1;
+                entry.content_guid.data2 = native_info.contentGuid.Data2;
+                entry.content_guid.data3 = native_info.contentGuid.Data3;
+                std::copy(
+                    std::begin(native_info.contentGuid.Data4),
+                    std::end(native_info.contentGuid.Data4),
+                    entry.content_guid.data4);
+                entry.file_position = records[slot].file_position;
+                entry.data_size = records[slot].data_size;
+                std::strncpy(
+                    entry.content_file_type,
+                    native_info.contentFileType,
+                    sizeof(entry.content_file_type) - 1);
+                native_info.name.copy(
+                    entry.name,
+                    sizeof(entry.name) - 1);
+                return true;
+            });
+    });
+}
+
+lcj_status lcj_reader_find_attachment(
+    lcj_reader* reader,
+    const char* content_file_type,
+    const char* name,
+    int32_t* index)
+{
+    if (index == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "index must not be null");
+    }
+
+    *index = -1;
+
+    return protect([&] {
+        require_reader(reader);
+        reader->value->EnumerateSubset(
+            content_file_type,
+            name,
+            [&](int found, const libCZI::AttachmentInfo&) {
+                *index = static_cast<int32_t>(found);
+                return false;
+            });
+    });
+}
+
+lcj_status lcj_reader_attachment_copy(
+    lcj_reader* reader,
+    int32_t index,
+    void* destination,
+    size_t destination_size)
+{
+    return protect([&] {
+        require_reader(reader);
+        const auto& record = require_attachment(reader, index);
+        if (record.data_size > destination_size) {
+            throw buffer_too_small("attachment destination is too small");
+        }
+        if (record.data_size != 0 && destination == nullptr) {
+            throw std::invalid_argument(
+                "attachment destination must not be null");
+        }
+
+        read_exact(
+            *reader->stream,
+            record.file_position + attachment_header_size,
+            destination,
+            record.data_size,
+            "attachment payload is truncated");
+    });
+}
+
+lcj_status lcj_reader_subblock_info(
+    lcj_reader* reader,
+    int32_t native_index,
+    lcj_subblock_info* info)
+{
+    if (info == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "subblock info must not be null");
+    }
+
+    return protect([&] {
+        require_reader(reader);
+
+        libCZI::SubBlockInfo native_info;
+        if (!reader->value->TryGetSubBlockInfo(native_index, &native_info)) {
+            throw std::out_of_range("subblock index is out of range");
+        }
+
+        fill_subblock_info(native_index, native_info, info);
+    });
+}
+
+lcj_status lcj_reader_subblock_directory(
+    lcj_reader* reader,
+    int32_t first_index,
+    uint32_t flags,
+    lcj_subblock_directory_entry* entries,
+    size_t entry_capacity,
+    size_t* entry_count)
+{
+    if (entry_count == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "entry count must not be null");
+    }
+
+    *entry_count = 0;
+
+    return protect([&] {
+        require_reader(reader);
+        if ((flags & ~static_cast<uint32_t>(LCJ_DIRECTORY_STORED_SIZE)) != 0) {
+            throw std::invalid_argument("unknown subblock directory flags");
+        }
+        if (entry_capacity != 0 && entries == nullptr) {
+            throw std::invalid_argument(
+                "subblock directory entries must not be null");
+        }
+
+        const auto subblock_count =
+            reader->value->GetStatistics().subBlockCount;
+        if (first_index < 0 || first_index > subblock_count) {
+            throw std::out_of_range("subblock index is out of range");
+        }
+
+        const auto available =
+            static_cast<size_t>(subblock_count - first_index);
+        const auto wanted = std::min(entry_capacity, available);
+        if (wanted == 0) {
+            return;
+        }
+
+        // Pages are served from the cached positions and libCZI's indexed
+        // lookup, so later pages cost no rescan of the directory.
+        const auto& positions = subblock_positions(reader);
+        size_t written = 0;
+        for (; written < wanted; ++written) {
+            const auto index = first_index + static_cast<int32_t>(written);
+            libCZI::SubBlockInfo native_info;
+            if (static_cast<size_t>(index) >= positions.size() ||
+                !reader->value->TryGetSubBlockInfo(index, &native_info)) {
+                throw std::out_of_range("subblock index is out of range");
+            }
+
+            auto& entry = entries[written];
+            fill_subblock_info(index, native_info, &entry.info);
+            entry.file_position = positions[static_cast<size_t>(index)];
+            entry.stored_size = 0;
+        }
+
+        if ((flags & LCJ_DIRECTORY_STORED_SIZE) != 0) {
+            if (!reader->stream) {
+                throw unsupported_operation(
+                    "reader has no stream for segment size reads");
+            }
+            parallel_for_checked(written, 0, [&](size_t i) {
+                entries[i].stored_size = read_subblock_segment(
+                    *reader->stream,
+                    entries[i].file_position).stored_size;
+            });
+        }
+
+        *entry_count = written;
+    });
+}
+
+lcj_status lcj_reader_read_plane_roi(
+    lcj_reader* reader,
+    const lcj_plane_coordinate* plane,
+    const lcj_rect_i32* roi,
+    lcj_pixel_type pixel_type,
+    const lcj_compose_options* options,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride)
+{
+    return protect([&] {
+        require_reader(reader);
+        const auto rectangle = require_roi(roi);
+        const auto selection = to_plane_selection(plane);
+
+        caller_bitmap target(
+            plane_pixel_type(reader, selection, pixel_type),
+            static_cast<uint32_t>(rectangle.w),
+            static_cast<uint32_t>(rectangle.h),
+            destination,
+            destination_size,
+            destination_row_stride);
+
+        libCZI::ISingleChannelTileAccessor::Options native_options;
+        apply_compose_options(reader, options, selection, native_options);
+
+        auto accessor = reader->value->CreateSingleChannelTileAccessor();
+        accessor->Get(
+            &target,
+            rectangle.x,
+            rectangle.y,
+            &selection.coordinate,
+            &native_options);
+    });
+}
+
+lcj_status lcj_reader_scaled_size(
+    lcj_reader* reader,
+    const lcj_rect_i32* roi,
+    float zoom,
+    uint32_t* width,
+    uint32_t* height)
+{
+    if (width == nullptr || height == nullptr) {
+        return fail(
+            LCJ_INVALID_ARGUMENT,
+            "width and height outputs must not be null");
+    }
+
+    return protect([&] {
+        require_reader(reader);
+        const auto rectangle = require_roi(roi);
+
+        auto accessor =
+            reader->value->CreateSingleChannelScalingTileAccessor();
+        const auto size = accessor->CalcSize(rectangle, require_zoom(zoom));
+        *width = size.w;
+        *height = size.h;
+    });
+}
+
+lcj_status lcj_reader_read_plane_scaled(
+    lcj_reader* reader,
+    const lcj_plane_coordinate* plane,
+    const lcj_rect_i32* roi,
+    float zoom,
+    lcj_pixel_type pixel_type,
+    const lcj_compose_options* options,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride)
+{
+    return protect([&] {
+        require_reader(reader);
+        const auto rectangle = require_roi(roi);
+        const auto selection = to_plane_selection(plane);
+        require_zoom(zoom);
+
+        auto accessor =
+            reader->value->CreateSingleChannelScalingTileAccessor();
+        const auto size = accessor->CalcSize(rectangle, zoom);
+        caller_bitmap target(
+            plane_pixel_type(reader, selection, pixel_type),
+            size.w,
+            size.h,
+            destination,
+            destination_size,
+            destination_row_stride);
+
+        libCZI::ISingleChannelScalingTileAccessor::Options native_options;
+        apply_compose_options(reader, options, selection, native_options);
+
+        accessor->Get(
+            &target,
+            rectangle,
+            &selection.coordinate,
+            zoom,
+            &native_options);
+    });
+}
+
+lcj_status lcj_reader_read_hyperslab(
+    lcj_reader* reader,
+    const lcj_plane_coordinate* base,
+    const lcj_hyperslab_range* ranges,
+    size_t range_count,
+    const lcj_rect_i32* roi,
+    lcj_pixel_type pixel_type,
+    const lcj_compose_options* options,
+    uint32_t thread_count,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride)
+{
+    return protect([&] {
+        require_reader(reader);
+        const auto rectangle = require_roi(roi);
+
+        const auto planes = hyperslab_planes(base, ranges, range_count);
+
+        // Every plane shares one layout, so the pixel type has to be known
+        // before the first plane is composed.
+        std::vector<plane_selection> selections;
+        selections.reserve(planes.size());
+        auto resolved = libCZI::PixelType::Invalid;
+        for (const auto& plane : planes) {
+            selections.push_back(to_plane_selection(&plane.coordinate));
+            const auto type =
+                plane_pixel_type(reader, selections.back(), pixel_type);
+            if (resolved == libCZI::PixelType::Invalid) {
+                resolved = type;
+            }
+            else if (type != resolved) {
+                throw std::invalid_argument(
+                    "hyperslab channels have different pixel types");
+            }
+        }
+
+        const auto row_bytes =
+            row_bytes_of(resolved, static_cast<uint32_t>(rectangle.w));
+        require_destination(
+            destination,
+            destination_size,
+            destination_row_stride,
+            row_bytes,
+            static_cast<uint32_t>(rectangle.h));
+        require_hyperslab_layout(
+            ranges,
+            range_count,
+            (static_cast<size_t>(rectangle.h) - 1) * destination_row_stride +
+                row_bytes,
+            destination_size);
+
+        auto* bytes = static_cast<uint8_t*>(destination);
+        parallel_for_checked(planes.size(), thread_count, [&](size_t i) {
+            caller_bitmap target(
+                resolved,
+                static_cast<uint32_t>(rectangle.w),
+                static_cast<uint32_t>(rectangle.h),
+                bytes + planes[i].offset,
+                destination_size - planes[i].offset,
+                destination_row_stride);
+
+            libCZI::ISingleChannelTileAccessor::Options native_options;
+            apply_compose_options(
+                reader,
+                options,
+                selections[i],
+                native_options);
+
+            reader->value->CreateSingleChannelTileAccessor()->Get(
+                &target,
+                rectangle.x,
+                rectangle.y,
+                &selections[i].coordinate,
+                &native_options);
+        });
+    });
+}
+
+lcj_status lcj_reader_read_composite(
+    lcj_reader* reader,
+    const lcj_plane_coordinate* plane,
+    const lcj_rect_i32* roi,
+    float zoom,
+    const lcj_channel_display* channels,
+    size_t channel_count,
+    lcj_pixel_type pixel_type,
+    const lcj_compose_options* options,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride)
+{
+    return protect([&] {
+        require_reader(reader);
+        const auto rectangle = require_roi(roi);
+        require_zoom(zoom);
+        if (plane == nullptr) {
+            throw std::invalid_argument("plane coordinate must not be null");
+        }
+        require_plane_mask(*plane);
+        if (pixel_type != LCJ_PIXEL_BGR24 && pixel_type != LCJ_PIXEL_BGRA32) {
+            throw std::invalid_argument(
+                "composite pixel type must be BGR24 or BGRA32");
+        }
+        if (channels == nullptr && channel_count != 0) {
+            throw std::invalid_argument("channel displays must not be null");
+        }
+
+        const auto displays = channels != nullptr
+            ? std::vector<lcj_channel_display>(
+                  channels,
+                  channels + channel_count)
+            : document_display_settings(reader);
+        if (displays.empty() ||
+            displays.size() >
+                static_cast<size_t>(std::numeric_limits<int>::max())) {
+            throw std::invalid_argument(
+                "composite needs at least one channel");
+        }
+
+        const bool scaled = zoom < 1.0f;
+        const auto size = scaled
+            ? reader->value->CreateSingleChannelScalingTileAccessor()
+                  ->CalcSize(rectangle, zoom)
+            : libCZI::IntSize{
+                  static_cast<uint32_t>(rectangle.w),
+                  static_cast<uint32_t>(rectangle.h),
+              };
+        caller_bitmap target(
+            from_lcj_pixel_type(pixel_type),
+            size.w,
+            size.h,
+            destination,
+            destination_size,
+            destination_row_stride);
+
+        std::vector<composite_channel> rendered(displays.size());
+        for (size_t i = 0; i < displays.size(); ++i) {
+            prepare_composite_channel(
+                reader,
+                *plane,
+                displays[i],
+                size,
+                rendered[i]);
+        }
+
+        parallel_for_checked(rendered.size(), 0, [&](size_t i) {
+            auto& channel = rendered[i];
+            if (scaled) {
+                libCZI::ISingleChannelScalingTileAccessor::Options native;
+                apply_compose_options(
+                    reader,
+                    options,
+                    channel.selection,
+                    native);
+                reader->value->CreateSingleChannelScalingTileAccessor()->Get(
+                    channel.bitmap.get(),
+                    rectangle,
+                    &channel.selection.coordinate,
+                    zoom,
+                    &native);
+            }
+            else {
+                libCZI::ISingleChannelTileAccessor::Options native;
+                apply_compose_options(
+                    reader,
+                    options,
+                    channel.selection,
+                    native);
+                reader->value->CreateSingleChannelTileAccessor()->Get(
+                    channel.bitmap.get(),
+                    rectangle.x,
+                    rectangle.y,
+                    &channel.selection.coordinate,
+                    &native);
+            }
+        });
+
+        std::vector<libCZI::IBitmapData*> sources;
+        std::vector<libCZI::Compositors::ChannelInfo> infos;
+        for (auto& channel : rendered) {
+            sources.push_back(channel.bitmap.get());
+            infos.push_back(channel.info);
+        }
+
+        const auto count = static_cast<int>(rendered.size());
+        if (pixel_type == LCJ_PIXEL_BGR24) {
+            libCZI::Compositors::ComposeMultiChannel_Bgr24(
+                &target,
+                count,
+                sources.data(),
+                infos.data());
+        }
+        else {
+            libCZI::Compositors::ComposeMultiChannel_Bgra32(
+                uint8_t{0xff},
+                &target,
+                count,
+                sources.data(),
+                infos.data());
+        }
+    });
+}
+
+lcj_status lcj_reader_display_settings(
+    lcj_reader* reader,
+    lcj_channel_display* channels,
+    size_t capacity,
+    size_t* count)
+{
+    if (count == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "count must not be null");
+    }
+
+    *count = 0;
+
+    return protect([&] {
+        require_reader(reader);
+        if (capacity != 0 && channels == nullptr) {
+            throw std::invalid_argument("channel displays must not be null");
+        }
+
+        const auto displays = document_display_settings(reader);
+        *count = displays.size();
+        if (displays.size() > capacity) {
+            throw buffer_too_small("channel display destination is too small");
+        }
+        std::copy(displays.begin(), displays.end(), channels);
+    });
+}
+
+lcj_status lcj_reader_read_subblock_bitmap(
+    lcj_reader* reader,
+    int32_t native_index,
+    lcj_bitmap** bitmap)
+{
+    if (bitmap == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "bitmap output must not be null");
+    }
+
+    *bitmap = nullptr;
+
+    return protect([&] {
+        require_reader(reader);
+
+        *bitmap = bitmap_handle(
+            reader,
+            decode_subblock(reader, native_index)).release();
+    });
+}
+
+lcj_status lcj_reader_read_subblock_into(
+    lcj_reader* reader,
+    int32_t native_index,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride)
+{
+    return protect([&] {
+        require_reader(reader);
+        read_subblock_into(
+            reader,
+            native_index,
+            destination,
+            destination_size,
+            destination_row_stride);
+    });
+}
+
+lcj_status lcj_reader_read_subblocks_into(
+    lcj_reader* reader,
+    size_t count,
+    const int32_t* native_indices,
+    void* const* destinations,
+    const size_t* destination_sizes,
+    const size_t* destination_row_strides,
+    uint32_t thread_count,
+    lcj_status* results)
+{
+    return protect([&] {
+        require_reader(reader);
+        if (count != 0 &&
+            (native_indices == nullptr || destinations == nullptr ||
+                destination_sizes == nullptr ||
+                destination_row_strides == nullptr)) {
+            throw std::invalid_argument(
+                "subblock batch arrays must not be null");
+        }
+
+        parallel_for_checked(
+            count,
+            thread_count,
+            [&](size_t i) {
+                read_subblock_into(
+                    reader,
+                    native_indices[i],
+                    destinations[i],
+                    destination_sizes[i],
+                    destination_row_strides[i]);
+            },
+            results);
+    });
+}
+
+lcj_status lcj_reader_subblock_raw_size(
+    lcj_reader* reader,
+    int32_t native_index,
+    size_t* size,
+    int32_t* compression_raw)
+{
+    if (size == nullptr || compression_raw == nullptr) {
+        return fail(
+            LCJ_INVALID_ARGUMENT,
+            "size and compression outputs must not be null");
+    }
+
+    return protect([&] {
+        require_reader(reader);
+
+        libCZI::SubBlockInfo native_info;
+        if (!reader->value->TryGetSubBlockInfo(native_index, &native_info)) {
+            throw std::out_of_range("subblock index is out of range");
+        }
+        if (!reader->stream) {
+            throw unsupported_operation(
+                "reader has no stream for segment header reads");
+        }
+
+        const auto segment = read_subblock_segment(
+            *reader->stream,
+            subblock_position(reader, native_index));
+        if (segment.data_size > std::numeric_limits<size_t>::max()) {
+            throw std::overflow_error("subblock data size overflows size_t");
+        }
+
+        *size = static_cast<size_t>(segment.data_size);
+        *compression_raw =
+            static_cast<int32_t>(native_info.compressionModeRaw);
+    });
+}
+
+lcj_status lcj_reader_subblock_raw_copy(
+    lcj_reader* reader,
+    int32_t native_index,
+    void* destination,
+    size_t destination_size)
+{
+    return protect([&] {
+        require_reader(reader);
+        copy_subblock_data(
+            reader,
+            native_index,
+            destination,
+            destination_size);
+    });
+}
+
+lcj_status lcj_reader_query_subblocks(
+    lcj_reader* reader,
+    const lcj_plane_coordinate* plane,
+    const lcj_rect_i32* roi,
+    int32_t layer,
+    int32_t* native_indices,
+    size_t capacity,
+    size_t* count)
+{
+    if (count == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "count must not be null");
+    }
+
+    *count = 0;
+
+    return protect([&] {
+        require_reader(reader);
+        if (plane != nullptr) {
+            require_plane_mask(*plane);
+        }
+        if (capacity != 0 && native_indices == nullptr) {
+            throw std::invalid_argument("subblock indices must not be null");
+        }
+
+        libCZI::IntRect rectangle;
+        if (roi != nullptr) {
+            rectangle = require_roi(roi);
+        }
+
+        const auto selected = query_spatial_index(
+            reader_spatial_index(reader),
+            plane,
+            roi != nullptr ? &rectangle : nullptr,
+            layer);
+
+        *count = selected.size();
+        if (selected.size() > capacity) {
+            throw buffer_too_small("subblock index destination is too small");
+        }
+        std::copy(selected.begin(), selected.end(), native_indices);
+    });
+}
+
+lcj_status lcj_reader_sort_by_file_position(
     lcj_reader* reader,
-    lcj_dimension dimension,
-    lcj_dim_bounds* bounds)
+    int32_t* native_indices,
+    size_t count)
 {
-    if (bounds == nullptr) {
-        return fail(LCJ_INVALID_ARGUMENT, "bounds must not be null");
+    return protect([&] {
+        require_reader(reader);
+        if (count != 0 && native_indices == nullptr) {
+            throw std::invalid_argument("subblock indices must not be null");
+        }
+
+        sort_by_file_position(reader, native_indices, count);
+    });
+}
+
+lcj_status lcj_reader_plan_scan(
+    lcj_reader* reader,
+    const lcj_plane_coordinate* plane,
+    int32_t* native_indices,
+    size_t capacity,
+    size_t* count)
+{
+    if (count == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "count must not be null");
     }
 
+    *count = 0;
+
     return protect([&] {
         require_reader(reader);
-        const auto statistics = reader->value->GetStatistics();
+        if (plane != nullptr) {
+            require_plane_mask(*plane);
+        }
+        if (capacity != 0 && native_indices == nullptr) {
+            throw std::invalid_argument("subblock indices must not be null");
+        }
 
-        int start = 0;
-        int size = 0;
-        const bool present = statistics.dimBounds.TryGetInterval(
-            to_libczi_dimension(dimension),
-            &start,
-            &size);
+        std::vector<int32_t> selected;
+        reader->value->EnumerateSubBlocks(
+            [&](int index, const libCZI::SubBlockInfo& native_info) {
+                if (plane == nullptr ||
+                    plane_matches(*plane, native_info.coordinate)) {
+                    selected.push_back(static_cast<int32_t>(index));
+                }
+                return true;
+            });
 
-        bounds->present = present ? uint8_t{1} : uint8_t{0};
-        std::fill(
-            std::begin(bounds->reserved),
-            std::end(bounds->reserved),
-            uint8_t{0});
-        bounds->start = present ? static_cast<int32_t>(start) : 0;
-        bounds->size = present ? static_cast<int32_t>(size) : 0;
+        *count = selected.size();
+        if (selected.size() > capacity) {
+            throw buffer_too_small("subblock index destination is too small");
+        }
+
+        sort_by_file_position(reader, selected.data(), selected.size());
+        std::copy(selected.begin(), selected.end(), native_indices);
     });
 }
 
-lcj_status lcj_reader_metadata_size(
+lcj_status lcj_scan_open(
     lcj_reader* reader,
-    size_t* size)
+    const int32_t* native_indices,
+    size_t count,
+    uint32_t readahead,
+    lcj_scan** scan)
 {
-    if (size == nullptr) {
-        return fail(LCJ_INVALID_ARGUMENT, "size must not be null");
+    if (scan == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "scan output must not be null");
     }
 
+    *scan = nullptr;
+
     return protect([&] {
-        auto segment = metadata_segment(reader);
-        const void* data = nullptr;
-        size_t bytes = 0;
-        segment->DangerousGetRawData(
-            libCZI::IMetadataSegment::MemBlkType::XmlMetadata,
-            data,
-            bytes);
-        *size = bytes;
+        require_reader(reader);
+        if (count != 0 && native_indices == nullptr) {
+            throw std::invalid_argument("subblock indices must not be null");
+        }
+
+        auto result = std::make_unique<lcj_scan>();
+        result->reader = reader;
+        result->indices.assign(native_indices, native_indices + count);
+        result->readahead = readahead;
+        scan_read_ahead(result.get());
+        *scan = result.release();
     });
 }
 
-lcj_status lcj_reader_metadata_copy(
-    lcj_reader* reader,
-    void* destination,
-    size_t destination_size)
+lcj_status lcj_scan_next(
+    lcj_scan* scan,
+    int32_t* native_index,
+    lcj_bitmap** bitmap)
 {
+    if (native_index == nullptr || bitmap == nullptr) {
+        return fail(
+            LCJ_INVALID_ARGUMENT,
+            "index and bitmap outputs must not be null");
+    }
+
+    *native_index = -1;
+    *bitmap = nullptr;
+
     return protect([&] {
-        auto segment = metadata_segment(reader);
-        const void* data = nullptr;
-        size_t bytes = 0;
-        segment->DangerousGetRawData(
-            libCZI::IMetadataSegment::MemBlkType::XmlMetadata,
-            data,
-            bytes);
+        require_scan(scan);
 
-        if (bytes > destination_size) {
-            throw buffer_too_small("metadata destination is too small");
-        }
-        if (bytes != 0 && destination == nullptr) {
-            throw std::invalid_argument(
-                "metadata destination must not be null");
+        const auto consumed = scan->next_read - scan->pending.size();
+        if (consumed == scan->indices.size()) {
+            return;
         }
 
-        if (bytes != 0 && data == nullptr) {
-            throw std::runtime_error(
-                "libCZI returned null metadata storage");
+        *native_index = scan->indices[consumed];
+        std::shared_ptr<libCZI::ISubBlock> subblock;
+        if (scan->pending.empty()) {
+            ++scan->next_read;
+            subblock = read_subblock(scan->reader, *native_index);
         }
-        if (bytes != 0) {
-            std::memcpy(destination, data, bytes);
+        else {
+            auto pending = std::move(scan->pending.front());
+            scan->pending.pop_front();
+            scan_read_ahead(scan);
+            subblock = pending.get();
         }
+
+        *bitmap = bitmap_handle(
+            scan->reader,
+            create_bitmap(scan->reader, *subblock)).release();
     });
 }
 
-lcj_status lcj_reader_subblock_info(
+lcj_status lcj_scan_close(lcj_scan* scan)
+{
+    clear_error();
+    if (scan != nullptr) {
+        for (auto& pending : scan->pending) {
+            pending.wait();
+        }
+    }
+    delete scan;
+    return LCJ_OK;
+}
+
+lcj_status lcj_queue_open(
     lcj_reader* reader,
-    int32_t native_index,
-    lcj_subblock_info* info)
+    uint32_t max_in_flight,
+    lcj_queue** queue)
 {
-    if (info == nullptr) {
-        return fail(LCJ_INVALID_ARGUMENT, "subblock info must not be null");
+    if (queue == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "queue output must not be null");
     }
 
+    *queue = nullptr;
+
     return protect([&] {
         require_reader(reader);
 
-        libCZI::SubBlockInfo native_info;
-        if (!reader->value->TryGetSubBlockInfo(native_index, &native_info)) {
-            throw std::out_of_range("subblock index is out of range");
+        auto state = std::make_shared<queue_state>();
+        state->reader = reader;
+        state->max_in_flight = max_in_flight == 0
+            ? shared_pool().size()
+            : max_in_flight;
+
+        auto result = std::make_unique<lcj_queue>();
+        result->state = std::move(state);
+        *queue = result.release();
+    });
+}
+
+lcj_status lcj_queue_submit(
+    lcj_queue* queue,
+    lcj_request_kind kind,
+    int32_t native_index,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride,
+    uint64_t user_data,
+    uint64_t* request_id)
+{
+    if (request_id == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "request id must not be null");
+    }
+
+    *request_id = 0;
+
+    return protect([&] {
+        require_queue(queue);
+        if (kind != LCJ_REQUEST_DECODE && kind != LCJ_REQUEST_RAW) {
+            throw std::invalid_argument("unknown request kind");
         }
 
-        info->native_index = native_index;
-        info->compression_raw =
-            static_cast<int32_t>(native_info.compressionModeRaw);
-        info->pixel_type =
-            to_lcj_pixel_type(native_info.pixelType);
-        info->pyramid_type =
-            to_lcj_pyramid_type(native_info.pyramidType);
-        info->m_index_present =
-            native_info.IsMindexValid() ? uint8_t{1} : uint8_t{0};
-        info->reserved0 = 0;
-        info->m_index = native_info.IsMindexValid()
-            ? static_cast<int32_t>(native_info.mIndex)
-            : 0;
-        info->logical_rect = convert_rect(native_info.logicalRect);
-        if (static_cast<uint64_t>(native_info.physicalSize.w) >
-                std::numeric_limits<uint32_t>::max() ||
-            static_cast<uint64_t>(native_info.physicalSize.h) >
-                std::numeric_limits<uint32_t>::max()) {
-            throw std::runtime_error(
-                "libCZI returned an invalid physical subblock size");
+        auto& state = *queue->state;
+        {
+            std::lock_guard<std::mutex> guard(state.mutex);
+            queue_request request;
+            request.request_id = state.next_request_id++;
+            request.user_data = user_data;
+            request.kind = kind;
+            request.native_index = native_index;
+            request.destination = destination;
+            request.destination_size = destination_size;
+            request.destination_row_stride = destination_row_stride;
+            state.waiting.push_back(request);
+            *request_id = request.request_id;
+            state.dispatch_locked();
         }
-        info->physical_width =
-            static_cast<uint32_t>(native_info.physicalSize.w);
-        info->physical_height =
-            static_cast<uint32_t>(native_info.physicalSize.h);
-        info->coordinate_mask = 0;
-        info->reserved1 = 0;
-        std::fill(
-            std::begin(info->coordinate),
-            std::end(info->coordinate),
-            int32_t{0});
+    });
+}
 
-        for (size_t i = 0; i < LCJ_DIMENSION_COUNT; ++i) {
-            int coordinate = 0;
-            if (native_info.coordinate.TryGetPosition(
-                    dimensions[i],
-                    &coordinate)) {
-                info->coordinate_mask |=
-                    static_cast<uint16_t>(uint16_t{1} << i);
-                info->coordinate[i] =
-                    static_cast<int32_t>(coordinate);
-            }
+lcj_status lcj_queue_poll(
+    lcj_queue* queue,
+    lcj_completion* completions,
+    size_t capacity,
+    uint32_t timeout_ms,
+    size_t* count)
+{
+    if (count == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "count must not be null");
+    }
+
+    *count = 0;
+
+    return protect([&] {
+        require_queue(queue);
+        if (capacity == 0 || completions == nullptr) {
+            throw std::invalid_argument(
+                "completion storage must not be empty");
+        }
+
+        auto& state = *queue->state;
+        std::unique_lock<std::mutex> lock(state.mutex);
+        const auto ready = [&state] { return !state.completed.empty(); };
+        if (timeout_ms == LCJ_WAIT_FOREVER) {
+            state.changed.wait(lock, ready);
         }
+        else {
+            state.changed.wait_for(
+                lock,
+                std::chrono::milliseconds(timeout_ms),
+                ready);
+        }
+
+        const auto taken = std::min(capacity, state.completed.size());
+        std::copy_n(state.completed.begin(), taken, completions);
+        state.completed.erase(
+            state.completed.begin(),
+            state.completed.begin() + static_cast<std::ptrdiff_t>(taken));
+        *count = taken;
     });
 }
 
-lcj_status lcj_reader_read_subblock_bitmap(
-    lcj_reader* reader,
-    int32_t native_index,
-    lcj_bitmap** bitmap)
+lcj_status lcj_queue_close(lcj_queue* queue)
 {
-    if (bitmap == nullptr) {
-        return fail(LCJ_INVALID_ARGUMENT, "bitmap output must not be null");
+    clear_error();
+    if (queue == nullptr) {
+        return LCJ_OK;
     }
 
-    *bitmap = nullptr;
+    std::unique_ptr<lcj_queue> owned(queue);
+    if (owned->state) {
+        auto& state = *owned->state;
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.waiting.clear();
+        state.changed.wait(lock, [&state] { return state.running == 0; });
+    }
+    return LCJ_OK;
+}
+
+lcj_status lcj_writer_open_utf8(
+    const char* path,
+    const lcj_writer_options* options,
+    lcj_writer** writer)
+{
+    if (path == nullptr || writer == nullptr) {
+        return fail(
+            LCJ_INVALID_ARGUMENT,
+            "path and writer output must not be null");
+    }
+
+    *writer = nullptr;
 
     return protect([&] {
-        require_reader(reader);
+        const lcj_writer_options settings = require_writer_options(options);
 
-        auto subblock = reader->value->ReadSubBlock(native_index);
-        if (!subblock) {
-            throw std::out_of_range("subblock index is out of range");
+        auto result = std::make_unique<lcj_writer>();
+        result->state = open_writer(path, settings);
+        *writer = result.release();
+    });
+}
+
+lcj_status lcj_writer_add_subblock(
+    lcj_writer* writer,
+    const lcj_subblock_write* subblock,
+    const void* data,
+    size_t data_size,
+    size_t row_stride)
+{
+    return protect([&] {
+        require_writer(writer);
+        if (subblock == nullptr) {
+            throw std::invalid_argument("subblock must not be null");
+        }
+
+        auto& state = *writer->state;
+        state.submit(
+            subblock_job(state, *subblock, data, data_size, row_stride));
+    });
+}
+
+lcj_status lcj_writer_add_metadata(
+    lcj_writer* writer,
+    const char* xml,
+    size_t size)
+{
+    return protect([&] {
+        require_writer(writer);
+        if (xml == nullptr && size != 0) {
+            throw std::invalid_argument("metadata XML must not be null");
+        }
+
+        auto& state = *writer->state;
+        if (state.metadata_added) {
+            throw std::invalid_argument("writer metadata was already added");
         }
 
-        auto decoded = subblock->CreateBitmap();
-        if (!decoded) {
-            throw std::runtime_error("libCZI returned a null bitmap");
+        state.submit(metadata_job(xml, size));
+        state.metadata_added = true;
+    });
+}
+
+lcj_status lcj_writer_add_attachment(
+    lcj_writer* writer,
+    const lcj_guid* content_guid,
+    const char* content_file_type,
+    const char* name,
+    const void* data,
+    size_t size)
+{
+    return protect([&] {
+        require_writer(writer);
+        if (content_guid == nullptr || content_file_type == nullptr ||
+            name == nullptr) {
+            throw std::invalid_argument(
+                "attachment GUID, file type and name must not be null");
+        }
+        if (data == nullptr && size != 0) {
+            throw std::invalid_argument("attachment data must not be null");
         }
 
-        auto result = std::make_unique<lcj_bitmap>();
-        result->value = std::move(decoded);
-        *bitmap = result.release();
+        writer->state->submit(attachment_job(
+            to_libczi_guid(*content_guid),
+            content_file_type,
+            name,
+            data,
+            size));
+    });
+}
+
+lcj_status lcj_writer_close(lcj_writer* writer)
+{
+    clear_error();
+    if (writer == nullptr) {
+        return LCJ_OK;
+    }
+
+    std::unique_ptr<lcj_writer> owned(writer);
+    if (!owned->state) {
+        return LCJ_OK;
+    }
+    return protect([&owned] { owned->state->finish(); });
+}
+
+lcj_status lcj_transcode_file(
+    const char* source,
+    const char* destination,
+    const lcj_writer_options* options)
+{
+    if (source == nullptr || destination == nullptr) {
+        return fail(
+            LCJ_INVALID_ARGUMENT,
+            "source and destination paths must not be null");
+    }
+
+    return protect([&] {
+        transcode_file(source, destination, require_writer_options(options));
     });
 }
 
@@ -522,11 +5555,7 @@ lcj_status lcj_bitmap_get_info(
 
         const auto pixel_type = bitmap->value->GetPixelType();
         const auto size = bitmap->value->GetSize();
-        const auto bytes = bytes_per_pixel(pixel_type);
-
-        if (size.w > std::numeric_limits<size_t>::max() / bytes) {
-            throw std::overflow_error("bitmap row size overflows size_t");
-        }
+        const auto row_bytes = row_bytes_of(pixel_type, size.w);
 
         info->pixel_type = to_lcj_pixel_type(pixel_type);
         std::fill(
@@ -536,8 +5565,7 @@ lcj_status lcj_bitmap_get_info(
         info->width = size.w;
         info->height = size.h;
         info->reserved1 = 0;
-        info->row_bytes =
-            static_cast<uint64_t>(static_cast<size_t>(size.w) * bytes);
+        info->row_bytes = static_cast<uint64_t>(row_bytes);
     });
 }
 
@@ -549,73 +5577,149 @@ lcj_status lcj_bitmap_copy(
 {
     return protect([&] {
         require_bitmap(bitmap);
-        if (destination == nullptr) {
-            throw std::invalid_argument(
-                "bitmap destination must not be null");
-        }
+        scoped_timer timer(
+            bitmap->metrics ? &bitmap->metrics->copy_nanoseconds : nullptr);
+        copy_bitmap(
+            bitmap->value,
+            destination,
+            destination_size,
+            destination_row_stride);
+    });
+}
 
-        const auto pixel_type = bitmap->value->GetPixelType();
+lcj_status lcj_bitmap_copy_converted(
+    lcj_bitmap* bitmap,
+    const lcj_copy_options* options,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride)
+{
+    return protect([&] {
+        require_bitmap(bitmap);
+        scoped_timer timer(
+            bitmap->metrics ? &bitmap->metrics->copy_nanoseconds : nullptr);
+        copy_bitmap_converted(
+            bitmap->value,
+            require_copy_options(options),
+            destination,
+            destination_size,
+            destination_row_stride);
+    });
+}
+
+lcj_status lcj_bitmap_binned_layout(
+    lcj_bitmap* bitmap,
+    const lcj_bin_options* options,
+    lcj_bin_layout* layout)
+{
+    if (layout == nullptr) {
+        return fail(LCJ_INVALID_ARGUMENT, "bin layout must not be null");
+    }
+
+    *layout = lcj_bin_layout{};
+
+    return protect([&] {
+        require_bitmap(bitmap);
+        *layout = bin_layout(
+            bitmap->value->GetPixelType(),
+            bitmap->value->GetSize(),
+            require_bin_options(options));
+    });
+}
+
+lcj_status lcj_bitmap_copy_binned(
+    lcj_bitmap* bitmap,
+    const lcj_bin_options* options,
+    void* destination,
+    size_t destination_size,
+    size_t destination_row_stride)
+{
+    return protect([&] {
+        require_bitmap(bitmap);
+        scoped_timer timer(
+            bitmap->metrics ? &bitmap->metrics->copy_nanoseconds : nullptr);
+        copy_bitmap_binned(
+            bitmap->value,
+            require_bin_options(options),
+            destination,
+            destination_size,
+            destination_row_stride);
+    });
+}
+
+lcj_status lcj_bitmap_lock(
+    lcj_bitmap* bitmap,
+    const void** data,
+    size_t* row_stride)
+{
+    if (data == nullptr || row_stride == nullptr) {
+        return fail(
+            LCJ_INVALID_ARGUMENT,
+            "bitmap data and row stride outputs must not be null");
+    }
+
+    *data = nullptr;
+    *row_stride = 0;
+
+    return protect([&] {
+        require_bitmap(bitmap);
         const auto size = bitmap->value->GetSize();
-        const auto bytes = bytes_per_pixel(pixel_type);
-        if (size.w > std::numeric_limits<size_t>::max() / bytes) {
-            throw std::overflow_error("bitmap row size overflows size_t");
-        }
         const auto row_bytes =
-            static_cast<size_t>(size.w) * bytes;
-
-        if (destination_row_stride < row_bytes) {
-            throw buffer_too_small(
-                "bitmap destination row stride is too small");
-        }
+            row_bytes_of(bitmap->value->GetPixelType(), size.w);
 
-        size_t required = 0;
-        if (size.h != 0) {
-            const auto rows_before_last =
-                static_cast<size_t>(size.h - 1);
-            if (rows_before_last >
-                (std::numeric_limits<size_t>::max() - row_bytes) /
-                    destination_row_stride) {
-                throw std::overflow_error(
-                    "bitmap destination size overflows size_t");
+        // Threads may lock one bitmap at once; claim the count first.
+        auto count = bitmap->lock_count.load();
+        do {
+            if (count == std::numeric_limits<uint32_t>::max()) {
+                throw std::out_of_range("bitmap lock count overflows");
             }
-            required =
-                rows_before_last * destination_row_stride + row_bytes;
-        }
+        } while (!bitmap->lock_count.compare_exchange_weak(count, count + 1));
 
-        if (destination_size < required) {
-            throw buffer_too_small(
-                "bitmap destination buffer is too small");
+        const auto lock = bitmap->value->Lock();
+        if ((size.w != 0 && size.h != 0 && lock.ptrDataRoi == nullptr) ||
+            lock.stride < row_bytes) {
+            bitmap->value->Unlock();
+            --bitmap->lock_count;
+            throw std::runtime_error(
+                "libCZI returned invalid decoded bitmap storage");
         }
 
-        libCZI::ScopedBitmapLockerSP lock(bitmap->value);
-        const auto* source =
-            static_cast<const uint8_t*>(lock.ptrDataRoi);
-        auto* target = static_cast<uint8_t*>(destination);
+        *data = lock.ptrDataRoi;
+        *row_stride = lock.stride;
+    });
+}
 
-        if (size.w != 0 && size.h != 0 && source == nullptr) {
-            throw std::runtime_error(
-                "libCZI returned null decoded bitmap storage");
-        }
-        if (lock.stride < row_bytes) {
-            throw std::runtime_error(
-                "libCZI returned a bitmap stride smaller than one row");
-        }
+lcj_status lcj_bitmap_unlock(lcj_bitmap* bitmap)
+{
+    return protect([&] {
+        require_bitmap(bitmap);
+        auto count = bitmap->lock_count.load();
+        do {
+            if (count == 0) {
+                throw std::invalid_argument("bitmap is not locked");
+            }
+        } while (!bitmap->lock_count.compare_exchange_weak(count, count - 1));
 
-        for (uint32_t y = 0; y < size.h; ++y) {
-            std::memcpy(
-                target + static_cast<size_t>(y) *
-                    destination_row_stride,
-                source + static_cast<size_t>(y) * lock.stride,
-                row_bytes);
-        }
+        bitmap->value->Unlock();
     });
 }
 
 lcj_status lcj_bitmap_close(lcj_bitmap* bitmap)
 {
-    clear_error();
-    delete bitmap;
-    return LCJ_OK;
+    if (bitmap == nullptr) {
+        clear_error();
+        return LCJ_OK;
+    }
+
+    std::unique_ptr<lcj_bitmap> owned(bitmap);
+    if (owned->metrics) {
+        owned->metrics->remove_bitmap(owned->bytes);
+    }
+    return protect([&] {
+        for (; owned->lock_count != 0; --owned->lock_count) {
+            owned->value->Unlock();
+        }
+    });
 }
 
 } // extern "C"
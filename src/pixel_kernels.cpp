@@ -0,0 +1,1202 @@
+#include "pixel_kernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#  define LCJ_KERNELS_X86 1
+#  include <immintrin.h>
+#  if defined(_MSC_VER) && !defined(__clang__)
+#    include <intrin.h>
+#    define LCJ_TARGET(isa)
+#  else
+#    define LCJ_TARGET(isa) __attribute__((target(isa)))
+#  endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#  define LCJ_KERNELS_NEON 1
+#  include <arm_neon.h>
+#endif
+
+#include <cstring>
+
+namespace pixel_kernels {
+
+namespace {
+
+uint16_t load_u16(const uint8_t* source)
+{
+    uint16_t value;
+    std::memcpy(&value, source, sizeof(value));
+    return value;
+}
+
+void store_u16(uint8_t* destination, uint16_t value)
+{
+    std::memcpy(destination, &value, sizeof(value));
+}
+
+uint32_t load_u32(const uint8_t* source)
+{
+    uint32_t value;
+    std::memcpy(&value, source, sizeof(value));
+    return value;
+}
+
+void store_u32(uint8_t* destination, uint32_t value)
+{
+    std::memcpy(destination, &value, sizeof(value));
+}
+
+float load_f32(const uint8_t* source)
+{
+    float value;
+    std::memcpy(&value, source, sizeof(value));
+    return value;
+}
+
+void store_f32(uint8_t* destination, float value)
+{
+    std::memcpy(destination, &value, sizeof(value));
+}
+
+/*
+ * Scalar kernels take the first pixel to convert so that vector kernels can
+ * finish their rows with them.
+ */
+void bgr24_to_rgb24_from(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t first,
+    size_t width)
+{
+    for (auto x = first; x < width; ++x) {
+        destination[3 * x] = source[3 * x + 2];
+        destination[3 * x + 1] = source[3 * x + 1];
+        destination[3 * x + 2] = source[3 * x];
+    }
+}
+
+void bgr48_to_rgb48_from(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t first,
+    size_t width)
+{
+    for (auto x = first; x < width; ++x) {
+        std::memcpy(destination + 6 * x, source + 6 * x + 4, 2);
+        std::memcpy(destination + 6 * x + 2, source + 6 * x + 2, 2);
+        std::memcpy(destination + 6 * x + 4, source + 6 * x, 2);
+    }
+}
+
+void bgr24_to_planar_from(
+    const uint8_t* source,
+    uint8_t* red,
+    uint8_t* green,
+    uint8_t* blue,
+    size_t first,
+    size_t width)
+{
+    for (auto x = first; x < width; ++x) {
+        blue[x] = source[3 * x];
+        green[x] = source[3 * x + 1];
+        red[x] = source[3 * x + 2];
+    }
+}
+
+void bgr48_to_planar_from(
+    const uint8_t* source,
+    uint8_t* red,
+    uint8_t* green,
+    uint8_t* blue,
+    size_t first,
+    size_t width)
+{
+    for (auto x = first; x < width; ++x) {
+        std::memcpy(blue + 2 * x, source + 6 * x, 2);
+        std::memcpy(green + 2 * x, source + 6 * x + 2, 2);
+        std::memcpy(red + 2 * x, source + 6 * x + 4, 2);
+    }
+}
+
+void gray8_to_u16_from(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t first,
+    size_t width)
+{
+    for (auto x = first; x < width; ++x) {
+        store_u16(destination + 2 * x, source[x]);
+    }
+}
+
+void gray8_to_f32_from(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t first,
+    size_t width,
+    float scale,
+    float offset)
+{
+    for (auto x = first; x < width; ++x) {
+        const float product = static_cast<float>(source[x]) * scale;
+        store_f32(destination + 4 * x, product + offset);
+    }
+}
+
+void gray16_to_f32_from(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t first,
+    size_t width,
+    float scale,
+    float offset)
+{
+    for (auto x = first; x < width; ++x) {
+        const float product =
+            static_cast<float>(load_u16(source + 2 * x)) * scale;
+        store_f32(destination + 4 * x, product + offset);
+    }
+}
+
+void add_u8_from(
+    const uint8_t* source,
+    uint8_t* accumulator,
+    size_t first,
+    size_t count)
+{
+    for (auto i = first; i < count; ++i) {
+        auto* sum = accumulator + 4 * i;
+        store_u32(sum, load_u32(sum) + source[i]);
+    }
+}
+
+void add_u16_from(
+    const uint8_t* source,
+    uint8_t* accumulator,
+    size_t first,
+    size_t count)
+{
+    for (auto i = first; i < count; ++i) {
+        auto* sum = accumulator + 4 * i;
+        store_u32(sum, load_u32(sum) + load_u16(source + 2 * i));
+    }
+}
+
+void add_f32_from(
+    const uint8_t* source,
+    uint8_t* accumulator,
+    size_t first,
+    size_t count)
+{
+    for (auto i = first; i < count; ++i) {
+        auto* sum = accumulator + 4 * i;
+        store_f32(sum, load_f32(sum) + load_f32(source + 4 * i));
+    }
+}
+
+void max_u8_from(
+    const uint8_t* source,
+    uint8_t* accumulator,
+    size_t first,
+    size_t count)
+{
+    for (auto i = first; i < count; ++i) {
+        if (source[i] > accumulator[i]) {
+            accumulator[i] = source[i];
+        }
+    }
+}
+
+void max_u16_from(
+    const uint8_t* source,
+    uint8_t* accumulator,
+    size_t first,
+    size_t count)
+{
+    for (auto i = first; i < count; ++i) {
+        const auto value = load_u16(source + 2 * i);
+        if (value > load_u16(accumulator + 2 * i)) {
+            store_u16(accumulator + 2 * i, value);
+        }
+    }
+}
+
+/*
+ * Written as `current > value ? current : value`, which is what maxps and
+ * the NEON select below compute, so NaNs resolve the same way everywhere.
+ */
+void max_f32_from(
+    const uint8_t* source,
+    uint8_t* accumulator,
+    size_t first,
+    size_t count)
+{
+    for (auto i = first; i < count; ++i) {
+        const auto current = load_f32(accumulator + 4 * i);
+        const auto value = load_f32(source + 4 * i);
+        store_f32(accumulator + 4 * i, current > value ? current : value);
+    }
+}
+
+void bgr24_to_rgb24_scalar(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width)
+{
+    bgr24_to_rgb24_from(source, destination, 0, width);
+}
+
+void bgr48_to_rgb48_scalar(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width)
+{
+    bgr48_to_rgb48_from(source, destination, 0, width);
+}
+
+void bgr24_to_planar_scalar(
+    const uint8_t* source,
+    uint8_t* red,
+    uint8_t* green,
+    uint8_t* blue,
+    size_t width)
+{
+    bgr24_to_planar_from(source, red, green, blue, 0, width);
+}
+
+void bgr48_to_planar_scalar(
+    const uint8_t* source,
+    uint8_t* red,
+    uint8_t* green,
+    uint8_t* blue,
+    size_t width)
+{
+    bgr48_to_planar_from(source, red, green, blue, 0, width);
+}
+
+void gray8_to_u16_scalar(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width)
+{
+    gray8_to_u16_from(source, destination, 0, width);
+}
+
+void gray8_to_f32_scalar(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width,
+    float scale,
+    float offset)
+{
+    gray8_to_f32_from(source, destination, 0, width, scale, offset);
+}
+
+void gray16_to_f32_scalar(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width,
+    float scale,
+    float offset)
+{
+    gray16_to_f32_from(source, destination, 0, width, scale, offset);
+}
+
+void add_u8_scalar(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    add_u8_from(source, accumulator, 0, count);
+}
+
+void add_u16_scalar(
+    const uint8_t* source,
+    uint8_t* accumulator,
+    size_t count)
+{
+    add_u16_from(source, accumulator, 0, count);
+}
+
+void add_f32_scalar(
+    const uint8_t* source,
+    uint8_t* accumulator,
+    size_t count)
+{
+    add_f32_from(source, accumulator, 0, count);
+}
+
+void max_u8_scalar(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    max_u8_from(source, accumulator, 0, count);
+}
+
+void max_u16_scalar(
+    const uint8_t* source,
+    uint8_t* accumulator,
+    size_t count)
+{
+    max_u16_from(source, accumulator, 0, count);
+}
+
+void max_f32_scalar(
+    const uint8_t* source,
+    uint8_t* accumulator,
+    size_t count)
+{
+    max_f32_from(source, accumulator, 0, count);
+}
+
+const kernel_set scalar_set = {
+    "scalar",
+    bgr24_to_rgb24_scalar,
+    bgr48_to_rgb48_scalar,
+    bgr24_to_planar_scalar,
+    bgr48_to_planar_scalar,
+    gray8_to_u16_scalar,
+    gray8_to_f32_scalar,
+    gray16_to_f32_scalar,
+    add_u8_scalar,
+    add_u16_scalar,
+    add_f32_scalar,
+    max_u8_scalar,
+    max_u16_scalar,
+    max_f32_scalar,
+};
+
+#if defined(LCJ_KERNELS_X86)
+
+/*
+ * pshufb masks. A swap mask reverses the samples of each whole pixel in a
+ * 16-byte load and keeps the trailing partial pixel; the next iteration
+ * starts at that pixel and overwrites it. Split masks gather one channel of
+ * 48 interleaved bytes from each of the three loads, 0x80 zeroing lanes that
+ * come from another load.
+ */
+struct shuffle_masks {
+    alignas(16) uint8_t swap24[16];
+    alignas(16) uint8_t swap48[16];
+    alignas(16) uint8_t split24[3][3][16];
+    alignas(16) uint8_t split48[3][3][16];
+
+    shuffle_masks()
+    {
+        for (int i = 0; i < 16; ++i) {
+            swap24[i] = static_cast<uint8_t>(
+                i < 15 ? 3 * (i / 3) + 2 - i % 3 : i);
+
+            const int lane = i / 2;
+            swap48[i] = static_cast<uint8_t>(
+                lane < 6 ? 2 * (3 * (lane / 3) + 2 - lane % 3) + i % 2 : i);
+        }
+
+        for (int channel = 0; channel < 3; ++channel) {
+            for (int load = 0; load < 3; ++load) {
+                for (int i = 0; i < 16; ++i) {
+                    const int byte = 3 * i + channel;
+                    split24[channel][load][i] = static_cast<uint8_t>(
+                        byte / 16 == load ? byte % 16 : 0x80);
+
+                    const int sample = 3 * (i / 2) + channel;
+                    split48[channel][load][i] = static_cast<uint8_t>(
+                        sample / 8 == load ? 2 * (sample % 8) + i % 2 : 0x80);
+                }
+            }
+        }
+    }
+};
+
+const shuffle_masks& masks()
+{
+    static const shuffle_masks value;
+    return value;
+}
+
+__m128i load_mask(const uint8_t* mask)
+{
+    return _mm_load_si128(reinterpret_cast<const __m128i*>(mask));
+}
+
+__m128i loadu(const uint8_t* source)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+}
+
+void storeu(uint8_t* destination, __m128i value)
+{
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), value);
+}
+
+LCJ_TARGET("ssse3")
+void bgr24_to_rgb24_ssse3(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width)
+{
+    const auto mask = load_mask(masks().swap24);
+    size_t x = 0;
+    for (; x + 6 <= width; x += 5) {
+        const auto pixels = loadu(source + 3 * x);
+        storeu(destination + 3 * x, _mm_shuffle_epi8(pixels, mask));
+    }
+    bgr24_to_rgb24_from(source, destination, x, width);
+}
+
+LCJ_TARGET("ssse3")
+void bgr48_to_rgb48_ssse3(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width)
+{
+    const auto mask = load_mask(masks().swap48);
+    size_t x = 0;
+    for (; x + 3 <= width; x += 2) {
+        const auto pixels = loadu(source + 6 * x);
+        storeu(destination + 6 * x, _mm_shuffle_epi8(pixels, mask));
+    }
+    bgr48_to_rgb48_from(source, destination, x, width);
+}
+
+LCJ_TARGET("ssse3")
+__m128i gather_channel(
+    __m128i first,
+    __m128i second,
+    __m128i third,
+    const uint8_t (&mask)[3][16])
+{
+    return _mm_or_si128(
+        _mm_or_si128(
+            _mm_shuffle_epi8(first, load_mask(mask[0])),
+            _mm_shuffle_epi8(second, load_mask(mask[1]))),
+        _mm_shuffle_epi8(third, load_mask(mask[2])));
+}
+
+LCJ_TARGET("ssse3")
+void bgr24_to_planar_ssse3(
+    const uint8_t* source,
+    uint8_t* red,
+    uint8_t* green,
+    uint8_t* blue,
+    size_t width)
+{
+    const auto& split = masks().split24;
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const auto first = loadu(source + 3 * x);
+        const auto second = loadu(source + 3 * x + 16);
+        const auto third = loadu(source + 3 * x + 32);
+        storeu(blue + x, gather_channel(first, second, third, split[0]));
+        storeu(green + x, gather_channel(first, second, third, split[1]));
+        storeu(red + x, gather_channel(first, second, third, split[2]));
+    }
+    bgr24_to_planar_from(source, red, green, blue, x, width);
+}
+
+LCJ_TARGET("ssse3")
+void bgr48_to_planar_ssse3(
+    const uint8_t* source,
+    uint8_t* red,
+    uint8_t* green,
+    uint8_t* blue,
+    size_t width)
+{
+    const auto& split = masks().split48;
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const auto first = loadu(source + 6 * x);
+        const auto second = loadu(source + 6 * x + 16);
+        const auto third = loadu(source + 6 * x + 32);
+        storeu(blue + 2 * x, gather_channel(first, second, third, split[0]));
+        storeu(green + 2 * x, gather_channel(first, second, third, split[1]));
+        storeu(red + 2 * x, gather_channel(first, second, third, split[2]));
+    }
+    bgr48_to_planar_from(source, red, green, blue, x, width);
+}
+
+void gray8_to_u16_sse2(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width)
+{
+    const auto zero = _mm_setzero_si128();
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const auto value = loadu(source + x);
+        storeu(destination + 2 * x, _mm_unpacklo_epi8(value, zero));
+        storeu(destination + 2 * x + 16, _mm_unpackhi_epi8(value, zero));
+    }
+    gray8_to_u16_from(source, destination, x, width);
+}
+
+void store_scaled_sse2(
+    uint8_t* destination,
+    __m128i value,
+    __m128 scale,
+    __m128 offset)
+{
+    const auto product = _mm_mul_ps(_mm_cvtepi32_ps(value), scale);
+    _mm_storeu_ps(
+        reinterpret_cast<float*>(destination),
+        _mm_add_ps(product, offset));
+}
+
+void gray8_to_f32_sse2(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width,
+    float scale,
+    float offset)
+{
+    const auto zero = _mm_setzero_si128();
+    const auto factor = _mm_set1_ps(scale);
+    const auto shift = _mm_set1_ps(offset);
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const auto value = loadu(source + x);
+        const auto low = _mm_unpacklo_epi8(value, zero);
+        const auto high = _mm_unpackhi_epi8(value, zero);
+        auto* target = destination + 4 * x;
+        store_scaled_sse2(
+            target, _mm_unpacklo_epi16(low, zero), factor, shift);
+        store_scaled_sse2(
+            target + 16, _mm_unpackhi_epi16(low, zero), factor, shift);
+        store_scaled_sse2(
+            target + 32, _mm_unpacklo_epi16(high, zero), factor, shift);
+        store_scaled_sse2(
+            target + 48, _mm_unpackhi_epi16(high, zero), factor, shift);
+    }
+    gray8_to_f32_from(source, destination, x, width, scale, offset);
+}
+
+void gray16_to_f32_sse2(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width,
+    float scale,
+    float offset)
+{
+    const auto zero = _mm_setzero_si128();
+    const auto factor = _mm_set1_ps(scale);
+    const auto shift = _mm_set1_ps(offset);
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const auto value = loadu(source + 2 * x);
+        auto* target = destination + 4 * x;
+        store_scaled_sse2(
+            target, _mm_unpacklo_epi16(value, zero), factor, shift);
+        store_scaled_sse2(
+            target + 16, _mm_unpackhi_epi16(value, zero), factor, shift);
+    }
+    gray16_to_f32_from(source, destination, x, width, scale, offset);
+}
+
+void add_u32_sse2(uint8_t* accumulator, __m128i value)
+{
+    storeu(accumulator, _mm_add_epi32(loadu(accumulator), value));
+}
+
+void add_u8_sse2(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    const auto zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const auto value = loadu(source + i);
+        const auto low = _mm_unpacklo_epi8(value, zero);
+        const auto high = _mm_unpackhi_epi8(value, zero);
+        auto* sum = accumulator + 4 * i;
+        add_u32_sse2(sum, _mm_unpacklo_epi16(low, zero));
+        add_u32_sse2(sum + 16, _mm_unpackhi_epi16(low, zero));
+        add_u32_sse2(sum + 32, _mm_unpacklo_epi16(high, zero));
+        add_u32_sse2(sum + 48, _mm_unpackhi_epi16(high, zero));
+    }
+    add_u8_from(source, accumulator, i, count);
+}
+
+void add_u16_sse2(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    const auto zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const auto value = loadu(source + 2 * i);
+        auto* sum = accumulator + 4 * i;
+        add_u32_sse2(sum, _mm_unpacklo_epi16(value, zero));
+        add_u32_sse2(sum + 16, _mm_unpackhi_epi16(value, zero));
+    }
+    add_u16_from(source, accumulator, i, count);
+}
+
+void add_f32_sse2(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto* sum = reinterpret_cast<float*>(accumulator + 4 * i);
+        const auto value =
+            _mm_loadu_ps(reinterpret_cast<const float*>(source + 4 * i));
+        _mm_storeu_ps(sum, _mm_add_ps(_mm_loadu_ps(sum), value));
+    }
+    add_f32_from(source, accumulator, i, count);
+}
+
+void max_u8_sse2(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        storeu(
+            accumulator + i,
+            _mm_max_epu8(loadu(accumulator + i), loadu(source + i)));
+    }
+    max_u8_from(source, accumulator, i, count);
+}
+
+void max_u16_sse2(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    // SSE2 has no unsigned 16-bit max; (a -sat b) +sat b is max(a, b).
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const auto current = loadu(accumulator + 2 * i);
+        const auto value = loadu(source + 2 * i);
+        storeu(
+            accumulator + 2 * i,
+            _mm_adds_epu16(_mm_subs_epu16(current, value), value));
+    }
+    max_u16_from(source, accumulator, i, count);
+}
+
+void max_f32_sse2(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto* current = reinterpret_cast<float*>(accumulator + 4 * i);
+        const auto value =
+            _mm_loadu_ps(reinterpret_cast<const float*>(source + 4 * i));
+        _mm_storeu_ps(current, _mm_max_ps(_mm_loadu_ps(current), value));
+    }
+    max_f32_from(source, accumulator, i, count);
+}
+
+LCJ_TARGET("avx2")
+void add_u32_avx2(uint8_t* accumulator, __m256i value)
+{
+    auto* sum = reinterpret_cast<__m256i*>(accumulator);
+    _mm256_storeu_si256(sum, _mm256_add_epi32(_mm256_loadu_si256(sum), value));
+}
+
+LCJ_TARGET("avx2")
+void add_u8_avx2(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const auto value = loadu(source + i);
+        auto* sum = accumulator + 4 * i;
+        add_u32_avx2(sum, _mm256_cvtepu8_epi32(value));
+        add_u32_avx2(
+            sum + 32,
+            _mm256_cvtepu8_epi32(_mm_srli_si128(value, 8)));
+    }
+    add_u8_from(source, accumulator, i, count);
+}
+
+LCJ_TARGET("avx2")
+void add_u16_avx2(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        auto* sum = accumulator + 4 * i;
+        add_u32_avx2(sum, _mm256_cvtepu16_epi32(loadu(source + 2 * i)));
+        add_u32_avx2(
+            sum + 32,
+            _mm256_cvtepu16_epi32(loadu(source + 2 * i + 16)));
+    }
+    add_u16_from(source, accumulator, i, count);
+}
+
+LCJ_TARGET("avx2")
+void add_f32_avx2(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto* sum = reinterpret_cast<float*>(accumulator + 4 * i);
+        const auto value =
+            _mm256_loadu_ps(reinterpret_cast<const float*>(source + 4 * i));
+        _mm256_storeu_ps(sum, _mm256_add_ps(_mm256_loadu_ps(sum), value));
+    }
+    add_f32_from(source, accumulator, i, count);
+}
+
+LCJ_TARGET("avx2")
+void max_u8_avx2(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        auto* current = reinterpret_cast<__m256i*>(accumulator + i);
+        const auto value = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(source + i));
+        _mm256_storeu_si256(
+            current,
+            _mm256_max_epu8(_mm256_loadu_si256(current), value));
+    }
+    max_u8_from(source, accumulator, i, count);
+}
+
+LCJ_TARGET("avx2")
+void max_u16_avx2(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        auto* current = reinterpret_cast<__m256i*>(accumulator + 2 * i);
+        const auto value = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(source + 2 * i));
+        _mm256_storeu_si256(
+            current,
+            _mm256_max_epu16(_mm256_loadu_si256(current), value));
+    }
+    max_u16_from(source, accumulator, i, count);
+}
+
+LCJ_TARGET("avx2")
+void max_f32_avx2(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto* current = reinterpret_cast<float*>(accumulator + 4 * i);
+        const auto value =
+            _mm256_loadu_ps(reinterpret_cast<const float*>(source + 4 * i));
+        _mm256_storeu_ps(
+            current,
+            _mm256_max_ps(_mm256_loadu_ps(current), value));
+    }
+    max_f32_from(source, accumulator, i, count);
+}
+
+LCJ_TARGET("avx2")
+void gray8_to_u16_avx2(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width)
+{
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i*>(destination + 2 * x),
+            _mm256_cvtepu8_epi16(loadu(source + x)));
+    }
+    gray8_to_u16_from(source, destination, x, width);
+}
+
+LCJ_TARGET("avx2")
+void gray8_to_f32_avx2(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width,
+    float scale,
+    float offset)
+{
+    const auto factor = _mm256_set1_ps(scale);
+    const auto shift = _mm256_set1_ps(offset);
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const auto value = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(source + x)));
+        const auto product = _mm256_mul_ps(_mm256_cvtepi32_ps(value), factor);
+        _mm256_storeu_ps(
+            reinterpret_cast<float*>(destination + 4 * x),
+            _mm256_add_ps(product, shift));
+    }
+    gray8_to_f32_from(source, destination, x, width, scale, offset);
+}
+
+LCJ_TARGET("avx2")
+void gray16_to_f32_avx2(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width,
+    float scale,
+    float offset)
+{
+    const auto factor = _mm256_set1_ps(scale);
+    const auto shift = _mm256_set1_ps(offset);
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const auto value = _mm256_cvtepu16_epi32(loadu(source + 2 * x));
+        const auto product = _mm256_mul_ps(_mm256_cvtepi32_ps(value), factor);
+        _mm256_storeu_ps(
+            reinterpret_cast<float*>(destination + 4 * x),
+            _mm256_add_ps(product, shift));
+    }
+    gray16_to_f32_from(source, destination, x, width, scale, offset);
+}
+
+const kernel_set sse2_set = {
+    "sse2",
+    bgr24_to_rgb24_scalar,
+    bgr48_to_rgb48_scalar,
+    bgr24_to_planar_scalar,
+    bgr48_to_planar_scalar,
+    gray8_to_u16_sse2,
+    gray8_to_f32_sse2,
+    gray16_to_f32_sse2,
+    add_u8_sse2,
+    add_u16_sse2,
+    add_f32_sse2,
+    max_u8_sse2,
+    max_u16_sse2,
+    max_f32_sse2,
+};
+
+const kernel_set ssse3_set = {
+    "ssse3",
+    bgr24_to_rgb24_ssse3,
+    bgr48_to_rgb48_ssse3,
+    bgr24_to_planar_ssse3,
+    bgr48_to_planar_ssse3,
+    gray8_to_u16_sse2,
+    gray8_to_f32_sse2,
+    gray16_to_f32_sse2,
+    add_u8_sse2,
+    add_u16_sse2,
+    add_f32_sse2,
+    max_u8_sse2,
+    max_u16_sse2,
+    max_f32_sse2,
+};
+
+const kernel_set avx2_set = {
+    "avx2",
+    bgr24_to_rgb24_ssse3,
+    bgr48_to_rgb48_ssse3,
+    bgr24_to_planar_ssse3,
+    bgr48_to_planar_ssse3,
+    gray8_to_u16_avx2,
+    gray8_to_f32_avx2,
+    gray16_to_f32_avx2,
+    add_u8_avx2,
+    add_u16_avx2,
+    add_f32_avx2,
+    max_u8_avx2,
+    max_u16_avx2,
+    max_f32_avx2,
+};
+
+#  if defined(_MSC_VER) && !defined(__clang__)
+
+bool cpu_has_ssse3()
+{
+    int registers[4];
+    __cpuid(registers, 1);
+    return (registers[2] & (1 << 9)) != 0;
+}
+
+bool cpu_has_avx2()
+{
+    int registers[4];
+    __cpuid(registers, 0);
+    if (registers[0] < 7) {
+        return false;
+    }
+
+    // AVX state must also be enabled by the operating system.
+    __cpuid(registers, 1);
+    const bool osxsave = (registers[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+
+    __cpuidex(registers, 7, 0);
+    return (registers[1] & (1 << 5)) != 0;
+}
+
+#  else
+
+bool cpu_has_ssse3()
+{
+    return __builtin_cpu_supports("ssse3") != 0;
+}
+
+bool cpu_has_avx2()
+{
+    return __builtin_cpu_supports("avx2") != 0;
+}
+
+#  endif
+
+std::vector<const kernel_set*> detect_supported()
+{
+    std::vector<const kernel_set*> sets = {&scalar_set, &sse2_set};
+    if (cpu_has_ssse3()) {
+        sets.push_back(&ssse3_set);
+    }
+    if (cpu_has_avx2()) {
+        sets.push_back(&avx2_set);
+    }
+    return sets;
+}
+
+#elif defined(LCJ_KERNELS_NEON)
+
+void bgr24_to_rgb24_neon(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width)
+{
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        auto pixels = vld3q_u8(source + 3 * x);
+        const auto blue = pixels.val[0];
+        pixels.val[0] = pixels.val[2];
+        pixels.val[2] = blue;
+        vst3q_u8(destination + 3 * x, pixels);
+    }
+    bgr24_to_rgb24_from(source, destination, x, width);
+}
+
+void bgr48_to_rgb48_neon(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width)
+{
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        auto pixels =
+            vld3q_u16(reinterpret_cast<const uint16_t*>(source + 6 * x));
+        const auto blue = pixels.val[0];
+        pixels.val[0] = pixels.val[2];
+        pixels.val[2] = blue;
+        vst3q_u16(reinterpret_cast<uint16_t*>(destination + 6 * x), pixels);
+    }
+    bgr48_to_rgb48_from(source, destination, x, width);
+}
+
+void bgr24_to_planar_neon(
+    const uint8_t* source,
+    uint8_t* red,
+    uint8_t* green,
+    uint8_t* blue,
+    size_t width)
+{
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const auto pixels = vld3q_u8(source + 3 * x);
+        vst1q_u8(blue + x, pixels.val[0]);
+        vst1q_u8(green + x, pixels.val[1]);
+        vst1q_u8(red + x, pixels.val[2]);
+    }
+    bgr24_to_planar_from(source, red, green, blue, x, width);
+}
+
+void bgr48_to_planar_neon(
+    const uint8_t* source,
+    uint8_t* red,
+    uint8_t* green,
+    uint8_t* blue,
+    size_t width)
+{
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const auto pixels =
+            vld3q_u16(reinterpret_cast<const uint16_t*>(source + 6 * x));
+        vst1q_u16(reinterpret_cast<uint16_t*>(blue + 2 * x), pixels.val[0]);
+        vst1q_u16(reinterpret_cast<uint16_t*>(green + 2 * x), pixels.val[1]);
+        vst1q_u16(reinterpret_cast<uint16_t*>(red + 2 * x), pixels.val[2]);
+    }
+    bgr48_to_planar_from(source, red, green, blue, x, width);
+}
+
+void gray8_to_u16_neon(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width)
+{
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const auto value = vld1q_u8(source + x);
+        auto* target = reinterpret_cast<uint16_t*>(destination + 2 * x);
+        vst1q_u16(target, vmovl_u8(vget_low_u8(value)));
+        vst1q_u16(target + 8, vmovl_u8(vget_high_u8(value)));
+    }
+    gray8_to_u16_from(source, destination, x, width);
+}
+
+void store_scaled_neon(
+    uint8_t* destination,
+    uint32x4_t value,
+    float32x4_t scale,
+    float32x4_t offset)
+{
+    const auto product = vmulq_f32(vcvtq_f32_u32(value), scale);
+    vst1q_f32(
+        reinterpret_cast<float*>(destination),
+        vaddq_f32(product, offset));
+}
+
+void gray8_to_f32_neon(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width,
+    float scale,
+    float offset)
+{
+    const auto factor = vdupq_n_f32(scale);
+    const auto shift = vdupq_n_f32(offset);
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const auto value = vmovl_u8(vld1_u8(source + x));
+        auto* target = destination + 4 * x;
+        store_scaled_neon(
+            target, vmovl_u16(vget_low_u16(value)), factor, shift);
+        store_scaled_neon(
+            target + 16, vmovl_u16(vget_high_u16(value)), factor, shift);
+    }
+    gray8_to_f32_from(source, destination, x, width, scale, offset);
+}
+
+void gray16_to_f32_neon(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width,
+    float scale,
+    float offset)
+{
+    const auto factor = vdupq_n_f32(scale);
+    const auto shift = vdupq_n_f32(offset);
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const auto value =
+            vld1q_u16(reinterpret_cast<const uint16_t*>(source + 2 * x));
+        auto* target = destination + 4 * x;
+        store_scaled_neon(
+            target, vmovl_u16(vget_low_u16(value)), factor, shift);
+        store_scaled_neon(
+            target + 16, vmovl_u16(vget_high_u16(value)), factor, shift);
+    }
+    gray16_to_f32_from(source, destination, x, width, scale, offset);
+}
+
+void add_u8_neon(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const auto value = vld1q_u8(source + i);
+        const auto low = vmovl_u8(vget_low_u8(value));
+        const auto high = vmovl_u8(vget_high_u8(value));
+        auto* sum = reinterpret_cast<uint32_t*>(accumulator + 4 * i);
+        vst1q_u32(sum, vaddw_u16(vld1q_u32(sum), vget_low_u16(low)));
+        vst1q_u32(sum + 4, vaddw_u16(vld1q_u32(sum + 4), vget_high_u16(low)));
+        vst1q_u32(sum + 8, vaddw_u16(vld1q_u32(sum + 8), vget_low_u16(high)));
+        vst1q_u32(
+            sum + 12,
+            vaddw_u16(vld1q_u32(sum + 12), vget_high_u16(high)));
+    }
+    add_u8_from(source, accumulator, i, count);
+}
+
+void add_u16_neon(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const auto value =
+            vld1q_u16(reinterpret_cast<const uint16_t*>(source + 2 * i));
+        auto* sum = reinterpret_cast<uint32_t*>(accumulator + 4 * i);
+        vst1q_u32(sum, vaddw_u16(vld1q_u32(sum), vget_low_u16(value)));
+        vst1q_u32(
+            sum + 4,
+            vaddw_u16(vld1q_u32(sum + 4), vget_high_u16(value)));
+    }
+    add_u16_from(source, accumulator, i, count);
+}
+
+void add_f32_neon(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto* sum = reinterpret_cast<float*>(accumulator + 4 * i);
+        const auto value =
+            vld1q_f32(reinterpret_cast<const float*>(source + 4 * i));
+        vst1q_f32(sum, vaddq_f32(vld1q_f32(sum), value));
+    }
+    add_f32_from(source, accumulator, i, count);
+}
+
+void max_u8_neon(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        vst1q_u8(
+            accumulator + i,
+            vmaxq_u8(vld1q_u8(accumulator + i), vld1q_u8(source + i)));
+    }
+    max_u8_from(source, accumulator, i, count);
+}
+
+void max_u16_neon(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto* current = reinterpret_cast<uint16_t*>(accumulator + 2 * i);
+        const auto value =
+            vld1q_u16(reinterpret_cast<const uint16_t*>(source + 2 * i));
+        vst1q_u16(current, vmaxq_u16(vld1q_u16(current), value));
+    }
+    max_u16_from(source, accumulator, i, count);
+}
+
+void max_f32_neon(const uint8_t* source, uint8_t* accumulator, size_t count)
+{
+    // vmaxq_f32 propagates NaNs; select like maxps and the scalar kernel.
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto* target = reinterpret_cast<float*>(accumulator + 4 * i);
+        const auto current = vld1q_f32(target);
+        const auto value =
+            vld1q_f32(reinterpret_cast<const float*>(source + 4 * i));
+        vst1q_f32(
+            target,
+            vbslq_f32(vcgtq_f32(current, value), current, value));
+    }
+    max_f32_from(source, accumulator, i, count);
+}
+
+const kernel_set neon_set = {
+    "neon",
+    bgr24_to_rgb24_neon,
+    bgr48_to_rgb48_neon,
+    bgr24_to_planar_neon,
+    bgr48_to_planar_neon,
+    gray8_to_u16_neon,
+    gray8_to_f32_neon,
+    gray16_to_f32_neon,
+    add_u8_neon,
+    add_u16_neon,
+    add_f32_neon,
+    max_u8_neon,
+    max_u16_neon,
+    max_f32_neon,
+};
+
+std::vector<const kernel_set*> detect_supported()
+{
+    return {&scalar_set, &neon_set};
+}
+
+#else
+
+std::vector<const kernel_set*> detect_supported()
+{
+    return {&scalar_set};
+}
+
+#endif
+
+} // namespace
+
+const kernel_set& scalar_kernels()
+{
+    return scalar_set;
+}
+
+const kernel_set& active_kernels()
+{
+    static const kernel_set& kernels = *detect_supported().back();
+    return kernels;
+}
+
+std::vector<const kernel_set*> supported_kernels()
+{
+    return detect_supported();
+}
+
+} // namespace pixel_kernels
@@ -0,0 +1,79 @@
+#ifndef LIBCZI_JULIA_PIXEL_KERNELS_H
+#define LIBCZI_JULIA_PIXEL_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Row kernels for converting copies. Every kernel converts `width` pixels of
+ * one row; pointers need no particular alignment and source and destination
+ * must not overlap. Multi-byte samples are in host byte order.
+ */
+namespace pixel_kernels {
+
+using convert_row = void (*)(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width);
+
+using split_row = void (*)(
+    const uint8_t* source,
+    uint8_t* red,
+    uint8_t* green,
+    uint8_t* blue,
+    size_t width);
+
+using scale_row = void (*)(
+    const uint8_t* source,
+    uint8_t* destination,
+    size_t width,
+    float scale,
+    float offset);
+
+/*
+ * Binning kernels fold `count` samples of one row into an accumulator row
+ * element by element: `add` kernels sum 8- or 16-bit samples into 32-bit
+ * integers or floats into floats, `max` kernels keep the larger of each
+ * sample and the accumulator of the same type.
+ */
+using accumulate_row = void (*)(
+    const uint8_t* source,
+    uint8_t* accumulator,
+    size_t count);
+
+struct kernel_set {
+    const char* name;
+    convert_row bgr24_to_rgb24;
+    convert_row bgr48_to_rgb48;
+    split_row bgr24_to_planar;
+    split_row bgr48_to_planar;
+    convert_row gray8_to_u16;
+    scale_row gray8_to_f32;
+    scale_row gray16_to_f32;
+    accumulate_row add_u8;
+    accumulate_row add_u16;
+    accumulate_row add_f32;
+    accumulate_row max_u8;
+    accumulate_row max_u16;
+    accumulate_row max_f32;
+};
+
+/*
+ * Portable reference kernels.
+ */
+const kernel_set& scalar_kernels();
+
+/*
+ * Fastest kernels for the running CPU, detected on first use.
+ */
+const kernel_set& active_kernels();
+
+/*
+ * Every kernel set the running CPU can execute, slowest first.
+ */
+std::vector<const kernel_set*> supported_kernels();
+
+} // namespace pixel_kernels
+
+#endif
@@ -9,9 +9,59 @@ _Static_assert(sizeof(lcj_dim_bounds) == 12, "lcj_dim_bounds ABI size");
 _Static_assert(sizeof(lcj_statistics) == 48, "lcj_statistics ABI size");
 _Static_assert(sizeof(lcj_subblock_info) == 80, "lcj_subblock_info ABI size");
 _Static_assert(sizeof(lcj_bitmap_info) == 24, "lcj_bitmap_info ABI size");
+_Static_assert(
+    sizeof(lcj_subblock_directory_entry) == 96,
+    "lcj_subblock_directory_entry ABI size");
+_Static_assert(
+    sizeof(lcj_plane_coordinate) == 40,
+    "lcj_plane_coordinate ABI size");
+_Static_assert(
+    sizeof(lcj_compose_options) == 16,
+    "lcj_compose_options ABI size");
+_Static_assert(
+    sizeof(lcj_reader_options) == 64,
+    "lcj_reader_options ABI size");
+_Static_assert(
+    sizeof(lcj_cache_statistics) == 40,
+    "lcj_cache_statistics ABI size");
+_Static_assert(sizeof(lcj_completion) == 24, "lcj_completion ABI size");
+_Static_assert(
+    sizeof(lcj_hyperslab_range) == 24,
+    "lcj_hyperslab_range ABI size");
+_Static_assert(sizeof(lcj_copy_options) == 56, "lcj_copy_options ABI size");
+_Static_assert(
+    sizeof(lcj_channel_display) == 56,
+    "lcj_channel_display ABI size");
+_Static_assert(
+    offsetof(lcj_channel_display, lut) == 24,
+    "lcj_channel_display lut offset");
+_Static_assert(sizeof(lcj_guid) == 16, "lcj_guid ABI size");
+_Static_assert(
+    sizeof(lcj_attachment_info) == 144,
+    "lcj_attachment_info ABI size");
+_Static_assert(
+    offsetof(lcj_attachment_info, name) == 56,
+    "lcj_attachment_info name offset");
+_Static_assert(sizeof(lcj_scaling) == 32, "lcj_scaling ABI size");
+_Static_assert(sizeof(lcj_channel_info) == 16, "lcj_channel_info ABI size");
+_Static_assert(sizeof(lcj_scene_info) == 40, "lcj_scene_info ABI size");
+_Static_assert(
+    sizeof(lcj_reader_metrics) == 152,
+    "lcj_reader_metrics ABI size");
+_Static_assert(
+    sizeof(lcj_writer_options) == 64,
+    "lcj_writer_options ABI size");
+_Static_assert(
+    sizeof(lcj_subblock_write) == 88,
+    "lcj_subblock_write ABI size");
+_Static_assert(sizeof(lcj_bin_options) == 32, "lcj_bin_options ABI size");
+_Static_assert(sizeof(lcj_bin_layout) == 32, "lcj_bin_layout ABI size");
 _Static_assert(
     offsetof(lcj_subblock_info, coordinate) == 44,
     "lcj_subblock_info coordinate offset");
+_Static_assert(
+    offsetof(lcj_subblock_directory_entry, file_position) == 80,
+    "lcj_subblock_directory_entry file_position offset");
 _Static_assert(
     offsetof(lcj_bitmap_info, row_bytes) == 16,
     "lcj_bitmap_info row_bytes offset");
@@ -0,0 +1,544 @@
+#include "libczi_julia.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Writes synthetic CZI fixtures with lcj_writer and measures the read paths
+ * on them. Every parameter takes a comma-separated list and every
+ * combination is run; results go to standard output as one JSON document.
+ */
+
+#define MAX_LIST 16
+
+typedef struct pixel_format {
+    const char* name;
+    lcj_pixel_type type;
+    size_t bytes_per_pixel;
+    size_t bytes_per_sample;
+} pixel_format;
+
+typedef struct compression_format {
+    const char* name;
+    lcj_compression type;
+} compression_format;
+
+static const pixel_format pixel_formats[] = {
+    {"gray8", LCJ_PIXEL_GRAY8, 1, 1},
+    {"gray16", LCJ_PIXEL_GRAY16, 2, 2},
+    {"gray32f", LCJ_PIXEL_GRAY32_FLOAT, 4, 4},
+    {"bgr24", LCJ_PIXEL_BGR24, 3, 1},
+    {"bgr48", LCJ_PIXEL_BGR48, 6, 2},
+};
+
+static const compression_format compression_formats[] = {
+    {"none", LCJ_COMPRESSION_NONE},
+    {"zstd0", LCJ_COMPRESSION_ZSTD0},
+    {"zstd1", LCJ_COMPRESSION_ZSTD1},
+};
+
+typedef struct settings {
+    const pixel_format* pixels[MAX_LIST];
+    size_t pixel_count;
+    const compression_format* compressions[MAX_LIST];
+    size_t compression_count;
+    uint32_t tile_sizes[MAX_LIST];
+    size_t tile_size_count;
+    size_t subblock_counts[MAX_LIST];
+    size_t subblock_count_count;
+    unsigned repeat;
+    const char* directory;
+    int keep;
+} settings;
+
+typedef struct measurement {
+    uint64_t file_bytes;
+    double write_seconds;
+    double open_seconds;
+    double info_seconds;
+    double decode_seconds;
+    double copy_seconds;
+    uint64_t decoded_bytes;
+} measurement;
+
+static int check(lcj_status status, const char* operation)
+{
+    if (status == LCJ_OK) {
+        return 1;
+    }
+
+    fprintf(
+        stderr,
+        "%s failed (%d): %s\n",
+        operation,
+        (int)status,
+        lcj_last_error_message());
+    return 0;
+}
+
+static double now_seconds(void)
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static uint32_t next_random(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/*
+ * Smooth gradients with a few bits of noise, so that compressed fixtures
+ * compress about as well as real microscopy data rather than perfectly.
+ */
+static void fill_tile(
+    unsigned char* tile,
+    const pixel_format* format,
+    uint32_t size,
+    uint32_t seed)
+{
+    uint32_t random = seed * 2654435761u + 1u;
+    const size_t samples =
+        (size_t)size * format->bytes_per_pixel / format->bytes_per_sample;
+    for (uint32_t y = 0; y < size; ++y) {
+        for (size_t i = 0; i < samples; ++i) {
+            const uint32_t base = (uint32_t)i + 2u * y + seed;
+            const uint32_t noise = next_random(&random) & 7u;
+            const size_t at = (size_t)y * samples + i;
+            if (format->type == LCJ_PIXEL_GRAY32_FLOAT) {
+                const float value = (float)((base & 1023u) + noise) / 1024.0f;
+                memcpy(tile + at * 4u, &value, sizeof(value));
+            }
+            else if (format->bytes_per_sample == 2) {
+                const uint16_t value =
+                    (uint16_t)(((base & 4095u) << 4) | (noise << 1));
+                memcpy(tile + at * 2u, &value, sizeof(value));
+            }
+            else {
+                tile[at] = (unsigned char)((base & 127u) + noise);
+            }
+        }
+    }
+}
+
+static int write_fixture(
+    const char* path,
+    const pixel_format* format,
+    const compression_format* compression,
+    uint32_t size,
+    size_t subblocks,
+    unsigned char* tile,
+    measurement* result)
+{
+    lcj_writer* writer = NULL;
+    const size_t row_bytes = (size_t)size * format->bytes_per_pixel;
+    const size_t tile_bytes = row_bytes * size;
+    size_t columns = 1;
+    while (columns * columns < subblocks) {
+        ++columns;
+    }
+
+    lcj_writer_options options;
+    memset(&options, 0, sizeof(options));
+    options.compression = (uint32_t)compression->type;
+    options.overwrite = 1;
+
+    lcj_subblock_write subblock;
+    memset(&subblock, 0, sizeof(subblock));
+    subblock.plane.coordinate_mask = (uint16_t)(1u << LCJ_DIM_C);
+    subblock.m_index_present = 1;
+    subblock.pixel_type = (uint8_t)format->type;
+    subblock.logical_rect.width = (int32_t)size;
+    subblock.logical_rect.height = (int32_t)size;
+    subblock.physical_width = size;
+    subblock.physical_height = size;
+
+    const double start = now_seconds();
+    if (!check(
+            lcj_writer_open_utf8(path, &options, &writer),
+            "lcj_writer_open_utf8")) {
+        return 0;
+    }
+    for (size_t i = 0; i < subblocks; ++i) {
+        fill_tile(tile, format, size, (uint32_t)i);
+        subblock.m_index = (int32_t)i;
+        subblock.logical_rect.x = (int32_t)((i % columns) * size);
+        subblock.logical_rect.y = (int32_t)((i / columns) * size);
+        if (!check(
+                lcj_writer_add_subblock(
+                    writer,
+                    &subblock,
+                    tile,
+                    tile_bytes,
+                    row_bytes),
+                "lcj_writer_add_subblock")) {
+            lcj_writer_close(writer);
+            return 0;
+        }
+    }
+    if (!check(lcj_writer_close(writer), "lcj_writer_close")) {
+        return 0;
+    }
+    result->write_seconds = now_seconds() - start;
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL || fseek(file, 0, SEEK_END) != 0) {
+        fprintf(stderr, "failed to measure %s\n", path);
+        if (file != NULL) {
+            fclose(file);
+        }
+        return 0;
+    }
+    result->file_bytes = (uint64_t)ftell(file);
+    fclose(file);
+    return 1;
+}
+
+static int measure_reads(
+    const char* path,
+    size_t subblocks,
+    unsigned repeat,
+    unsigned char* copy,
+    size_t copy_size,
+    measurement* result)
+{
+    int ok = 0;
+    lcj_reader* reader = NULL;
+    lcj_statistics statistics;
+
+    double start = now_seconds();
+    for (unsigned i = 0; i < repeat; ++i) {
+        if (!check(
+                lcj_reader_open_utf8(path, &reader),
+                "lcj_reader_open_utf8") ||
+            !check(
+                lcj_reader_statistics(reader, &statistics),
+                "lcj_reader_statistics")) {
+            goto cleanup;
+        }
+        lcj_reader_close(reader);
+        reader = NULL;
+    }
+    result->open_seconds = (now_seconds() - start) / repeat;
+
+    if (!check(lcj_reader_open_utf8(path, &reader), "lcj_reader_open_utf8")) {
+        goto cleanup;
+    }
+
+    start = now_seconds();
+    for (unsigned pass = 0; pass < repeat; ++pass) {
+        for (size_t i = 0; i < subblocks; ++i) {
+            lcj_subblock_info info;
+            if (!check(
+                    lcj_reader_subblock_info(reader, (int32_t)i, &info),
+                    "lcj_reader_subblock_info")) {
+                goto cleanup;
+            }
+        }
+    }
+    result->info_seconds = (now_seconds() - start) / repeat;
+
+    for (size_t i = 0; i < subblocks; ++i) {
+        lcj_bitmap* bitmap = NULL;
+        lcj_bitmap_info info;
+        const double decode_start = now_seconds();
+        if (!check(
+                lcj_reader_read_subblock_bitmap(reader, (int32_t)i, &bitmap),
+                "lcj_reader_read_subblock_bitmap")) {
+            goto cleanup;
+        }
+        const double copy_start = now_seconds();
+        result->decode_seconds += copy_start - decode_start;
+
+        const int copied =
+            check(lcj_bitmap_get_info(bitmap, &info), "lcj_bitmap_get_info") &&
+            check(
+                lcj_bitmap_copy(
+                    bitmap,
+                    copy,
+                    copy_size,
+                    (size_t)info.row_bytes),
+                "lcj_bitmap_copy");
+        result->copy_seconds += now_seconds() - copy_start;
+        lcj_bitmap_close(bitmap);
+        if (!copied) {
+            goto cleanup;
+        }
+        result->decoded_bytes += info.row_bytes * info.height;
+    }
+    ok = 1;
+
+cleanup:
+    lcj_reader_close(reader);
+    return ok;
+}
+
+static double rate(double amount, double seconds)
+{
+    return seconds > 0.0 ? amount / seconds : 0.0;
+}
+
+static int run_case(
+    const settings* options,
+    const pixel_format* format,
+    const compression_format* compression,
+    uint32_t size,
+    size_t subblocks,
+    int first)
+{
+    char path[4096];
+    measurement result;
+    memset(&result, 0, sizeof(result));
+    snprintf(
+        path,
+        sizeof(path),
+        "%s/lcj_bench_%s_%s_%" PRIu32 "_%zu.czi",
+        options->directory,
+        format->name,
+        compression->name,
+        size,
+        subblocks);
+
+    const size_t tile_size = (size_t)size * size * format->bytes_per_pixel;
+    unsigned char* tile = malloc(tile_size);
+    unsigned char* copy = malloc(tile_size);
+    const int ok = tile != NULL && copy != NULL &&
+        write_fixture(
+            path,
+            format,
+            compression,
+            size,
+            subblocks,
+            tile,
+            &result) &&
+        measure_reads(
+            path,
+            subblocks,
+            options->repeat,
+            copy,
+            tile_size,
+            &result);
+    free(copy);
+    free(tile);
+    if (!options->keep) {
+        remove(path);
+    }
+    if (!ok) {
+        fprintf(stderr, "benchmark case %s failed\n", path);
+        return 0;
+    }
+
+    printf(
+        "%s    {\"pixel_type\": \"%s\", \"compression\": \"%s\", "
+        "\"tile_size\": %" PRIu32 ", \"subblocks\": %zu, "
+        "\"file_bytes\": %" PRIu64 ", \"write_s\": %.6f, "
+        "\"open_ms\": %.4f, \"subblock_info_per_s\": %.1f, "
+        "\"decode_mb_per_s\": %.2f, \"copy_gb_per_s\": %.3f}",
+        first ? "" : ",\n",
+        format->name,
+        compression->name,
+        size,
+        subblocks,
+        result.file_bytes,
+        result.write_seconds,
+        result.open_seconds * 1e3,
+        rate((double)subblocks, result.info_seconds),
+        rate((double)result.decoded_bytes * 1e-6, result.decode_seconds),
+        rate((double)result.decoded_bytes * 1e-9, result.copy_seconds));
+    fflush(stdout);
+    return 1;
+}
+
+/*
+ * Copy the next comma-separated item of `*list` into `item` and advance.
+ */
+static int next_item(const char** list, char* item, size_t capacity)
+{
+    const char* start = *list;
+    if (*start == '\0') {
+        return 0;
+    }
+    const char* end = strchr(start, ',');
+    const size_t length = end == NULL ? strlen(start) : (size_t)(end - start);
+    if (length == 0 || length >= capacity) {
+        return -1;
+    }
+    memcpy(item, start, length);
+    item[length] = '\0';
+    *list = end == NULL ? start + length : end + 1;
+    return 1;
+}
+
+static int parse_settings(int argc, char** argv, settings* options)
+{
+    const char* pixels = "gray8,gray16,bgr24";
+    const char* compressions = "none,zstd0,zstd1";
+    const char* tile_sizes = "256,1024";
+    const char* subblock_counts = "256";
+    options->repeat = 3;
+    options->directory = ".";
+
+    for (int i = 1; i < argc; ++i) {
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--keep") == 0) {
+            options->keep = 1;
+            continue;
+        }
+        if (value == NULL) {
+            return 0;
+        }
+        if (strcmp(argv[i], "--pixel-types") == 0) {
+            pixels = value;
+        }
+        else if (strcmp(argv[i], "--compressions") == 0) {
+            compressions = value;
+        }
+        else if (strcmp(argv[i], "--tile-sizes") == 0) {
+            tile_sizes = value;
+        }
+        else if (strcmp(argv[i], "--subblocks") == 0) {
+            subblock_counts = value;
+        }
+        else if (strcmp(argv[i], "--repeat") == 0) {
+            options->repeat = (unsigned)strtoul(value, NULL, 10);
+        }
+        else if (strcmp(argv[i], "--dir") == 0) {
+            options->directory = value;
+        }
+        else {
+            return 0;
+        }
+        ++i;
+    }
+
+    char item[32];
+    int found = 0;
+    while ((found = next_item(&pixels, item, sizeof(item))) > 0) {
+        const size_t known = sizeof(pixel_formats) / sizeof(pixel_formats[0]);
+        size_t k = 0;
+        while (k < known && strcmp(item, pixel_formats[k].name) != 0) {
+            ++k;
+        }
+        if (k == known || options->pixel_count == MAX_LIST) {
+            return 0;
+        }
+        options->pixels[options->pixel_count++] = &pixel_formats[k];
+    }
+    if (found < 0) {
+        return 0;
+    }
+    while ((found = next_item(&compressions, item, sizeof(item))) > 0) {
+        const size_t known =
+            sizeof(compression_formats) / sizeof(compression_formats[0]);
+        size_t k = 0;
+        while (k < known && strcmp(item, compression_formats[k].name) != 0) {
+            ++k;
+        }
+        if (k == known || options->compression_count == MAX_LIST) {
+            return 0;
+        }
+        options->compressions[options->compression_count++] =
+            &compression_formats[k];
+    }
+    if (found < 0) {
+        return 0;
+    }
+    while ((found = next_item(&tile_sizes, item, sizeof(item))) > 0) {
+        const unsigned long size = strtoul(item, NULL, 10);
+        if (size == 0 || size > 65536u ||
+            options->tile_size_count == MAX_LIST) {
+            return 0;
+        }
+        options->tile_sizes[options->tile_size_count++] = (uint32_t)size;
+    }
+    if (found < 0) {
+        return 0;
+    }
+    while ((found = next_item(&subblock_counts, item, sizeof(item))) > 0) {
+        const unsigned long long count = strtoull(item, NULL, 10);
+        if (count == 0 || count > 2147483647ull ||
+            options->subblock_count_count == MAX_LIST) {
+            return 0;
+        }
+        options->subblock_counts[options->subblock_count_count++] =
+            (size_t)count;
+    }
+    return found == 0 && options->repeat != 0 && options->pixel_count != 0 &&
+        options->compression_count != 0 && options->tile_size_count != 0 &&
+        options->subblock_count_count != 0;
+}
+
+int main(int argc, char** argv)
+{
+    settings options;
+    memset(&options, 0, sizeof(options));
+    if (!parse_settings(argc, argv, &options)) {
+        fprintf(
+            stderr,
+            "usage: %s [--pixel-types gray8,gray16,gray32f,bgr24,bgr48]\n"
+            "          [--compressions none,zstd0,zstd1]\n"
+            "          [--tile-sizes 256,1024] [--subblocks 256,1000000]\n"
+            "          [--repeat 3] [--dir DIRECTORY] [--keep]\n",
+            argv[0]);
+        return 2;
+    }
+
+    lcj_version abi;
+    lcj_version libczi;
+    if (!check(lcj_abi_version(&abi), "lcj_abi_version") ||
+        !check(lcj_libczi_version(&libczi), "lcj_libczi_version")) {
+        return 1;
+    }
+    printf(
+        "{\n  \"abi\": \"%u.%u\",\n  \"libczi\": \"%u.%u.%u\",\n"
+        "  \"repeat\": %u,\n  \"cases\": [\n",
+        abi.major,
+        abi.minor,
+        libczi.major,
+        libczi.minor,
+        libczi.patch,
+        options.repeat);
+
+    int first = 1;
+    for (size_t p = 0; p < options.pixel_count; ++p) {
+        for (size_t c = 0; c < options.compression_count; ++c) {
+            for (size_t t = 0; t < options.tile_size_count; ++t) {
+                for (size_t n = 0; n < options.subblock_count_count; ++n) {
+                    if (!run_case(
+                            &options,
+                            options.pixels[p],
+                            options.compressions[c],
+                            options.tile_sizes[t],
+                            options.subblock_counts[n],
+                            first)) {
+                        // Keep the document parseable; details are on
+                        // stderr.
+                        printf(
+                            "\n  ],\n  \"error\": {\"pixel_type\": \"%s\", "
+                            "\"compression\": \"%s\", "
+                            "\"tile_size\": %" PRIu32 ", "
+                            "\"subblocks\": %zu}\n}\n",
+                            options.pixels[p]->name,
+                            options.compressions[c]->name,
+                            options.tile_sizes[t],
+                            options.subblock_counts[n]);
+                        return 1;
+                    }
+                    first = 0;
+                }
+            }
+        }
+    }
+
+    printf("\n  ]\n}\n");
+    return 0;
+}
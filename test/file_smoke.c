@@ -3,6 +3,7 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static int check(lcj_status status, const char* operation)
 {
@@ -19,6 +20,915 @@ static int check(lcj_status status, const char* operation)
     return 0;
 }
 
+static int check_stream(
+    const char* path,
+    lcj_stream_kind stream,
+    const void* expected,
+    size_t size,
+    size_t row_stride)
+{
+    int ok = 0;
+    lcj_reader* reader = NULL;
+    void* pixels = malloc(size);
+    if (pixels == NULL) {
+        fprintf(stderr, "failed to allocate %zu decoded bytes\n", size);
+        return 0;
+    }
+
+    lcj_reader_options options;
+    memset(&options, 0, sizeof(options));
+    options.stream = (uint32_t)stream;
+    if (check(
+            lcj_reader_open_utf8_ex(path, &options, &reader),
+            "lcj_reader_open_utf8_ex") &&
+        check(
+            lcj_reader_read_subblock_into(reader, 0, pixels, size, row_stride),
+            "lcj_reader_read_subblock_into")) {
+        ok = memcmp(pixels, expected, size) == 0;
+        if (!ok) {
+            fprintf(
+                stderr,
+                "stream kind %d decodes differently\n",
+                (int)stream);
+        }
+    }
+
+    lcj_reader_close(reader);
+    free(pixels);
+    return ok;
+}
+
+static int check_memory(
+    const char* path,
+    const void* expected,
+    size_t size,
+    size_t row_stride)
+{
+    int ok = 0;
+    lcj_reader* reader = NULL;
+    unsigned char* file = NULL;
+    void* pixels = NULL;
+    size_t file_size = 0;
+
+    FILE* stream = fopen(path, "rb");
+    if (stream == NULL) {
+        fprintf(stderr, "failed to open %s\n", path);
+        return 0;
+    }
+    for (;;) {
+        unsigned char* grown = realloc(file, file_size + 65536u);
+        if (grown == NULL) {
+            fprintf(stderr, "failed to buffer %s\n", path);
+            goto cleanup;
+        }
+        file = grown;
+        const size_t bytes = fread(file + file_size, 1, 65536u, stream);
+        file_size += bytes;
+        if (bytes < 65536u) {
+            break;
+        }
+    }
+
+    pixels = malloc(size);
+    if (pixels == NULL) {
+        fprintf(stderr, "failed to allocate %zu decoded bytes\n", size);
+        goto cleanup;
+    }
+
+    if (check(
+            lcj_reader_open_memory(file, file_size, &reader),
+            "lcj_reader_open_memory") &&
+        check(
+            lcj_reader_read_subblock_into(reader, 0, pixels, size, row_stride),
+            "lcj_reader_read_subblock_into")) {
+        ok = memcmp(pixels, expected, size) == 0;
+        if (!ok) {
+            fprintf(stderr, "in-memory reader decodes differently\n");
+        }
+    }
+
+cleanup:
+    lcj_reader_close(reader);
+    free(pixels);
+    free(file);
+    fclose(stream);
+    return ok;
+}
+
+static int check_shared(
+    const char* path,
+    const void* expected,
+    size_t size,
+    size_t row_stride)
+{
+    int ok = 0;
+    lcj_reader* first = NULL;
+    lcj_reader* second = NULL;
+    void* pixels = malloc(size);
+    if (pixels == NULL) {
+        fprintf(stderr, "failed to allocate %zu decoded bytes\n", size);
+        return 0;
+    }
+
+    lcj_reader_options options;
+    memset(&options, 0, sizeof(options));
+    options.shared = 1;
+    lcj_reader_metrics metrics;
+    if (!check(
+            lcj_reader_open_utf8_ex(path, &options, &first),
+            "lcj_reader_open_utf8_ex") ||
+        !check(
+            lcj_reader_open_utf8_ex(path, &options, &second),
+            "lcj_reader_open_utf8_ex") ||
+        !check(lcj_reader_reset_metrics(first), "lcj_reader_reset_metrics") ||
+        !check(
+            lcj_reader_read_subblock_into(second, 0, pixels, size, row_stride),
+            "lcj_reader_read_subblock_into") ||
+        !check(
+            lcj_reader_get_metrics(first, &metrics),
+            "lcj_reader_get_metrics")) {
+        goto cleanup;
+    }
+    if (memcmp(pixels, expected, size) != 0 || metrics.stream_reads == 0) {
+        fprintf(stderr, "pooled readers do not share one parsed file\n");
+        goto cleanup;
+    }
+
+    // The first handle must stay usable after the second is closed.
+    lcj_reader_close(second);
+    second = NULL;
+    memset(pixels, 0, size);
+    ok = check(
+             lcj_reader_read_subblock_into(first, 0, pixels, size, row_stride),
+             "lcj_reader_read_subblock_into") &&
+        memcmp(pixels, expected, size) == 0;
+    if (!ok) {
+        fprintf(stderr, "pooled reader broke when its twin closed\n");
+    }
+
+cleanup:
+    lcj_reader_close(second);
+    lcj_reader_close(first);
+    lcj_reader_pool_set_idle_capacity(0);
+    free(pixels);
+    return ok;
+}
+
+static int check_scan(lcj_reader* reader, size_t subblock_count)
+{
+    int ok = 0;
+    lcj_scan* scan = NULL;
+    lcj_bitmap* bitmap = NULL;
+    int32_t* plan = calloc(subblock_count, sizeof(*plan));
+    if (plan == NULL) {
+        fprintf(stderr, "failed to allocate the scan plan\n");
+        return 0;
+    }
+
+    size_t planned = 0;
+    if (!check(
+            lcj_reader_plan_scan(reader, NULL, plan, subblock_count, &planned),
+            "lcj_reader_plan_scan")) {
+        goto cleanup;
+    }
+    if (planned != subblock_count) {
+        fprintf(stderr, "scan plan does not cover every subblock\n");
+        goto cleanup;
+    }
+
+    const size_t visited = planned < 8 ? planned : 8;
+    if (!check(
+            lcj_scan_open(reader, plan, visited, 4, &scan),
+            "lcj_scan_open")) {
+        goto cleanup;
+    }
+    for (size_t i = 0;; ++i) {
+        int32_t native_index = -1;
+        if (!check(
+                lcj_scan_next(scan, &native_index, &bitmap),
+                "lcj_scan_next")) {
+            goto cleanup;
+        }
+        if (native_index < 0) {
+            ok = i == visited && bitmap == NULL;
+            break;
+        }
+        if (i >= visited || native_index != plan[i] || bitmap == NULL) {
+            break;
+        }
+        lcj_bitmap_close(bitmap);
+        bitmap = NULL;
+    }
+    if (!ok) {
+        fprintf(stderr, "scan did not follow its plan\n");
+    }
+
+cleanup:
+    lcj_bitmap_close(bitmap);
+    lcj_scan_close(scan);
+    free(plan);
+    return ok;
+}
+
+static int check_query(
+    lcj_reader* reader,
+    size_t subblock_count,
+    const lcj_plane_coordinate* plane,
+    const lcj_rect_i32* roi)
+{
+    int ok = 0;
+    size_t total = 0;
+    if (lcj_reader_query_subblocks(reader, NULL, NULL, -1, NULL, 0, &total) !=
+            LCJ_BUFFER_TOO_SMALL ||
+        total != subblock_count) {
+        fprintf(stderr, "unfiltered query does not report every subblock\n");
+        return 0;
+    }
+
+    int32_t* matches = calloc(subblock_count, sizeof(*matches));
+    if (matches == NULL) {
+        fprintf(stderr, "failed to allocate the query result\n");
+        return 0;
+    }
+
+    size_t found = 0;
+    if (!check(
+            lcj_reader_query_subblocks(
+                reader,
+                plane,
+                roi,
+                -1,
+                matches,
+                subblock_count,
+                &found),
+            "lcj_reader_query_subblocks")) {
+        goto cleanup;
+    }
+    if (found == 0 || matches[0] != 0) {
+        fprintf(stderr, "query missed the subblock covering its rect\n");
+        goto cleanup;
+    }
+    ok = 1;
+
+cleanup:
+    free(matches);
+    return ok;
+}
+
+static int check_hyperslab(
+    lcj_reader* reader,
+    const lcj_plane_coordinate* plane,
+    const lcj_rect_i32* roi,
+    lcj_pixel_type pixel_type,
+    const void* expected,
+    size_t plane_bytes,
+    size_t row_stride)
+{
+    lcj_dim_bounds channels;
+    if (!check(
+            lcj_reader_dimension_bounds(reader, LCJ_DIM_C, &channels),
+            "lcj_reader_dimension_bounds")) {
+        return 0;
+    }
+
+    /* One plane per channel, stacked like a Julia (x, y, c) array. */
+    lcj_hyperslab_range range;
+    memset(&range, 0, sizeof(range));
+    range.dimension = LCJ_DIM_C;
+    range.start = channels.start;
+    range.size = channels.present ? channels.size : 1;
+    range.stride = plane_bytes;
+    const size_t range_count = channels.present ? 1u : 0u;
+    const size_t slot =
+        channels.present && (plane->coordinate_mask & (1u << LCJ_DIM_C))
+            ? (size_t)(plane->coordinate[LCJ_DIM_C] - channels.start)
+            : 0u;
+
+    const size_t stack_bytes = plane_bytes * (size_t)range.size;
+    unsigned char* stack = malloc(stack_bytes);
+    if (stack == NULL) {
+        fprintf(stderr, "failed to allocate %zu stack bytes\n", stack_bytes);
+        return 0;
+    }
+
+    int ok = check(
+        lcj_reader_read_hyperslab(
+            reader,
+            plane,
+            &range,
+            range_count,
+            roi,
+            pixel_type,
+            NULL,
+            0,
+            stack,
+            stack_bytes,
+            row_stride),
+        "lcj_reader_read_hyperslab");
+    if (ok && memcmp(stack + slot * plane_bytes, expected, plane_bytes) != 0) {
+        fprintf(stderr, "hyperslab plane disagrees with the plane read\n");
+        ok = 0;
+    }
+
+    free(stack);
+    return ok;
+}
+
+static int check_converted(
+    lcj_bitmap* bitmap,
+    const lcj_bitmap_info* info,
+    const unsigned char* pixels)
+{
+    lcj_copy_options options;
+    memset(&options, 0, sizeof(options));
+    size_t target_bytes = 0;
+    switch (info->pixel_type) {
+    case LCJ_PIXEL_GRAY8:
+        options.format = LCJ_COPY_UINT16;
+        target_bytes = 2;
+        break;
+    case LCJ_PIXEL_GRAY16:
+        options.format = LCJ_COPY_FLOAT32;
+        options.scale = 1.0f;
+        target_bytes = 4;
+        break;
+    case LCJ_PIXEL_BGR24:
+        options.format = LCJ_COPY_RGB;
+        target_bytes = 3;
+        break;
+    default:
+        return 1;
+    }
+
+    const size_t stride = (size_t)info->width * target_bytes;
+    const size_t size = stride * (info->height == 0 ? 1u : info->height);
+    unsigned char* converted = malloc(size);
+    if (converted == NULL) {
+        fprintf(stderr, "failed to allocate %zu converted bytes\n", size);
+        return 0;
+    }
+
+    int ok = check(
+        lcj_bitmap_copy_converted(bitmap, &options, converted, size, stride),
+        "lcj_bitmap_copy_converted");
+    for (uint32_t y = 0; ok && y < info->height; ++y) {
+        const unsigned char* row = pixels + (size_t)y * info->row_bytes;
+        const unsigned char* out = converted + (size_t)y * stride;
+        for (uint32_t x = 0; ok && x < info->width; ++x) {
+            uint16_t sample16;
+            float sample32;
+            switch (info->pixel_type) {
+            case LCJ_PIXEL_GRAY8:
+                memcpy(&sample16, out + 2u * x, sizeof(sample16));
+                ok = sample16 == row[x];
+                break;
+            case LCJ_PIXEL_GRAY16:
+                memcpy(&sample16, row + 2u * x, sizeof(sample16));
+                memcpy(&sample32, out + 4u * x, sizeof(sample32));
+                ok = sample32 == (float)sample16;
+                break;
+            default:
+                ok = out[3u * x] == row[3u * x + 2u] &&
+                    out[3u * x + 1u] == row[3u * x + 1u] &&
+                    out[3u * x + 2u] == row[3u * x];
+                break;
+            }
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "converted copy disagrees with the native copy\n");
+    }
+
+    free(converted);
+    return ok;
+}
+
+static int check_binned(
+    lcj_bitmap* bitmap,
+    const lcj_bitmap_info* info,
+    const unsigned char* pixels)
+{
+    lcj_bin_options options;
+    memset(&options, 0, sizeof(options));
+    options.factor = 1;
+    options.mode = LCJ_BIN_MEAN;
+    lcj_bin_layout same;
+    lcj_bin_layout summed;
+    if (!check(
+            lcj_bitmap_binned_layout(bitmap, &options, &same),
+            "lcj_bitmap_binned_layout")) {
+        return 0;
+    }
+    options.factor = 2;
+    options.mode = LCJ_BIN_SUM;
+    if (!check(
+            lcj_bitmap_binned_layout(bitmap, &options, &summed),
+            "lcj_bitmap_binned_layout")) {
+        return 0;
+    }
+    if (same.width != info->width || same.height != info->height ||
+        same.row_bytes != info->row_bytes ||
+        summed.width != (info->width + 1u) / 2u ||
+        summed.height != (info->height + 1u) / 2u ||
+        summed.sample_bytes != 4 ||
+        summed.samples_per_pixel != same.samples_per_pixel) {
+        fprintf(stderr, "binned layout is wrong\n");
+        return 0;
+    }
+
+    const size_t size = (size_t)info->row_bytes * info->height +
+        (size_t)summed.row_bytes * summed.height;
+    unsigned char* binned = malloc(size == 0 ? 1 : size);
+    if (binned == NULL) {
+        fprintf(stderr, "failed to allocate %zu binned bytes\n", size);
+        return 0;
+    }
+    unsigned char* sums = binned + (size_t)info->row_bytes * info->height;
+
+    options.factor = 1;
+    options.mode = LCJ_BIN_MEAN;
+    int ok = check(
+        lcj_bitmap_copy_binned(
+            bitmap,
+            &options,
+            binned,
+            (size_t)info->row_bytes * info->height,
+            (size_t)info->row_bytes),
+        "lcj_bitmap_copy_binned");
+    if (ok &&
+        memcmp(binned, pixels, (size_t)info->row_bytes * info->height) != 0) {
+        fprintf(stderr, "binning by 1 disagrees with the native copy\n");
+        ok = 0;
+    }
+
+    options.factor = 2;
+    options.mode = LCJ_BIN_SUM;
+    ok = ok &&
+        check(
+            lcj_bitmap_copy_binned(
+                bitmap,
+                &options,
+                sums,
+                (size_t)summed.row_bytes * summed.height,
+                (size_t)summed.row_bytes),
+            "lcj_bitmap_copy_binned");
+    if (ok && info->pixel_type == LCJ_PIXEL_GRAY8 && info->width >= 2 &&
+        info->height >= 2) {
+        uint32_t sum;
+        memcpy(&sum, sums, sizeof(sum));
+        const unsigned char* below = pixels + info->row_bytes;
+        if (sum != (uint32_t)pixels[0] + pixels[1] + below[0] + below[1]) {
+            fprintf(stderr, "binned sum disagrees with the native copy\n");
+            ok = 0;
+        }
+    }
+
+    free(binned);
+    return ok;
+}
+
+static int check_composite(
+    lcj_reader* reader,
+    const lcj_plane_coordinate* plane,
+    const lcj_rect_i32* roi,
+    const lcj_subblock_info* subblock,
+    const unsigned char* expected,
+    size_t expected_stride)
+{
+    size_t display_count = 0;
+    const lcj_status settings =
+        lcj_reader_display_settings(reader, NULL, 0, &display_count);
+    if (settings != LCJ_OK && settings != LCJ_BUFFER_TOO_SMALL &&
+        settings != LCJ_UNSUPPORTED) {
+        return check(settings, "lcj_reader_display_settings");
+    }
+
+    /* A single linear, untinted gray channel reproduces its samples. */
+    lcj_channel_display display;
+    memset(&display, 0, sizeof(display));
+    display.channel = (subblock->coordinate_mask & (1u << LCJ_DIM_C))
+        ? subblock->coordinate[LCJ_DIM_C]
+        : 0;
+    display.weight = 1.0f;
+    display.white_point = 1.0f;
+    display.gamma = 1.0f;
+
+    const size_t stride = (size_t)roi->width * 3u;
+    const size_t size = stride * (size_t)roi->height;
+    unsigned char* composite = malloc(size);
+    if (composite == NULL) {
+        fprintf(stderr, "failed to allocate %zu composite bytes\n", size);
+        return 0;
+    }
+
+    int ok = check(
+        lcj_reader_read_composite(
+            reader,
+            plane,
+            roi,
+            1.0f,
+            &display,
+            1,
+            LCJ_PIXEL_BGR24,
+            NULL,
+            composite,
+            size,
+            stride),
+        "lcj_reader_read_composite");
+    /* Allow for rounding in libCZI's 8-bit display mapping. */
+    const int check_pixels = subblock->pixel_type == LCJ_PIXEL_GRAY8;
+    for (int32_t y = 0; ok && check_pixels && y < roi->height; ++y) {
+        for (int32_t x = 0; ok && x < roi->width; ++x) {
+            const int gray = expected[(size_t)y * expected_stride + (size_t)x];
+            const unsigned char* pixel =
+                composite + (size_t)y * stride + 3u * (size_t)x;
+            for (int i = 0; i < 3; ++i) {
+                ok = ok && abs((int)pixel[i] - gray) <= 1;
+            }
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "gray composite disagrees with the plane read\n");
+    }
+
+    free(composite);
+    return ok;
+}
+
+static int check_attachments(lcj_reader* reader)
+{
+    size_t count = 0;
+    const lcj_status listed =
+        lcj_reader_attachment_directory(reader, NULL, 0, &count);
+    if (listed == LCJ_OK && count == 0) {
+        return 1;
+    }
+    if (listed != LCJ_BUFFER_TOO_SMALL) {
+        return check(listed, "lcj_reader_attachment_directory");
+    }
+
+    int ok = 0;
+    unsigned char* payload = NULL;
+    lcj_attachment_info* entries = calloc(count, sizeof(*entries));
+    if (entries == NULL) {
+        fprintf(stderr, "failed to allocate the attachment directory\n");
+        return 0;
+    }
+
+    if (!check(
+            lcj_reader_attachment_directory(reader, entries, count, &count),
+            "lcj_reader_attachment_directory")) {
+        goto cleanup;
+    }
+
+    int32_t found = -1;
+    if (!check(
+            lcj_reader_find_attachment(
+                reader,
+                entries[0].content_file_type,
+                entries[0].name,
+                &found),
+            "lcj_reader_find_attachment")) {
+        goto cleanup;
+    }
+    if (found != entries[0].index) {
+        fprintf(stderr, "attachment lookup by name failed\n");
+        goto cleanup;
+    }
+
+    payload = malloc(entries[0].data_size == 0 ? 1u : entries[0].data_size);
+    if (payload == NULL) {
+        fprintf(stderr, "failed to allocate the attachment payload\n");
+        goto cleanup;
+    }
+    ok = check(
+        lcj_reader_attachment_copy(
+            reader,
+            entries[0].index,
+            payload,
+            (size_t)entries[0].data_size),
+        "lcj_reader_attachment_copy");
+
+cleanup:
+    free(payload);
+    free(entries);
+    return ok;
+}
+
+static int check_document(lcj_reader* reader)
+{
+    lcj_scaling scaling;
+    if (!check(lcj_reader_scaling(reader, &scaling), "lcj_reader_scaling")) {
+        return 0;
+    }
+
+    int32_t channel_count = 0;
+    if (!check(
+            lcj_reader_channel_count(reader, &channel_count),
+            "lcj_reader_channel_count")) {
+        return 0;
+    }
+    for (int32_t channel = 0; channel < channel_count; ++channel) {
+        lcj_channel_info info;
+        char name[256];
+        size_t length = 0;
+        if (!check(
+                lcj_reader_channel_info(reader, channel, &info),
+                "lcj_reader_channel_info")) {
+            return 0;
+        }
+        if (info.name_length < sizeof(name) &&
+            (!check(
+                 lcj_reader_channel_name(
+                     reader,
+                     channel,
+                     name,
+                     sizeof(name),
+                     &length),
+                 "lcj_reader_channel_name") ||
+                length != info.name_length || strlen(name) != length)) {
+            fprintf(stderr, "channel name length disagrees\n");
+            return 0;
+        }
+    }
+
+    size_t scene_count = 0;
+    const lcj_status scenes =
+        lcj_reader_scenes(reader, NULL, 0, &scene_count);
+    if (scenes != LCJ_OK && scenes != LCJ_BUFFER_TOO_SMALL) {
+        return check(scenes, "lcj_reader_scenes");
+    }
+    return 1;
+}
+
+static int check_writer(
+    const lcj_bitmap_info* info,
+    const unsigned char* pixels)
+{
+    static const char path[] = "file_smoke_writer.czi";
+    static const char note[] = "written by file_smoke";
+    const size_t size = (size_t)info->row_bytes * info->height;
+    int ok = 0;
+    int32_t attachment = -1;
+    lcj_writer* writer = NULL;
+    lcj_reader* reader = NULL;
+    lcj_status closed = LCJ_INTERNAL_ERROR;
+    unsigned char* decoded = malloc(size == 0 ? 1u : size);
+    if (decoded == NULL) {
+        fprintf(stderr, "failed to allocate %zu decoded bytes\n", size);
+        return 0;
+    }
+
+    lcj_writer_options options;
+    memset(&options, 0, sizeof(options));
+    options.compression = LCJ_COMPRESSION_ZSTD1;
+    options.overwrite = 1;
+
+    lcj_subblock_write subblock;
+    memset(&subblock, 0, sizeof(subblock));
+    subblock.plane.coordinate_mask = (uint16_t)(1u << LCJ_DIM_C);
+    subblock.pixel_type = info->pixel_type;
+    subblock.logical_rect.width = (int32_t)info->width;
+    subblock.logical_rect.height = (int32_t)info->height;
+    subblock.physical_width = info->width;
+    subblock.physical_height = info->height;
+
+    lcj_guid guid;
+    memset(&guid, 0, sizeof(guid));
+    guid.data1 = 0x6c636a31u;
+
+    if (!check(
+            lcj_writer_open_utf8(path, &options, &writer),
+            "lcj_writer_open_utf8") ||
+        !check(
+            lcj_writer_add_subblock(
+                writer,
+                &subblock,
+                pixels,
+                size,
+                (size_t)info->row_bytes),
+            "lcj_writer_add_subblock") ||
+        !check(
+            lcj_writer_add_attachment(
+                writer,
+                &guid,
+                "TXT",
+                "Note",
+                note,
+                sizeof(note)),
+            "lcj_writer_add_attachment")) {
+        goto cleanup;
+    }
+
+    closed = lcj_writer_close(writer);
+    writer = NULL;
+    if (!check(closed, "lcj_writer_close") ||
+        !check(lcj_reader_open_utf8(path, &reader), "lcj_reader_open_utf8") ||
+        !check(
+            lcj_reader_read_subblock_into(
+                reader,
+                0,
+                decoded,
+                size,
+                (size_t)info->row_bytes),
+            "lcj_reader_read_subblock_into") ||
+        !check(
+            lcj_reader_find_attachment(reader, "TXT", "Note", &attachment),
+            "lcj_reader_find_attachment")) {
+        goto cleanup;
+    }
+
+    ok = attachment == 0 && memcmp(decoded, pixels, size) == 0;
+    if (!ok) {
+        fprintf(stderr, "written CZI reads back differently\n");
+    }
+
+cleanup:
+    lcj_writer_close(writer);
+    lcj_reader_close(reader);
+    free(decoded);
+    remove(path);
+    return ok;
+}
+
+static int check_transcode(
+    const char* path,
+    lcj_reader* source,
+    size_t subblock_count)
+{
+    static const char copy_path[] = "file_smoke_transcode.czi";
+    int ok = 0;
+    size_t count = 0;
+    lcj_reader* copy = NULL;
+    lcj_bitmap* expected = NULL;
+    lcj_bitmap* actual = NULL;
+    const unsigned char* expected_pixels = NULL;
+    const unsigned char* actual_pixels = NULL;
+    size_t expected_stride = 0;
+    size_t actual_stride = 0;
+    lcj_statistics statistics;
+    lcj_bitmap_info expected_info;
+    lcj_bitmap_info actual_info;
+    int32_t* order = calloc(subblock_count, sizeof(*order));
+    if (order == NULL) {
+        fprintf(stderr, "failed to allocate the scan plan\n");
+        return 0;
+    }
+
+    lcj_writer_options options;
+    memset(&options, 0, sizeof(options));
+    options.compression = LCJ_COMPRESSION_ZSTD1;
+    options.overwrite = 1;
+
+    /* The copy is in file order, so its subblock 0 is the first scanned. */
+    if (!check(
+            lcj_transcode_file(path, copy_path, &options),
+            "lcj_transcode_file") ||
+        !check(
+            lcj_reader_open_utf8(copy_path, &copy),
+            "lcj_reader_open_utf8") ||
+        !check(
+            lcj_reader_statistics(copy, &statistics),
+            "lcj_reader_statistics") ||
+        !check(
+            lcj_reader_plan_scan(source, NULL, order, subblock_count, &count),
+            "lcj_reader_plan_scan") ||
+        !check(
+            lcj_reader_read_subblock_bitmap(source, order[0], &expected),
+            "lcj_reader_read_subblock_bitmap") ||
+        !check(
+            lcj_reader_read_subblock_bitmap(copy, 0, &actual),
+            "lcj_reader_read_subblock_bitmap") ||
+        !check(
+            lcj_bitmap_get_info(expected, &expected_info),
+            "lcj_bitmap_get_info") ||
+        !check(
+            lcj_bitmap_get_info(actual, &actual_info),
+            "lcj_bitmap_get_info") ||
+        !check(
+            lcj_bitmap_lock(
+                expected,
+                (const void**)&expected_pixels,
+                &expected_stride),
+            "lcj_bitmap_lock") ||
+        !check(
+            lcj_bitmap_lock(
+                actual,
+                (const void**)&actual_pixels,
+                &actual_stride),
+            "lcj_bitmap_lock")) {
+        goto cleanup;
+    }
+
+    ok = (size_t)statistics.subblock_count == subblock_count &&
+        memcmp(&expected_info, &actual_info, sizeof(actual_info)) == 0;
+    for (uint32_t y = 0; ok && y < actual_info.height; ++y) {
+        ok = memcmp(
+                 expected_pixels + y * expected_stride,
+                 actual_pixels + y * actual_stride,
+                 (size_t)actual_info.row_bytes) == 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "transcoded CZI reads back differently\n");
+    }
+
+cleanup:
+    lcj_bitmap_close(actual);
+    lcj_bitmap_close(expected);
+    lcj_reader_close(copy);
+    free(order);
+    remove(copy_path);
+    return ok;
+}
+
+static int check_metrics(lcj_reader* reader, uint64_t bitmap_bytes)
+{
+    lcj_reader_metrics metrics;
+    if (!check(
+            lcj_reader_get_metrics(reader, &metrics),
+            "lcj_reader_get_metrics")) {
+        return 0;
+    }
+
+    uint64_t decoded = 0;
+    for (size_t i = 0; i < LCJ_COMPRESSION_SLOTS; ++i) {
+        decoded += metrics.decoded_subblocks[i];
+    }
+    if (metrics.stream_reads == 0 || metrics.stream_bytes == 0 ||
+        decoded == 0 || metrics.live_bitmap_bytes < bitmap_bytes ||
+        metrics.peak_bitmap_bytes < metrics.live_bitmap_bytes) {
+        fprintf(stderr, "reader metrics missed the reads so far\n");
+        return 0;
+    }
+
+    const uint64_t live = metrics.live_bitmap_bytes;
+    if (!check(
+            lcj_reader_reset_metrics(reader),
+            "lcj_reader_reset_metrics") ||
+        !check(
+            lcj_reader_get_metrics(reader, &metrics),
+            "lcj_reader_get_metrics")) {
+        return 0;
+    }
+    if (metrics.stream_reads != 0 || metrics.decode_nanoseconds != 0 ||
+        metrics.live_bitmap_bytes != live ||
+        metrics.peak_bitmap_bytes != live) {
+        fprintf(stderr, "reader metrics reset is wrong\n");
+        return 0;
+    }
+    return 1;
+}
+
+static int check_queue(
+    lcj_reader* reader,
+    const void* expected,
+    size_t size,
+    size_t row_stride)
+{
+    int ok = 0;
+    lcj_queue* queue = NULL;
+    void* pixels = malloc(size);
+    if (pixels == NULL) {
+        fprintf(stderr, "failed to allocate %zu decoded bytes\n", size);
+        return 0;
+    }
+
+    uint64_t request_id = 0;
+    lcj_completion completion;
+    size_t completed = 0;
+    if (check(lcj_queue_open(reader, 0, &queue), "lcj_queue_open") &&
+        check(
+            lcj_queue_submit(
+                queue,
+                LCJ_REQUEST_DECODE,
+                0,
+                pixels,
+                size,
+                row_stride,
+                42u,
+                &request_id),
+            "lcj_queue_submit") &&
+        check(
+            lcj_queue_poll(
+                queue,
+                &completion,
+                1,
+                LCJ_WAIT_FOREVER,
+                &completed),
+            "lcj_queue_poll")) {
+        ok = completed == 1 && completion.request_id == request_id &&
+            completion.user_data == 42u && completion.status == LCJ_OK &&
+            memcmp(pixels, expected, size) == 0;
+        if (!ok) {
+            fprintf(stderr, "queued decode disagrees with bitmap copy\n");
+        }
+    }
+
+    lcj_queue_close(queue);
+    free(pixels);
+    return ok;
+}
+
 int main(int argc, char** argv)
 {
     if (argc != 2) {
@@ -30,10 +940,17 @@ int main(int argc, char** argv)
     lcj_reader* reader = NULL;
     lcj_bitmap* bitmap = NULL;
     void* pixels = NULL;
+    void* direct_pixels = NULL;
+    void* overview = NULL;
+    void* raw = NULL;
+    lcj_subblock_directory_entry* directory = NULL;
 
+    lcj_reader_options options;
+    memset(&options, 0, sizeof(options));
+    options.cache_max_bytes = 64u << 20;
     if (!check(
-            lcj_reader_open_utf8(argv[1], &reader),
-            "lcj_reader_open_utf8")) {
+            lcj_reader_open_utf8_ex(argv[1], &options, &reader),
+            "lcj_reader_open_utf8_ex")) {
         goto cleanup;
     }
 
@@ -66,6 +983,33 @@ int main(int argc, char** argv)
         goto cleanup;
     }
 
+    directory = calloc(
+        (size_t)statistics.subblock_count,
+        sizeof(*directory));
+    if (directory == NULL) {
+        fprintf(stderr, "failed to allocate the subblock directory\n");
+        goto cleanup;
+    }
+
+    size_t directory_count = 0;
+    if (!check(
+            lcj_reader_subblock_directory(
+                reader,
+                0,
+                LCJ_DIRECTORY_STORED_SIZE,
+                directory,
+                (size_t)statistics.subblock_count,
+                &directory_count),
+            "lcj_reader_subblock_directory")) {
+        goto cleanup;
+    }
+    if (directory_count != (size_t)statistics.subblock_count ||
+        memcmp(&directory[0].info, &subblock, sizeof(subblock)) != 0 ||
+        directory[0].stored_size == 0) {
+        fprintf(stderr, "subblock directory disagrees with subblock info\n");
+        goto cleanup;
+    }
+
     if (!check(
             lcj_reader_read_subblock_bitmap(reader, 0, &bitmap),
             "lcj_reader_read_subblock_bitmap")) {
@@ -102,6 +1046,254 @@ int main(int argc, char** argv)
             "lcj_bitmap_copy")) {
         goto cleanup;
     }
+    if (!check_converted(bitmap, &bitmap_info, pixels) ||
+        !check_binned(bitmap, &bitmap_info, pixels) ||
+        !check_metrics(reader, pixel_bytes) ||
+        !check_writer(&bitmap_info, pixels)) {
+        goto cleanup;
+    }
+
+    const void* locked_pixels = NULL;
+    size_t locked_stride = 0;
+    if (!check(
+            lcj_bitmap_lock(bitmap, &locked_pixels, &locked_stride),
+            "lcj_bitmap_lock")) {
+        goto cleanup;
+    }
+    if (locked_stride < bitmap_info.row_bytes ||
+        (bitmap_info.height != 0 &&
+            memcmp(locked_pixels, pixels, (size_t)bitmap_info.row_bytes) !=
+                0)) {
+        fprintf(stderr, "locked bitmap view disagrees with bitmap copy\n");
+        goto cleanup;
+    }
+    if (!check(lcj_bitmap_unlock(bitmap), "lcj_bitmap_unlock")) {
+        goto cleanup;
+    }
+
+    direct_pixels = malloc(pixel_bytes);
+    if (direct_pixels == NULL) {
+        fprintf(stderr, "failed to allocate %zu decoded bytes\n", pixel_bytes);
+        goto cleanup;
+    }
+    if (!check(
+            lcj_reader_read_subblock_into(
+                reader,
+                0,
+                direct_pixels,
+                pixel_bytes,
+                (size_t)bitmap_info.row_bytes),
+            "lcj_reader_read_subblock_into")) {
+        goto cleanup;
+    }
+    if (memcmp(direct_pixels, pixels, pixel_bytes) != 0) {
+        fprintf(stderr, "direct subblock read disagrees with bitmap copy\n");
+        goto cleanup;
+    }
+
+    const int32_t batch_indices[2] = {0, 0};
+    void* const batch_destinations[2] = {pixels, direct_pixels};
+    const size_t batch_sizes[2] = {pixel_bytes, pixel_bytes};
+    const size_t batch_strides[2] = {
+        (size_t)bitmap_info.row_bytes,
+        (size_t)bitmap_info.row_bytes,
+    };
+    lcj_status batch_results[2] = {LCJ_INTERNAL_ERROR, LCJ_INTERNAL_ERROR};
+    if (!check(
+            lcj_reader_read_subblocks_into(
+                reader,
+                2,
+                batch_indices,
+                batch_destinations,
+                batch_sizes,
+                batch_strides,
+                0,
+                batch_results),
+            "lcj_reader_read_subblocks_into")) {
+        goto cleanup;
+    }
+    if (batch_results[0] != LCJ_OK || batch_results[1] != LCJ_OK ||
+        memcmp(direct_pixels, pixels, pixel_bytes) != 0) {
+        fprintf(stderr, "batch subblock reads disagree\n");
+        goto cleanup;
+    }
+
+    if (!check_stream(
+            argv[1],
+            LCJ_STREAM_PREAD,
+            pixels,
+            pixel_bytes,
+            (size_t)bitmap_info.row_bytes) ||
+        !check_stream(
+            argv[1],
+            LCJ_STREAM_MMAP,
+            pixels,
+            pixel_bytes,
+            (size_t)bitmap_info.row_bytes) ||
+        !check_memory(
+            argv[1],
+            pixels,
+            pixel_bytes,
+            (size_t)bitmap_info.row_bytes) ||
+        !check_shared(
+            argv[1],
+            pixels,
+            pixel_bytes,
+            (size_t)bitmap_info.row_bytes)) {
+        goto cleanup;
+    }
+
+    size_t raw_size = 0;
+    int32_t raw_compression = -1;
+    if (!check(
+            lcj_reader_subblock_raw_size(
+                reader,
+                0,
+                &raw_size,
+                &raw_compression),
+            "lcj_reader_subblock_raw_size")) {
+        goto cleanup;
+    }
+    raw = malloc(raw_size == 0 ? 1u : raw_size);
+    if (raw == NULL) {
+        fprintf(stderr, "failed to allocate %zu raw bytes\n", raw_size);
+        goto cleanup;
+    }
+    if (!check(
+            lcj_reader_subblock_raw_copy(reader, 0, raw, raw_size),
+            "lcj_reader_subblock_raw_copy")) {
+        goto cleanup;
+    }
+    if (raw_compression != subblock.compression_raw ||
+        (raw_compression == 0 &&
+            (raw_size < pixel_bytes ||
+                memcmp(raw, pixels, pixel_bytes) != 0))) {
+        fprintf(stderr, "raw subblock data disagrees with decoded data\n");
+        goto cleanup;
+    }
+
+    if (!check_queue(
+            reader,
+            pixels,
+            pixel_bytes,
+            (size_t)bitmap_info.row_bytes) ||
+        !check_scan(reader, (size_t)statistics.subblock_count) ||
+        !check_transcode(
+            argv[1],
+            reader,
+            (size_t)statistics.subblock_count) ||
+        !check_attachments(reader) ||
+        !check_document(reader)) {
+        goto cleanup;
+    }
+
+    lcj_cache_statistics cache;
+    if (!check(
+            lcj_reader_cache_statistics(reader, &cache),
+            "lcj_reader_cache_statistics")) {
+        goto cleanup;
+    }
+    if (subblock.compression_raw != 0 && cache.hits == 0) {
+        fprintf(stderr, "second decode of subblock 0 missed the cache\n");
+        goto cleanup;
+    }
+
+    lcj_plane_coordinate plane;
+    memset(&plane, 0, sizeof(plane));
+    plane.coordinate_mask = subblock.coordinate_mask;
+    memcpy(plane.coordinate, subblock.coordinate, sizeof(plane.coordinate));
+    if (!check_query(
+            reader,
+            (size_t)statistics.subblock_count,
+            &plane,
+            &subblock.logical_rect)) {
+        goto cleanup;
+    }
+    if ((uint32_t)subblock.logical_rect.width == bitmap_info.width &&
+        (uint32_t)subblock.logical_rect.height == bitmap_info.height &&
+        !check(
+            lcj_reader_read_plane_roi(
+                reader,
+                &plane,
+                &subblock.logical_rect,
+                (lcj_pixel_type)subblock.pixel_type,
+                NULL,
+                direct_pixels,
+                pixel_bytes,
+                (size_t)bitmap_info.row_bytes),
+            "lcj_reader_read_plane_roi")) {
+        goto cleanup;
+    }
+    if ((uint32_t)subblock.logical_rect.width == bitmap_info.width &&
+        (uint32_t)subblock.logical_rect.height == bitmap_info.height &&
+        !check_hyperslab(
+            reader,
+            &plane,
+            &subblock.logical_rect,
+            (lcj_pixel_type)subblock.pixel_type,
+            direct_pixels,
+            pixel_bytes,
+            (size_t)bitmap_info.row_bytes)) {
+        goto cleanup;
+    }
+    if ((uint32_t)subblock.logical_rect.width == bitmap_info.width &&
+        (uint32_t)subblock.logical_rect.height == bitmap_info.height &&
+        (subblock.pixel_type == LCJ_PIXEL_GRAY8 ||
+            subblock.pixel_type == LCJ_PIXEL_GRAY16) &&
+        !check_composite(
+            reader,
+            &plane,
+            &subblock.logical_rect,
+            &subblock,
+            direct_pixels,
+            (size_t)bitmap_info.row_bytes)) {
+        goto cleanup;
+    }
+
+    const int32_t longest_side =
+        statistics.bounding_box.width > statistics.bounding_box.height
+            ? statistics.bounding_box.width
+            : statistics.bounding_box.height;
+    const float zoom =
+        longest_side > 256 ? 256.0f / (float)longest_side : 1.0f;
+    uint32_t overview_width = 0;
+    uint32_t overview_height = 0;
+    if (!check(
+            lcj_reader_scaled_size(
+                reader,
+                &statistics.bounding_box,
+                zoom,
+                &overview_width,
+                &overview_height),
+            "lcj_reader_scaled_size")) {
+        goto cleanup;
+    }
+
+    /* 12 bytes per pixel covers the widest pixel type, BGR96 float. */
+    const size_t overview_stride =
+        (size_t)overview_width * 12u;
+    const size_t overview_bytes =
+        overview_stride * (overview_height == 0 ? 1u : overview_height);
+    overview = malloc(overview_bytes);
+    if (overview == NULL) {
+        fprintf(stderr, "failed to allocate the overview\n");
+        goto cleanup;
+    }
+    if (overview_width != 0 && overview_height != 0 &&
+        !check(
+            lcj_reader_read_plane_scaled(
+                reader,
+                &plane,
+                &statistics.bounding_box,
+                zoom,
+                LCJ_PIXEL_INVALID,
+                NULL,
+                overview,
+                overview_bytes,
+                overview_stride),
+            "lcj_reader_read_plane_scaled")) {
+        goto cleanup;
+    }
 
     printf(
         "subblocks=%" PRId32
@@ -114,6 +1306,10 @@ int main(int argc, char** argv)
     result = 0;
 
 cleanup:
+    free(raw);
+    free(overview);
+    free(directory);
+    free(direct_pixels);
     free(pixels);
     lcj_bitmap_close(bitmap);
     lcj_reader_close(reader);
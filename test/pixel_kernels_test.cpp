@@ -0,0 +1,323 @@
+#include "pixel_kernels.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+/*
+ * Every supported kernel set must match the scalar kernels for all widths
+ * around the vector block sizes and must not write past the row.
+ */
+constexpr size_t max_width = 70;
+constexpr size_t guard = 64;
+constexpr uint8_t sentinel = 0xA5;
+
+std::vector<uint8_t> source_row(size_t bytes, uint32_t seed = 11u)
+{
+    std::vector<uint8_t> row(bytes);
+    for (size_t i = 0; i < bytes; ++i) {
+        row[i] = static_cast<uint8_t>(i * 37u + seed);
+    }
+    return row;
+}
+
+// Small finite floats, so that sums and maxima are exact.
+std::vector<uint8_t> float_row(size_t count, uint32_t seed)
+{
+    std::vector<uint8_t> row(count * 4);
+    for (size_t i = 0; i < count; ++i) {
+        const auto step = static_cast<int>((i * 37u + seed) % 251u) - 125;
+        const float value = static_cast<float>(step) * 0.25f;
+        std::memcpy(row.data() + 4 * i, &value, sizeof(value));
+    }
+    return row;
+}
+
+bool guard_intact(const std::vector<uint8_t>& row, size_t used)
+{
+    for (size_t i = used; i < row.size(); ++i) {
+        if (row[i] != sentinel) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool report(const char* kernel, const char* set, size_t width)
+{
+    std::fprintf(
+        stderr,
+        "%s kernel of %s disagrees at width %zu\n",
+        kernel,
+        set,
+        width);
+    return false;
+}
+
+bool check_convert(
+    const char* kernel,
+    const pixel_kernels::kernel_set& set,
+    pixel_kernels::convert_row candidate,
+    pixel_kernels::convert_row reference,
+    size_t source_bytes,
+    size_t target_bytes)
+{
+    for (size_t width = 0; width <= max_width; ++width) {
+        const auto source = source_row(width * source_bytes);
+        std::vector<uint8_t> expected(width * target_bytes + guard, sentinel);
+        std::vector<uint8_t> actual(expected.size(), sentinel);
+        reference(source.data(), expected.data(), width);
+        candidate(source.data(), actual.data(), width);
+        if (actual != expected ||
+            !guard_intact(actual, width * target_bytes)) {
+            return report(kernel, set.name, width);
+        }
+    }
+    return true;
+}
+
+bool check_split(
+    const char* kernel,
+    const pixel_kernels::kernel_set& set,
+    pixel_kernels::split_row candidate,
+    pixel_kernels::split_row reference,
+    size_t sample_bytes)
+{
+    for (size_t width = 0; width <= max_width; ++width) {
+        const auto plane = width * sample_bytes;
+        const auto source = source_row(3 * plane);
+        std::vector<uint8_t> expected(3 * (plane + guard), sentinel);
+        std::vector<uint8_t> actual(expected.size(), sentinel);
+        const auto stride = plane + guard;
+        reference(
+            source.data(),
+            expected.data(),
+            expected.data() + stride,
+            expected.data() + 2 * stride,
+            width);
+        candidate(
+            source.data(),
+            actual.data(),
+            actual.data() + stride,
+            actual.data() + 2 * stride,
+            width);
+        if (actual != expected) {
+            return report(kernel, set.name, width);
+        }
+    }
+    return true;
+}
+
+bool check_scale(
+    const char* kernel,
+    const pixel_kernels::kernel_set& set,
+    pixel_kernels::scale_row candidate,
+    pixel_kernels::scale_row reference,
+    size_t source_bytes)
+{
+    // Exactly representable results, so fused and separate multiply-add
+    // agree bit for bit.
+    for (size_t width = 0; width <= max_width; ++width) {
+        const auto source = source_row(width * source_bytes);
+        std::vector<uint8_t> expected(width * 4 + guard, sentinel);
+        std::vector<uint8_t> actual(expected.size(), sentinel);
+        reference(source.data(), expected.data(), width, 0.5f, -3.0f);
+        candidate(source.data(), actual.data(), width, 0.5f, -3.0f);
+        if (actual != expected || !guard_intact(actual, width * 4)) {
+            return report(kernel, set.name, width);
+        }
+    }
+    return true;
+}
+
+bool check_accumulate(
+    const char* kernel,
+    const pixel_kernels::kernel_set& set,
+    pixel_kernels::accumulate_row candidate,
+    pixel_kernels::accumulate_row reference,
+    size_t source_bytes,
+    size_t accumulator_bytes,
+    bool floating)
+{
+    for (size_t width = 0; width <= max_width; ++width) {
+        const auto source = floating
+            ? float_row(width, 3u)
+            : source_row(width * source_bytes);
+        auto expected = floating
+            ? float_row(width, 7u)
+            : source_row(width * accumulator_bytes, 200u);
+        expected.resize(width * accumulator_bytes + guard, sentinel);
+        auto actual = expected;
+        reference(source.data(), expected.data(), width);
+        candidate(source.data(), actual.data(), width);
+        if (actual != expected ||
+            !guard_intact(actual, width * accumulator_bytes)) {
+            return report(kernel, set.name, width);
+        }
+    }
+    return true;
+}
+
+bool check_reference()
+{
+    const auto& scalar = pixel_kernels::scalar_kernels();
+
+    const uint8_t bgr[6] = {1, 2, 3, 4, 5, 6};
+    const uint8_t rgb[6] = {3, 2, 1, 6, 5, 4};
+    uint8_t swapped[6] = {};
+    scalar.bgr24_to_rgb24(bgr, swapped, 2);
+
+    uint8_t red[2] = {};
+    uint8_t green[2] = {};
+    uint8_t blue[2] = {};
+    scalar.bgr24_to_planar(bgr, red, green, blue, 2);
+
+    const uint16_t gray16 = 1000;
+    uint8_t gray16_bytes[2];
+    std::memcpy(gray16_bytes, &gray16, sizeof(gray16));
+    float converted = 0.0f;
+    uint8_t converted_bytes[4];
+    scalar.gray16_to_f32(gray16_bytes, converted_bytes, 1, 0.25f, 1.0f);
+    std::memcpy(&converted, converted_bytes, sizeof(converted));
+
+    const uint16_t samples[2] = {65535, 7};
+    uint32_t sums[2] = {1, 4000000000u};
+    uint16_t maxima[2] = {9, 9};
+    uint8_t sample_bytes[4];
+    uint8_t sum_bytes[8];
+    uint8_t maximum_bytes[4];
+    std::memcpy(sample_bytes, samples, sizeof(samples));
+    std::memcpy(sum_bytes, sums, sizeof(sums));
+    std::memcpy(maximum_bytes, maxima, sizeof(maxima));
+    scalar.add_u16(sample_bytes, sum_bytes, 2);
+    scalar.max_u16(sample_bytes, maximum_bytes, 2);
+    std::memcpy(sums, sum_bytes, sizeof(sums));
+    std::memcpy(maxima, maximum_bytes, sizeof(maxima));
+
+    if (std::memcmp(swapped, rgb, sizeof(rgb)) != 0 || red[1] != 6 ||
+        green[1] != 5 || blue[1] != 4 || converted != 251.0f ||
+        sums[0] != 65536u || sums[1] != 4000000007u || maxima[0] != 65535 ||
+        maxima[1] != 9) {
+        std::fprintf(stderr, "scalar kernels are wrong\n");
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main()
+{
+    if (!check_reference()) {
+        return 1;
+    }
+
+    const auto& scalar = pixel_kernels::scalar_kernels();
+    for (const auto* set : pixel_kernels::supported_kernels()) {
+        const bool ok =
+            check_convert(
+                "bgr24_to_rgb24",
+                *set,
+                set->bgr24_to_rgb24,
+                scalar.bgr24_to_rgb24,
+                3,
+                3) &&
+            check_convert(
+                "bgr48_to_rgb48",
+                *set,
+                set->bgr48_to_rgb48,
+                scalar.bgr48_to_rgb48,
+                6,
+                6) &&
+            check_split(
+                "bgr24_to_planar",
+                *set,
+                set->bgr24_to_planar,
+                scalar.bgr24_to_planar,
+                1) &&
+            check_split(
+                "bgr48_to_planar",
+                *set,
+                set->bgr48_to_planar,
+                scalar.bgr48_to_planar,
+                2) &&
+            check_convert(
+                "gray8_to_u16",
+                *set,
+                set->gray8_to_u16,
+                scalar.gray8_to_u16,
+                1,
+                2) &&
+            check_scale(
+                "gray8_to_f32",
+                *set,
+                set->gray8_to_f32,
+                scalar.gray8_to_f32,
+                1) &&
+            check_scale(
+                "gray16_to_f32",
+                *set,
+                set->gray16_to_f32,
+                scalar.gray16_to_f32,
+                2) &&
+            check_accumulate(
+                "add_u8",
+                *set,
+                set->add_u8,
+                scalar.add_u8,
+                1,
+                4,
+                false) &&
+            check_accumulate(
+                "add_u16",
+                *set,
+                set->add_u16,
+                scalar.add_u16,
+                2,
+                4,
+                false) &&
+            check_accumulate(
+                "add_f32",
+                *set,
+                set->add_f32,
+                scalar.add_f32,
+                4,
+                4,
+                true) &&
+            check_accumulate(
+                "max_u8",
+                *set,
+                set->max_u8,
+                scalar.max_u8,
+                1,
+                1,
+                false) &&
+            check_accumulate(
+                "max_u16",
+                *set,
+                set->max_u16,
+                scalar.max_u16,
+                2,
+                2,
+                false) &&
+            check_accumulate(
+                "max_f32",
+                *set,
+                set->max_f32,
+                scalar.max_f32,
+                4,
+                4,
+                true);
+        if (!ok) {
+            return 2;
+        }
+        std::printf("pixel kernels %s: ok\n", set->name);
+    }
+
+    std::printf(
+        "active pixel kernels: %s\n",
+        pixel_kernels::active_kernels().name);
+    return 0;
+}
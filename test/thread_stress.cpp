@@ -0,0 +1,299 @@
+#include "libczi_julia.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+
+/*
+ * Many threads share one reader and decode the same subblocks over and over
+ * in different orders; every result must match a single-threaded pass.
+ */
+constexpr int32_t max_subblocks = 256;
+constexpr int rounds = 8;
+
+struct expected_subblock {
+    lcj_subblock_info info;
+    std::vector<uint8_t> pixels;
+    size_t row_bytes;
+};
+
+bool check(lcj_status status, const char* operation)
+{
+    if (status == LCJ_OK) {
+        return true;
+    }
+
+    std::fprintf(
+        stderr,
+        "%s failed (%d): %s\n",
+        operation,
+        static_cast<int>(status),
+        lcj_last_error_message());
+    return false;
+}
+
+bool decode(
+    lcj_reader* reader,
+    int32_t index,
+    std::vector<uint8_t>& pixels,
+    size_t& row_bytes)
+{
+    lcj_bitmap* bitmap = nullptr;
+    lcj_bitmap_info info;
+    bool ok = check(
+                  lcj_reader_read_subblock_bitmap(reader, index, &bitmap),
+                  "lcj_reader_read_subblock_bitmap") &&
+        check(lcj_bitmap_get_info(bitmap, &info), "lcj_bitmap_get_info");
+    if (ok) {
+        row_bytes = static_cast<size_t>(info.row_bytes);
+        pixels.resize(row_bytes * info.height);
+        ok = check(
+            lcj_bitmap_copy(bitmap, pixels.data(), pixels.size(), row_bytes),
+            "lcj_bitmap_copy");
+    }
+    lcj_bitmap_close(bitmap);
+    return ok;
+}
+
+bool load_expected(
+    lcj_reader* reader,
+    std::vector<expected_subblock>& expected)
+{
+    lcj_statistics statistics;
+    if (!check(
+            lcj_reader_statistics(reader, &statistics),
+            "lcj_reader_statistics")) {
+        return false;
+    }
+
+    const auto count = std::min(statistics.subblock_count, max_subblocks);
+    expected.resize(static_cast<size_t>(std::max(count, 0)));
+    for (int32_t index = 0; index < count; ++index) {
+        auto& subblock = expected[static_cast<size_t>(index)];
+        if (!check(
+                lcj_reader_subblock_info(reader, index, &subblock.info),
+                "lcj_reader_subblock_info") ||
+            !decode(reader, index, subblock.pixels, subblock.row_bytes)) {
+            return false;
+        }
+    }
+    return !expected.empty();
+}
+
+bool read_concurrently(
+    lcj_reader* reader,
+    const std::vector<expected_subblock>& expected,
+    unsigned thread_count)
+{
+    std::atomic<unsigned> waiting{thread_count};
+    std::atomic<bool> failed{false};
+
+    const auto work = [&](unsigned thread) {
+        // Start together so the reads actually overlap.
+        waiting.fetch_sub(1);
+        while (waiting.load() != 0) {
+            std::this_thread::yield();
+        }
+
+        std::vector<uint8_t> pixels;
+        const auto count = expected.size();
+        for (int round = 0; round < rounds && !failed.load(); ++round) {
+            for (size_t step = 0; step < count && !failed.load(); ++step) {
+                // Threads walk forwards or backwards from their own offset.
+                const auto offset = (thread * 7u + step) % count;
+                const auto position =
+                    (thread + round) % 2 == 0 ? offset : count - 1 - offset;
+                const auto index = static_cast<int32_t>(position);
+                const auto& subblock = expected[position];
+
+                lcj_subblock_info info;
+                size_t row_bytes = 0;
+                bool ok = check(
+                    lcj_reader_subblock_info(reader, index, &info),
+                    "lcj_reader_subblock_info");
+                if (ok && step % 2 == 0) {
+                    ok = decode(reader, index, pixels, row_bytes);
+                } else if (ok) {
+                    row_bytes = subblock.row_bytes;
+                    pixels.resize(subblock.pixels.size());
+                    ok = check(
+                        lcj_reader_read_subblock_into(
+                            reader,
+                            index,
+                            pixels.data(),
+                            pixels.size(),
+                            row_bytes),
+                        "lcj_reader_read_subblock_into");
+                }
+                if (ok &&
+                    (std::memcmp(&info, &subblock.info, sizeof(info)) != 0 ||
+                     row_bytes != subblock.row_bytes ||
+                     pixels != subblock.pixels)) {
+                    std::fprintf(
+                        stderr,
+                        "thread %u read subblock %d differently\n",
+                        thread,
+                        static_cast<int>(index));
+                    ok = false;
+                }
+                if (!ok) {
+                    failed.store(true);
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned thread = 0; thread < thread_count; ++thread) {
+        threads.emplace_back(work, thread);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return !failed.load();
+}
+
+/*
+ * Threads share one bitmap, interleaving nested locks with copies, and must
+ * all see the pixels of the single-threaded pass.
+ */
+bool share_bitmap(
+    lcj_reader* reader,
+    const expected_subblock& expected,
+    unsigned thread_count)
+{
+    lcj_bitmap* bitmap = nullptr;
+    if (!check(
+            lcj_reader_read_subblock_bitmap(reader, 0, &bitmap),
+            "lcj_reader_read_subblock_bitmap")) {
+        return false;
+    }
+
+    std::atomic<unsigned> waiting{thread_count};
+    std::atomic<bool> failed{false};
+    const auto height = expected.row_bytes == 0
+        ? size_t{0}
+        : expected.pixels.size() / expected.row_bytes;
+
+    const auto work = [&](unsigned thread) {
+        waiting.fetch_sub(1);
+        while (waiting.load() != 0) {
+            std::this_thread::yield();
+        }
+
+        std::vector<uint8_t> pixels(expected.pixels.size());
+        for (int round = 0; round < 64 * rounds && !failed.load(); ++round) {
+            const void* data = nullptr;
+            const void* nested = nullptr;
+            size_t stride = 0;
+            size_t nested_stride = 0;
+            bool ok = check(
+                          lcj_bitmap_lock(bitmap, &data, &stride),
+                          "lcj_bitmap_lock") &&
+                check(
+                    lcj_bitmap_lock(bitmap, &nested, &nested_stride),
+                    "lcj_bitmap_lock");
+            for (size_t y = 0; ok && y < height; ++y) {
+                ok = std::memcmp(
+                         static_cast<const uint8_t*>(data) + y * stride,
+                         expected.pixels.data() + y * expected.row_bytes,
+                         expected.row_bytes) == 0;
+            }
+            ok = ok && nested == data && nested_stride == stride &&
+                check(lcj_bitmap_unlock(bitmap), "lcj_bitmap_unlock") &&
+                check(
+                    lcj_bitmap_copy(
+                        bitmap,
+                        pixels.data(),
+                        pixels.size(),
+                        expected.row_bytes),
+                    "lcj_bitmap_copy") &&
+                check(lcj_bitmap_unlock(bitmap), "lcj_bitmap_unlock") &&
+                pixels == expected.pixels;
+            if (!ok) {
+                std::fprintf(
+                    stderr,
+                    "thread %u saw the shared bitmap differently\n",
+                    thread);
+                failed.store(true);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned thread = 0; thread < thread_count; ++thread) {
+        threads.emplace_back(work, thread);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Every lock was released, so one more unlock must be refused.
+    const bool balanced = lcj_bitmap_unlock(bitmap) == LCJ_INVALID_ARGUMENT;
+    if (!balanced) {
+        std::fprintf(stderr, "shared bitmap lock count is unbalanced\n");
+    }
+    lcj_bitmap_close(bitmap);
+    return !failed.load() && balanced;
+}
+
+bool stress(
+    const char* path,
+    const char* label,
+    const lcj_reader_options& options,
+    unsigned thread_count)
+{
+    lcj_reader* reader = nullptr;
+    std::vector<expected_subblock> expected;
+    const bool ok = check(
+                        lcj_reader_open_utf8_ex(path, &options, &reader),
+                        "lcj_reader_open_utf8_ex") &&
+        load_expected(reader, expected) &&
+        read_concurrently(reader, expected, thread_count) &&
+        share_bitmap(reader, expected.front(), thread_count);
+    lcj_reader_close(reader);
+    if (ok) {
+        std::printf(
+            "%s: %u threads x %zu subblocks x %d rounds ok\n",
+            label,
+            thread_count,
+            expected.size(),
+            rounds);
+    }
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        std::fprintf(stderr, "usage: %s FILE.czi\n", argv[0]);
+        return 2;
+    }
+
+    const auto thread_count =
+        std::max(4u, std::thread::hardware_concurrency());
+
+    lcj_reader_options options{};
+    if (!stress(argv[1], "default stream", options, thread_count)) {
+        return 1;
+    }
+
+    options.stream = LCJ_STREAM_LIBCZI;
+    if (!stress(argv[1], "libCZI stream", options, thread_count)) {
+        return 1;
+    }
+
+    options.stream = LCJ_STREAM_MMAP;
+    options.cache_max_bytes = 16u << 20;
+    if (!stress(argv[1], "cached mmap stream", options, thread_count)) {
+        return 1;
+    }
+    return 0;
+}